@@ -45,6 +45,7 @@
 #include "qapi/qapi-visit-common.h"
 #include "sysemu/reset.h"
 #include "qemu/guest-random.h"
+#include "qemu/rcu.h"
 #include "sysemu/hw_accel.h"
 #include "kvm-cpus.h"
 
@@ -104,6 +105,9 @@ struct KVMState
     OnOffAuto kernel_irqchip_split;
     bool sync_mmu;
     uint64_t manual_dirty_log_protect;
+    /* Number of kvm_dirty_gfn entries per vCPU ring; 0 if disabled */
+    uint32_t kvm_dirty_ring_size;
+    QemuThread kvm_dirty_ring_reaper;
     /* The man page (and posix) say ioctl numbers are signed int, but
      * they're not.  Linux, glibc and *BSD all treat ioctl numbers as
      * unsigned, and treating them as signed here can break things */
@@ -176,8 +180,15 @@ typedef struct KVMResampleFd KVMResampleFd;
 static QLIST_HEAD(, KVMResampleFd) kvm_resample_fd_list =
     QLIST_HEAD_INITIALIZER(kvm_resample_fd_list);
 
-#define kvm_slots_lock(kml)      qemu_mutex_lock(&(kml)->slots_lock)
-#define kvm_slots_unlock(kml)    qemu_mutex_unlock(&(kml)->slots_lock)
+/*
+ * Protects the slots of all the KVMMemoryListeners and everything inside
+ * them.  It also serializes the harvesting of the vCPU dirty rings, whose
+ * entries are looked up in the slots of every address space.
+ */
+static QemuMutex kml_slots_lock;
+
+#define kvm_slots_lock()    qemu_mutex_lock(&kml_slots_lock)
+#define kvm_slots_unlock()  qemu_mutex_unlock(&kml_slots_lock)
 
 static inline void kvm_resample_fd_remove(int gsi)
 {
@@ -242,7 +253,7 @@ int kvm_memcrypt_encrypt_data(uint8_t *ptr, uint64_t len)
     return 1;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 {
     KVMState *s = kvm_state;
@@ -263,14 +274,14 @@ bool kvm_has_free_slot(MachineState *ms)
     bool result;
     KVMMemoryListener *kml = &s->memory_listener;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     result = !!kvm_get_free_slot(kml);
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return result;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
 {
     KVMSlot *slot = kvm_get_free_slot(kml);
@@ -331,7 +342,7 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
     KVMMemoryListener *kml = &s->memory_listener;
     int i, ret = 0;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &kml->slots[i];
 
@@ -341,7 +352,7 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
             break;
         }
     }
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return ret;
 }
@@ -381,6 +392,230 @@ err:
     return ret;
 }
 
+/*
+ * KVM dirty ring support
+ */
+
+/* Interval between two harvests of the dirty rings by the reaper thread */
+#define KVM_DIRTY_RING_REAP_INTERVAL_MS  1000
+
+/* A run of contiguous dirty pages, in the ram_addr_t space */
+typedef struct KVMDirtyRun {
+    ram_addr_t start;
+    ram_addr_t length;
+} KVMDirtyRun;
+
+static inline uint32_t kvm_dirty_ring_bytes(KVMState *s)
+{
+    return s->kvm_dirty_ring_size * sizeof(struct kvm_dirty_gfn);
+}
+
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    /* Pairs with the kernel publishing the slot/offset of the entry */
+    return qatomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    /* The entry must be consumed before it is handed back to KVM */
+    qatomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+/* Called with kml_slots_lock held */
+static KVMSlot *kvm_dirty_ring_find_slot(KVMState *s, uint32_t slot_id)
+{
+    int as_id = slot_id >> 16;
+    int id = slot_id & 0xffff;
+    int i;
+
+    if (id >= s->nr_slots) {
+        return NULL;
+    }
+
+    for (i = 0; i < s->nr_as; i++) {
+        KVMMemoryListener *kml = s->as[i].ml;
+
+        if (kml && kml->as_id == as_id) {
+            return &kml->slots[id];
+        }
+    }
+
+    return NULL;
+}
+
+static void kvm_dirty_run_flush(KVMDirtyRun *run)
+{
+    uint8_t clients = DIRTY_CLIENTS_NOCODE;
+
+    if (!run->length) {
+        return;
+    }
+
+    if (!global_dirty_log) {
+        clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
+    }
+
+    cpu_physical_memory_set_dirty_range(run->start, run->length, clients);
+    run->length = 0;
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_dirty_ring_mark_page(KVMState *s, KVMDirtyRun *run,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMSlot *mem = kvm_dirty_ring_find_slot(s, slot_id);
+    ram_addr_t psize = qemu_real_host_page_size;
+    ram_addr_t addr;
+
+    if (!mem || offset >= mem->memory_size / psize) {
+        /* The slot went away since the page was dirtied */
+        return;
+    }
+
+    addr = mem->ram_start_offset + offset * psize;
+    if (run->length && run->start + run->length == addr) {
+        run->length += psize;
+        return;
+    }
+
+    kvm_dirty_run_flush(run);
+    run->start = addr;
+    run->length = psize;
+}
+
+/*
+ * Harvest the dirty ring of @cpu into the RAMBlock dirty bitmaps and mark
+ * the harvested entries as collected.  Returns the number of entries.
+ *
+ * Called with kml_slots_lock held.
+ */
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t count = 0, fetch = cpu->kvm_fetch_index;
+    KVMDirtyRun run = {};
+
+    if (!dirty_gfns) {
+        return 0;
+    }
+
+    while (true) {
+        cur = &dirty_gfns[fetch & (ring_size - 1)];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, &run, cur->slot, cur->offset);
+        dirty_gfn_set_collected(cur);
+        trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
+        fetch++;
+        count++;
+    }
+    kvm_dirty_run_flush(&run);
+    cpu->kvm_fetch_index = fetch;
+    cpu->dirty_pages += count;
+
+    return count;
+}
+
+/*
+ * Harvest the dirty ring of @cpu, or the rings of all vCPUs if @cpu is
+ * NULL, and let KVM write-protect the harvested pages again.  Since
+ * KVM_RESET_DIRTY_RINGS acts on the rings of every vCPU, this must be
+ * serialized with the harvesting of the other rings.
+ *
+ * Called with kml_slots_lock held, and with the BQL too if @cpu is NULL.
+ */
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState *cpu)
+{
+    int64_t stamp = get_clock();
+    uint64_t total = 0;
+    int ret;
+
+    if (cpu) {
+        total = kvm_dirty_ring_reap_one(s, cpu);
+    } else {
+        CPU_FOREACH(cpu) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    if (total) {
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret == total);
+    }
+
+    trace_kvm_dirty_ring_reap(total, (get_clock() - stamp) / 1000);
+
+    return total;
+}
+
+static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
+{
+    uint64_t total;
+
+    kvm_slots_lock();
+    total = kvm_dirty_ring_reap_locked(s, cpu);
+    kvm_slots_unlock();
+
+    return total;
+}
+
+static void do_kvm_cpu_synchronize_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+    /* Nothing to do, getting the vCPU out of KVM_RUN is all we need */
+}
+
+/*
+ * Synchronously kick all vCPUs out of KVM_RUN; this makes KVM flush the
+ * hardware dirty buffers (e.g. Intel PML) into the dirty rings.
+ */
+static void kvm_cpu_synchronize_kick_all(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, do_kvm_cpu_synchronize_kick, RUN_ON_CPU_NULL);
+    }
+}
+
+/* Must be called with the BQL held */
+static void kvm_dirty_ring_flush(void)
+{
+    trace_kvm_dirty_ring_flush(0);
+    assert(qemu_mutex_iothread_locked());
+
+    kvm_cpu_synchronize_kick_all();
+    kvm_dirty_ring_reap(kvm_state, NULL);
+
+    trace_kvm_dirty_ring_flush(1);
+}
+
+/*
+ * The reaper harvests the dirty rings periodically, so that the vCPUs
+ * seldom have to exit because their ring is full.
+ */
+static void *kvm_dirty_ring_reaper_thread(void *data)
+{
+    KVMState *s = data;
+
+    rcu_register_thread();
+
+    trace_kvm_dirty_ring_reaper("init");
+
+    while (true) {
+        g_usleep(KVM_DIRTY_RING_REAP_INTERVAL_MS * 1000);
+
+        trace_kvm_dirty_ring_reaper("reap");
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s, NULL);
+        qemu_mutex_unlock_iothread();
+    }
+
+    return NULL;
+}
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -407,6 +642,16 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* Harvest what is left before the ring goes away */
+        kvm_dirty_ring_reap(s, cpu);
+        ret = munmap(cpu->kvm_dirty_gfns, kvm_dirty_ring_bytes(s));
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
@@ -483,6 +728,25 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+#ifdef KVM_DIRTY_LOG_PAGE_OFFSET
+    if (s->kvm_dirty_ring_size) {
+        /* Use MAP_SHARED to share pages with the kernel */
+        cpu->kvm_dirty_gfns = mmap(NULL, kvm_dirty_ring_bytes(s),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            cpu->kvm_dirty_gfns = NULL;
+            ret = -errno;
+            error_setg_errno(errp, -ret,
+                             "kvm_init_vcpu: mmap'ing dirty ring failed (%lu)",
+                             kvm_arch_vcpu_id(cpu));
+            goto err;
+        }
+        cpu->kvm_fetch_index = 0;
+    }
+#endif
+
     ret = kvm_arch_init_vcpu(cpu);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
@@ -511,7 +775,7 @@ static int kvm_mem_flags(MemoryRegion *mr)
     return flags;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
                                  MemoryRegion *mr)
 {
@@ -537,7 +801,7 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
         return 0;
     }
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     while (size && !ret) {
         slot_size = MIN(kvm_max_slot_size, size);
@@ -553,7 +817,7 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
     }
 
 out:
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
     return ret;
 }
 
@@ -632,7 +896,7 @@ static void kvm_memslot_init_dirty_bitmap(KVMSlot *mem)
  * This function will first try to fetch dirty bitmap from the kernel,
  * and then updates qemu's dirty bitmap.
  *
- * NOTE: caller must be with kml->slots_lock held.
+ * NOTE: caller must be with kml_slots_lock held.
  *
  * @kml: the KVM memory listener object
  * @section: the memory section to sync the dirty bitmap with
@@ -824,7 +1088,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
         return ret;
     }
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     for (i = 0; i < s->nr_slots; i++) {
         mem = &kml->slots[i];
@@ -850,7 +1114,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
         }
     }
 
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return ret;
 }
@@ -1133,7 +1397,8 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     int err;
     MemoryRegion *mr = section->mr;
     bool writeable = !mr->readonly && !mr->rom_device;
-    hwaddr start_addr, size, slot_size;
+    hwaddr start_addr, size, slot_size, mr_offset;
+    ram_addr_t ram_start_offset;
     void *ram;
 
     if (!memory_region_is_ram(mr)) {
@@ -1151,11 +1416,13 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
         return;
     }
 
-    /* use aligned delta to align the ram address */
-    ram = memory_region_get_ram_ptr(mr) + section->offset_within_region +
-          (start_addr - section->offset_within_address_space);
+    /* use aligned delta to align the ram address and offset */
+    mr_offset = section->offset_within_region + start_addr -
+                section->offset_within_address_space;
+    ram = memory_region_get_ram_ptr(mr) + mr_offset;
+    ram_start_offset = memory_region_get_ram_addr(mr) + mr_offset;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     if (!add) {
         do {
@@ -1165,7 +1432,15 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 goto out;
             }
             if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-                kvm_physical_sync_dirty_bitmap(kml, section);
+                if (kvm_state->kvm_dirty_ring_size) {
+                    /*
+                     * The rings may still hold pages of the slot; they
+                     * cannot be looked up anymore once it is gone.
+                     */
+                    kvm_dirty_ring_reap_locked(kvm_state, NULL);
+                } else {
+                    kvm_physical_sync_dirty_bitmap(kml, section);
+                }
             }
 
             /* unregister the slot */
@@ -1192,9 +1467,11 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
         mem->memory_size = slot_size;
         mem->start_addr = start_addr;
         mem->ram = ram;
+        mem->ram_start_offset = ram_start_offset;
         mem->flags = kvm_mem_flags(mr);
 
-        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+        if ((mem->flags & KVM_MEM_LOG_DIRTY_PAGES) &&
+            !kvm_state->kvm_dirty_ring_size) {
             /*
              * Reallocate the bmap; it means it doesn't disappear in
              * middle of a migrate.
@@ -1208,12 +1485,13 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             abort();
         }
         start_addr += slot_size;
+        ram_start_offset += slot_size;
         ram += slot_size;
         size -= slot_size;
     } while (size);
 
 out:
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 }
 
 static void kvm_region_add(MemoryListener *listener,
@@ -1240,14 +1518,20 @@ static void kvm_log_sync(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     r = kvm_physical_sync_dirty_bitmap(kml, section);
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
     if (r < 0) {
         abort();
     }
 }
 
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    /* The rings are harvested straight into the RAMBlock dirty bitmaps */
+    kvm_dirty_ring_flush();
+}
+
 static void kvm_log_clear(MemoryListener *listener,
                           MemoryRegionSection *section)
 {
@@ -1342,7 +1626,6 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 {
     int i;
 
-    qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
     kml->as_id = as_id;
 
@@ -1354,10 +1637,15 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
     kml->listener.log_clear = kvm_log_clear;
     kml->listener.priority = 10;
 
+    if (s->kvm_dirty_ring_size) {
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    } else {
+        kml->listener.log_sync = kvm_log_sync;
+    }
+
     memory_listener_register(&kml->listener, as);
 
     for (i = 0; i < s->nr_as; ++i) {
@@ -2018,6 +2306,8 @@ static int kvm_init(MachineState *ms)
 
     s = KVM_STATE(ms->accelerator);
 
+    qemu_mutex_init(&kml_slots_lock);
+
     /*
      * On systems where the kernel can support different base page
      * sizes, host page size may be different from TARGET_PAGE_SIZE,
@@ -2140,10 +2430,45 @@ static int kvm_init(MachineState *ms)
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
 
-    dirty_log_manual_caps =
-        kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
-    dirty_log_manual_caps &= (KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE |
-                              KVM_DIRTY_LOG_INITIALLY_SET);
+    /*
+     * Enable the dirty ring if requested.  It is mutually exclusive with
+     * KVM_GET_DIRTY_LOG, so the manual protection below is not needed.
+     */
+    if (s->kvm_dirty_ring_size) {
+        uint64_t ring_bytes = kvm_dirty_ring_bytes(s);
+        int max_bytes = 0;
+
+#ifdef KVM_DIRTY_LOG_PAGE_OFFSET
+        max_bytes = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+#endif
+        if (max_bytes <= 0) {
+            error_report("KVM dirty ring not available");
+            ret = -EINVAL;
+            goto err;
+        }
+        if (ring_bytes > max_bytes) {
+            error_report("KVM dirty ring size %" PRIu32 " too big "
+                         "(maximum is %zu)", s->kvm_dirty_ring_size,
+                         max_bytes / sizeof(struct kvm_dirty_gfn));
+            ret = -EINVAL;
+            goto err;
+        }
+
+        ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+        if (ret) {
+            error_report("Enabling of KVM dirty ring failed: %s. "
+                         "Suggested minimum value is 1024.", strerror(-ret));
+            goto err;
+        }
+    }
+
+    dirty_log_manual_caps = 0;
+    if (!s->kvm_dirty_ring_size) {
+        dirty_log_manual_caps =
+            kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
+        dirty_log_manual_caps &= (KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE |
+                                  KVM_DIRTY_LOG_INITIALLY_SET);
+    }
     s->manual_dirty_log_protect = dirty_log_manual_caps;
     if (dirty_log_manual_caps) {
         ret = kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0,
@@ -2252,6 +2577,12 @@ static int kvm_init(MachineState *ms)
         assert(!ret);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->kvm_dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     cpus_register_accel(&kvm_cpus);
     return 0;
 
@@ -2547,6 +2878,16 @@ int kvm_cpu_exec(CPUState *cpu)
             DPRINTF("irq_window_open\n");
             ret = EXCP_INTERRUPT;
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /*
+             * Only harvest the ring of this vCPU, and without the BQL,
+             * so that the other vCPUs are not stalled.  KVM lets it run
+             * again once the entries are reset.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            kvm_dirty_ring_reap(kvm_state, cpu);
+            ret = 0;
+            break;
         case KVM_EXIT_SHUTDOWN:
             DPRINTF("shutdown\n");
             qemu_system_reset_request(SHUTDOWN_CAUSE_GUEST_RESET);
@@ -2730,6 +3071,22 @@ bool kvm_has_sync_mmu(void)
     return kvm_state->sync_mmu;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
+/*
+ * Harvest the dirty rings of all vCPUs without kicking them.  Pages that
+ * are still in the hardware dirty buffers are picked up by a later call.
+ */
+void kvm_dirty_ring_reap_all(void)
+{
+    if (kvm_dirty_ring_enabled()) {
+        kvm_dirty_ring_reap(kvm_state, NULL);
+    }
+}
+
 int kvm_has_vcpu_events(void)
 {
     return kvm_state->vcpu_events;
@@ -3143,6 +3500,35 @@ static void kvm_set_kvm_shadow_mem(Object *obj, Visitor *v,
     s->kvm_shadow_mem = value;
 }
 
+static void kvm_get_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty-ring-size must be a power of two");
+        return;
+    }
+
+    s->kvm_dirty_ring_size = value;
+}
+
 static void kvm_set_kernel_irqchip(Object *obj, Visitor *v,
                                    const char *name, void *opaque,
                                    Error **errp)
@@ -3220,6 +3606,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size");
+
+    object_class_property_add(oc, "dirty-ring-size", "uint32",
+        kvm_get_dirty_ring_size, kvm_set_dirty_ring_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-size",
+        "Size of the KVM dirty page ring of each vCPU (0 to disable)");
 }
 
 static const TypeInfo kvm_accel_type = {
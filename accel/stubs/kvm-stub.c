@@ -45,6 +45,15 @@ bool kvm_has_sync_mmu(void)
     return false;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
+void kvm_dirty_ring_reap_all(void)
+{
+}
+
 int kvm_has_many_ioeventfds(void)
 {
     return 0;
@@ -400,6 +400,17 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     return;
 }
 
+/*
+ * With tiered translation, TBs are first generated without running the
+ * optimizer and with CF_TIER0 set.  They count their own executions and
+ * return to the main loop once they have run tcg_tier_up_threshold times
+ * (see gen_tb_start()); they are then replaced by an optimized TB.
+ */
+static inline bool tb_tier0_is_hot(TranslationBlock *tb)
+{
+    return qatomic_read(&tb->exec_count) >= tcg_tier_up_threshold;
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit, uint32_t cf_mask)
@@ -407,14 +418,28 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
     TranslationBlock *tb;
     target_ulong cs_base, pc;
     uint32_t flags;
+    uint32_t gen_cflags = cf_mask;
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
+    if (tb && unlikely(tb_cflags(tb) & CF_TIER0)) {
+        if (tb_tier0_is_hot(tb)) {
+            mmap_lock();
+            tb_phys_invalidate(tb, -1);
+            mmap_unlock();
+            tb = NULL;
+        }
+    } else if (tb == NULL && tcg_tier_up_threshold &&
+               !(cf_mask & CF_USE_ICOUNT)) {
+        /* The exit of a hot TB would look like an expired icount budget */
+        gen_cflags |= CF_TIER0;
+    }
     if (tb == NULL) {
         mmap_lock();
-        tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
+        tb = tb_gen_code(cpu, pc, cs_base, flags, gen_cflags);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
-        qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        tb_jmp_cache_promote(&cpu->tb_jmp_cache[tb_jmp_cache_set(pc)],
+                             tb_jmp_cache_ways - 1, tb);
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
@@ -676,6 +701,11 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
         return;
     }
 
+    if (tb_cflags(tb) & CF_TIER0) {
+        /* A hot tier 0 TB wants to be retranslated, see tb_find() */
+        return;
+    }
+
     /* Instruction counter expired.  */
     assert(icount_enabled());
 #ifndef CONFIG_USER_ONLY
@@ -97,6 +97,61 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
     desc->window_max_entries = max_entries;
 }
 
+/* Return the index of the first entry of the victim tlb set for @page */
+static inline size_t tlb_vtlb_set(CPUTLBDesc *desc, target_ulong page)
+{
+    uint64_t hash = (uint64_t)(page >> TARGET_PAGE_BITS) *
+                    0x9e3779b97f4a7c15ull;
+    size_t n_sets = desc->vsize / CPU_VTLB_WAYS;
+
+    return ((hash >> 32) & (n_sets - 1)) * CPU_VTLB_WAYS;
+}
+
+/**
+ * tlb_vtlb_resize_locked() - resize the victim TLB if necessary
+ * @desc: The CPUTLBDesc portion of the TLB
+ * @window_expired: whether the resize window of the main TLB has expired
+ *
+ * Called with tlb_lock_held, just before the victim TLB is flushed.
+ *
+ * The victim TLB follows the same principle as the main TLB: the number of
+ * entries that were evicted into it since the last flush tells how much
+ * it had to hold.  If that is more than its size, victims were lost and
+ * possibly refilled through tlb_fill, so double it.  If it stays below a
+ * quarter of its size for a whole window, halve it so that flushes and
+ * range invalidations remain cheap.
+ */
+static void tlb_vtlb_resize_locked(CPUTLBDesc *desc, bool window_expired)
+{
+    size_t old_size = desc->vsize;
+    size_t new_size = old_size;
+
+    if (desc->n_victims > desc->window_max_victims) {
+        desc->window_max_victims = desc->n_victims;
+    }
+
+    if (desc->window_max_victims > old_size) {
+        new_size = MIN(old_size << 1, CPU_VTLB_MAX_SIZE);
+    } else if (desc->window_max_victims < old_size / 4 && window_expired) {
+        new_size = MAX(old_size >> 1, CPU_VTLB_MIN_SIZE);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            desc->window_max_victims = desc->n_victims;
+        }
+        return;
+    }
+
+    /* desc->n_victims is cleared by the caller */
+    desc->window_max_victims = 0;
+    desc->vsize = new_size;
+    g_free(desc->vtable);
+    g_free(desc->viotlb);
+    desc->vtable = g_new(CPUTLBEntry, new_size);
+    desc->viotlb = g_new(CPUIOTLBEntry, new_size);
+}
+
 /**
  * tlb_mmu_resize_locked() - perform TLB resize bookkeeping; resize if necessary
  * @desc: The CPUTLBDesc portion of the TLB
@@ -147,6 +202,8 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     int64_t window_len_ns = window_len_ms * 1000 * 1000;
     bool window_expired = now > desc->window_begin_ns + window_len_ns;
 
+    tlb_vtlb_resize_locked(desc, window_expired);
+
     if (desc->n_used_entries > desc->window_max_entries) {
         desc->window_max_entries = desc->n_used_entries;
     }
@@ -218,8 +275,9 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->n_victims = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->vtable, -1, desc->vsize * sizeof(CPUTLBEntry));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -241,6 +299,10 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->iotlb = g_new(CPUIOTLBEntry, n_entries);
+    desc->window_max_victims = 0;
+    desc->vsize = CPU_VTLB_MIN_SIZE;
+    desc->vtable = g_new(CPUTLBEntry, desc->vsize);
+    desc->viotlb = g_new(CPUIOTLBEntry, desc->vsize);
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -282,6 +344,8 @@ void tlb_destroy(CPUState *cpu)
 
         g_free(fast->table);
         g_free(desc->iotlb);
+        g_free(desc->vtable);
+        g_free(desc->viotlb);
     }
 }
 
@@ -321,6 +385,14 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_victim_counts(CPUState *cpu, size_t *phit, size_t *pmiss)
+{
+    CPUArchState *env = cpu->env_ptr;
+
+    *phit = qatomic_read(&env_tlb(env)->c.vtlb_hit_count);
+    *pmiss = qatomic_read(&env_tlb(env)->c.vtlb_miss_count);
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -435,6 +507,23 @@ static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
     return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
 }
 
+/**
+ * tlb_entry_page - return the page mapped by a TLB entry
+ * @te: pointer to a CPUTLBEntry that is not empty
+ */
+static inline target_ulong tlb_entry_page(CPUTLBEntry *te)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr & TLB_INVALID_MASK) {
+        addr = tlb_addr_write(te);
+    }
+    if (addr & TLB_INVALID_MASK) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
 /* Called with tlb_c.lock held */
 static bool tlb_flush_entry_mask_locked(CPUTLBEntry *tlb_entry,
                                         target_ulong page,
@@ -459,10 +548,15 @@ static void tlb_flush_vtlb_page_mask_locked(CPUArchState *env, int mmu_idx,
                                             target_ulong mask)
 {
     CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
-    int k;
+    size_t k, start = 0, end = d->vsize;
 
     assert_cpu_is_self(env_cpu(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    /* A single page can only be in its own set */
+    if (mask == -1) {
+        start = tlb_vtlb_set(d, page);
+        end = start + CPU_VTLB_WAYS;
+    }
+    for (k = start; k < end; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
@@ -1006,7 +1100,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (i = 0; i < env_tlb(env)->d[mmu_idx].vsize; i++) {
             tlb_reset_dirty_range_locked(&env_tlb(env)->d[mmu_idx].vtable[i],
                                          start1, length);
         }
@@ -1039,9 +1133,11 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_set_dirty1_locked(&env_tlb(env)->d[mmu_idx].vtable[k], vaddr);
+        CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+        size_t k, set = tlb_vtlb_set(desc, vaddr);
+
+        for (k = set; k < set + CPU_VTLB_WAYS; k++) {
+            tlb_set_dirty1_locked(&desc->vtable[k], vaddr);
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
@@ -1190,12 +1286,14 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t vidx = tlb_vtlb_set(desc, tlb_entry_page(te)) +
+                      desc->vindex++ % CPU_VTLB_WAYS;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
         copy_tlb_helper_locked(tv, te);
         desc->viotlb[vidx] = desc->iotlb[index];
+        desc->n_victims++;
         tlb_n_used_entries_dec(env, mmu_idx);
     }
 
@@ -1405,11 +1503,12 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
-    size_t vidx;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    size_t vidx, set = tlb_vtlb_set(desc, page);
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
-        CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
+    for (vidx = set; vidx < set + CPU_VTLB_WAYS; ++vidx) {
+        CPUTLBEntry *vtlb = &desc->vtable[vidx];
         target_ulong cmp;
 
         /* elt_ofs might correspond to .addr_write, so use qatomic_read */
@@ -1422,19 +1521,39 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
         if (cmp == page) {
             /* Found entry in victim tlb, swap tlb and iotlb.  */
             CPUTLBEntry tmptlb, *tlb = &env_tlb(env)->f[mmu_idx].table[index];
+            CPUIOTLBEntry tmpio, *io = &desc->iotlb[index];
+            CPUIOTLBEntry *vio = &desc->viotlb[vidx];
 
             qemu_spin_lock(&env_tlb(env)->c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
+            tmpio = *io; *io = *vio;
+
+            /*
+             * The entry coming from the main tlb belongs to the set of its
+             * own page, which need not be the one @page was found in.
+             */
+            if (!tlb_entry_is_empty(&tmptlb)) {
+                size_t nset = tlb_vtlb_set(desc, tlb_entry_page(&tmptlb));
+
+                if (nset != set) {
+                    memset(vtlb, -1, sizeof(*vtlb));
+                    vidx = nset + desc->vindex++ % CPU_VTLB_WAYS;
+                    vtlb = &desc->vtable[vidx];
+                    vio = &desc->viotlb[vidx];
+                }
+            }
             copy_tlb_helper_locked(vtlb, &tmptlb);
+            *vio = tmpio;
             qemu_spin_unlock(&env_tlb(env)->c.lock);
 
-            CPUIOTLBEntry tmpio, *io = &env_tlb(env)->d[mmu_idx].iotlb[index];
-            CPUIOTLBEntry *vio = &env_tlb(env)->d[mmu_idx].viotlb[vidx];
-            tmpio = *io; *io = *vio; *vio = tmpio;
+            qatomic_set(&env_tlb(env)->c.vtlb_hit_count,
+                        env_tlb(env)->c.vtlb_hit_count + 1);
             return true;
         }
     }
+    qatomic_set(&env_tlb(env)->c.vtlb_miss_count,
+                env_tlb(env)->c.vtlb_miss_count + 1);
     return false;
 }
 
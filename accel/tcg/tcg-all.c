@@ -28,6 +28,9 @@
 #include "sysemu/tcg.h"
 #include "sysemu/cpu-timers.h"
 #include "tcg/tcg.h"
+#include "exec/exec-all.h"
+#include "exec/tb-jmp-cache.h"
+#include "qemu/host-utils.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "hw/boards.h"
@@ -39,6 +42,8 @@ struct TCGState {
 
     bool mttcg_enabled;
     unsigned long tb_size;
+    uint32_t tb_jmp_cache_ways;
+    uint32_t tier_up_threshold;
 };
 typedef struct TCGState TCGState;
 
@@ -94,6 +99,7 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->tb_jmp_cache_ways = 1;
 }
 
 bool mttcg_enabled;
@@ -102,6 +108,8 @@ static int tcg_init(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
 
+    tb_jmp_cache_ways = s->tb_jmp_cache_ways;
+    tcg_tier_up_threshold = s->tier_up_threshold;
     tcg_exec_init(s->tb_size * 1024 * 1024);
     mttcg_enabled = s->mttcg_enabled;
     cpus_register_accel(&tcg_cpus);
@@ -168,6 +176,63 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_tb_jmp_cache_ways(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->tb_jmp_cache_ways, errp);
+}
+
+static void tcg_set_tb_jmp_cache_ways(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (!is_power_of_2(value) || value > TB_JMP_CACHE_MAX_WAYS) {
+        error_setg(errp, "tb-jmp-cache-ways must be a power of 2 "
+                   "between 1 and %d", TB_JMP_CACHE_MAX_WAYS);
+        return;
+    }
+    s->tb_jmp_cache_ways = value;
+}
+
+static void tcg_get_tier_up_threshold(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->tier_up_threshold, errp);
+}
+
+static void tcg_set_tier_up_threshold(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value && (value < TCG_TIER_UP_MIN_THRESHOLD ||
+                  value > TCG_TIER_UP_MAX_THRESHOLD)) {
+        error_setg(errp, "tier-up-threshold must be 0 or between %d and %d",
+                   TCG_TIER_UP_MIN_THRESHOLD, TCG_TIER_UP_MAX_THRESHOLD);
+        return;
+    }
+    s->tier_up_threshold = value;
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -185,6 +250,19 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tb-jmp-cache-ways", "int",
+        tcg_get_tb_jmp_cache_ways, tcg_set_tb_jmp_cache_ways,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-jmp-cache-ways",
+        "Associativity of the per-vCPU TB jump cache");
+
+    object_class_property_add(oc, "tier-up-threshold", "int",
+        tcg_get_tier_up_threshold, tcg_set_tier_up_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tier-up-threshold",
+        "Executions before an unoptimized TB is retranslated "
+        "(0 disables tiered translation)");
+
 }
 
 static const TypeInfo tcg_accel_type = {
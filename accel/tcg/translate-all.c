@@ -221,6 +221,8 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+unsigned int tb_jmp_cache_ways = 1;
+unsigned int tcg_tier_up_threshold;
 
 static void page_table_config_init(void)
 {
@@ -1435,6 +1437,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     PageDesc *p;
     uint32_t h;
     tb_page_addr_t phys_pc;
+    unsigned int i;
 
     assert_memory_lock();
 
@@ -1465,10 +1468,12 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
+    h = tb_jmp_cache_set(tb->pc);
     CPU_FOREACH(cpu) {
-        if (qatomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            qatomic_set(&cpu->tb_jmp_cache[h], NULL);
+        for (i = 0; i < tb_jmp_cache_ways; i++) {
+            if (qatomic_read(&cpu->tb_jmp_cache[h + i]) == tb) {
+                qatomic_set(&cpu->tb_jmp_cache[h + i], NULL);
+            }
         }
     }
 
@@ -1699,6 +1704,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cflags &= ~CF_CLUSTER_MASK;
     cflags |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
+    /* A TB that is thrown away after execution never becomes hot */
+    if (cflags & CF_NOCACHE) {
+        cflags &= ~CF_TIER0;
+    }
+
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
         max_insns = CF_COUNT_MASK;
@@ -1729,6 +1739,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -2342,6 +2353,7 @@ struct tb_tree_stats {
     size_t direct_jmp_count;
     size_t direct_jmp2_count;
     size_t cross_page;
+    size_t tier0;
 };
 
 static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
@@ -2358,6 +2370,9 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     if (tb->page_addr[1] != -1) {
         tst->cross_page++;
     }
+    if ((tb->cflags & (CF_TIER0 | CF_INVALID)) == CF_TIER0) {
+        tst->tier0++;
+    }
     if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
         tst->direct_jmp_count++;
         if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
@@ -2372,6 +2387,8 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    uint64_t jc_hits = 0, jc_misses = 0;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2393,6 +2410,8 @@ void dump_exec_info(void)
                 tst.target_size ? (double)tst.host_size / tst.target_size : 0);
     qemu_printf("cross page TB count %zu (%zu%%)\n", tst.cross_page,
                 nb_tbs ? (tst.cross_page * 100) / nb_tbs : 0);
+    qemu_printf("tier 0 TB count     %zu (%zu%%)\n", tst.tier0,
+                nb_tbs ? (tst.tier0 * 100) / nb_tbs : 0);
     qemu_printf("direct jump count   %zu (%zu%%) (2 jumps=%zu %zu%%)\n",
                 tst.direct_jmp_count,
                 nb_tbs ? (tst.direct_jmp_count * 100) / nb_tbs : 0,
@@ -2408,11 +2427,29 @@ void dump_exec_info(void)
                 qatomic_read(&tb_ctx.tb_flush_count));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
+    qemu_printf("CC ops eliminated   %zu\n", tcg_cc_ops_eliminated());
+
+    CPU_FOREACH(cpu) {
+        jc_hits += cpu->tb_jmp_cache_hits;
+        jc_misses += cpu->tb_jmp_cache_misses;
+    }
+    qemu_printf("TB jump cache       %u-way, %" PRIu64 " hits %" PRIu64
+                " misses (%0.1f%% hit rate)\n", tb_jmp_cache_ways,
+                jc_hits, jc_misses,
+                jc_hits ? (jc_hits * 100.0) / (jc_hits + jc_misses) : 0);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    CPU_FOREACH(cpu) {
+        size_t vhit, vmiss;
+
+        tlb_victim_counts(cpu, &vhit, &vmiss);
+        qemu_printf("TLB victim hits     cpu %d: %zu/%zu (%zu%%)\n",
+                    cpu->cpu_index, vhit, vhit + vmiss,
+                    vhit + vmiss ? (vhit * 100) / (vhit + vmiss) : 0);
+    }
     tcg_dump_info();
 }
 
@@ -2416,6 +2416,30 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+/*
+ * Return a host file descriptor from which [offset, offset + bytes) of @blk
+ * can be read directly, see bdrv_get_host_fd().  The caller must hold a
+ * blk_inc_in_flight() reference while it uses the file descriptor.
+ */
+int blk_get_host_fd(BlockBackend *blk, int64_t offset, int64_t bytes,
+                    int64_t *host_offset)
+{
+    int ret;
+
+    ret = blk_check_byte_request(blk, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Bypassing the block layer would skip throttling and request queuing */
+    if (blk->public.throttle_group_member.throttle_state ||
+        qatomic_read(&blk->quiesce_counter)) {
+        return -EBUSY;
+    }
+
+    return bdrv_get_host_fd(blk_bs(blk), offset, bytes, host_offset);
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     return blk->root;
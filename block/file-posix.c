@@ -160,6 +160,7 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool io_uring_fixed_buffers:1;
     bool page_cache_inconsistent:1;
     bool has_fallocate;
     bool needs_alignment;
@@ -172,6 +173,11 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+
+#ifdef CONFIG_LINUX_IO_URING
+    /* Ring that this node holds a fixed buffer reference on, if any */
+    LuringState *fixed_buffers_ring;
+#endif
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -179,9 +185,13 @@ typedef struct BDRVRawReopenState {
     int open_flags;
     bool drop_cache;
     bool check_cache_dropped;
+    bool io_uring_fixed_buffers;
 } BDRVRawReopenState;
 
 static int fd_open(BlockDriverState *bs);
+static void raw_io_uring_unregister_fd(BlockDriverState *bs, int fd);
+static int raw_io_uring_fixed_buffers_ref(BlockDriverState *bs, Error **errp);
+static void raw_io_uring_fixed_buffers_unref(BlockDriverState *bs);
 static int64_t raw_getlength(BlockDriverState *bs);
 
 typedef struct RawPosixAIOData {
@@ -527,6 +537,13 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with io_uring (default: off)",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -582,6 +599,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->io_uring_fixed_buffers = qemu_opt_get_bool(opts,
+                                                  "io-uring-fixed-buffers",
+                                                  false);
+    if (s->io_uring_fixed_buffers && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
@@ -682,6 +707,12 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
         }
+        if (s->io_uring_fixed_buffers) {
+            ret = raw_io_uring_fixed_buffers_ref(bs, errp);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
     }
 #else
     if (s->use_linux_io_uring) {
@@ -772,6 +803,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
     ret = 0;
 fail:
+    if (ret < 0) {
+        raw_io_uring_fixed_buffers_unref(bs);
+    }
     if (ret < 0 && s->fd != -1) {
         qemu_close(s->fd);
     }
@@ -1082,6 +1116,15 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     rs->drop_cache = qemu_opt_get_bool_del(opts, "drop-cache", true);
     rs->check_cache_dropped =
         qemu_opt_get_bool_del(opts, "x-check-cache-dropped", false);
+#ifdef CONFIG_LINUX_IO_URING
+    rs->io_uring_fixed_buffers =
+        qemu_opt_get_bool_del(opts, "io-uring-fixed-buffers", false);
+    if (rs->io_uring_fixed_buffers && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto out;
+    }
+#endif
 
     /* This driver's reopen function doesn't currently allow changing
      * other options, so let's put them back in the original QDict and
@@ -1107,6 +1150,17 @@ static int raw_reopen_prepare(BDRVReopenState *state,
         }
     }
 
+    /*
+     * Turning fixed buffers on can fail if RAM discard is in use, so the
+     * reference is taken here; turning them off only happens on commit.
+     */
+    if (rs->io_uring_fixed_buffers && !s->io_uring_fixed_buffers) {
+        ret = raw_io_uring_fixed_buffers_ref(state->bs, errp);
+        if (ret < 0) {
+            goto out_fd;
+        }
+    }
+
     s->reopen_state = state;
     ret = 0;
 out_fd:
@@ -1127,7 +1181,12 @@ static void raw_reopen_commit(BDRVReopenState *state)
     s->drop_cache = rs->drop_cache;
     s->check_cache_dropped = rs->check_cache_dropped;
     s->open_flags = rs->open_flags;
+    if (!rs->io_uring_fixed_buffers) {
+        raw_io_uring_fixed_buffers_unref(state->bs);
+    }
+    s->io_uring_fixed_buffers = rs->io_uring_fixed_buffers;
 
+    raw_io_uring_unregister_fd(state->bs, s->fd);
     qemu_close(s->fd);
     s->fd = rs->fd;
 
@@ -1149,6 +1208,10 @@ static void raw_reopen_abort(BDRVReopenState *state)
         return;
     }
 
+    if (rs->io_uring_fixed_buffers && !s->io_uring_fixed_buffers) {
+        raw_io_uring_fixed_buffers_unref(state->bs);
+    }
+
     if (rs->fd >= 0) {
         qemu_close(rs->fd);
         rs->fd = -1;
@@ -1994,7 +2057,8 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
     } else if (s->use_linux_io_uring) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
         assert(qiov->size == bytes);
-        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        return luring_co_submit(bs, aio, s->fd, offset, qiov, type,
+                                s->fixed_buffers_ring == aio);
 #endif
 #ifdef CONFIG_LINUX_AIO
     } else if (s->use_linux_aio) {
@@ -2089,7 +2153,8 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH,
+                                false);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
@@ -2111,21 +2176,90 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        Error *local_err;
+        Error *local_err = NULL;
         if (!aio_setup_linux_io_uring(new_context, &local_err)) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
+        } else if (s->io_uring_fixed_buffers) {
+            if (raw_io_uring_fixed_buffers_ref(bs, &local_err) < 0) {
+                error_reportf_err(local_err, "Unable to use io_uring fixed "
+                                             "buffers: ");
+                s->io_uring_fixed_buffers = false;
+            }
         }
     }
 #endif
 }
 
+/*
+ * io_uring keeps files in its registered file table open, so @fd has to be
+ * dropped from the ring before it is closed or used from another AioContext.
+ */
+static void raw_io_uring_unregister_fd(BlockDriverState *bs, int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring && fd >= 0) {
+        luring_unregister_fd(aio_get_linux_io_uring(bdrv_get_aio_context(bs)),
+                             fd);
+    }
+#endif
+}
+
+/*
+ * Fixed buffers pin guest RAM and disable RAM discard, so each node that opted
+ * in holds a reference on the ring of its AioContext only while it uses it.
+ */
+static int raw_io_uring_fixed_buffers_ref(BlockDriverState *bs, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+    int ret;
+
+    if (s->fixed_buffers_ring) {
+        assert(s->fixed_buffers_ring == aio);
+        return 0;
+    }
+
+    ret = luring_fixed_buffers_ref(aio, errp);
+    if (ret < 0) {
+        return ret;
+    }
+    s->fixed_buffers_ring = aio;
+#endif
+    return 0;
+}
+
+static void raw_io_uring_fixed_buffers_unref(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->fixed_buffers_ring) {
+        luring_fixed_buffers_unref(s->fixed_buffers_ring);
+        s->fixed_buffers_ring = NULL;
+    }
+#endif
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    raw_io_uring_unregister_fd(bs, s->fd);
+    raw_io_uring_fixed_buffers_unref(bs);
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    raw_io_uring_fixed_buffers_unref(bs);
     if (s->fd >= 0) {
+        raw_io_uring_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = -1;
     }
@@ -3129,6 +3263,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_io_uring_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3201,6 +3336,46 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
     return raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
 }
 
+static int raw_get_host_fd(BlockDriverState *bs, int64_t offset,
+                           int64_t bytes, int64_t *host_offset)
+{
+    BDRVRawState *s = bs->opaque;
+    uint64_t perm, shared;
+    struct stat st;
+
+    /* The data is sent from the page cache, which O_DIRECT bypasses */
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+
+    /*
+     * The kernel may still reference page cache pages after the transfer
+     * returned, so the data must not change underneath it.
+     */
+    bdrv_get_cumulative_perm(bs, &perm, &shared);
+    if (perm & BLK_PERM_WRITE) {
+        return -EBUSY;
+    }
+
+    if (fd_open(bs) < 0) {
+        return -EIO;
+    }
+
+    /*
+     * The image size is rounded up to sectors and reads past the end of a
+     * regular file return zeroes, but sendfile() stops at its end.
+     */
+    if (fstat(s->fd, &st) < 0) {
+        return -errno;
+    }
+    if (S_ISREG(st.st_mode) && offset + bytes > st.st_size) {
+        return -ENOTSUP;
+    }
+
+    *host_offset = offset;
+    return s->fd;
+}
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -3227,9 +3402,11 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_get_host_fd     = raw_get_host_fd,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
@@ -3601,9 +3778,11 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_pdiscard       = hdev_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_get_host_fd     = raw_get_host_fd,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
@@ -3728,6 +3907,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3858,6 +4038,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3151,6 +3151,27 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                    bytes, read_flags, write_flags);
 }
 
+int bdrv_get_host_fd(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     int64_t *host_offset)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    if (!drv->bdrv_get_host_fd) {
+        return -ENOTSUP;
+    }
+
+    /* Requests must wait for drained sections, and copy-on-read needs them */
+    if (qatomic_read(&bs->quiesce_counter) ||
+        qatomic_read(&bs->copy_on_read)) {
+        return -EBUSY;
+    }
+
+    return drv->bdrv_get_host_fd(bs, offset, bytes, host_offset);
+}
+
 static void bdrv_parent_cb_resize(BlockDriverState *bs)
 {
     BdrvChild *c;
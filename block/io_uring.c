@@ -16,18 +16,40 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/atomic.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
 #include "qapi/error.h"
+#include "exec/cpu-common.h"
+#include "exec/ramlist.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the registered file table of each ring */
+#define MAX_FIXED_FILES 64
+
+/*
+ * The kernel limits a registered buffer to 1 GiB and the number of
+ * registered buffers to UIO_MAXIOV.
+ */
+#define FIXED_BUFFER_MAX_LEN (1ULL << 30)
+#define MAX_FIXED_BUFFERS 1024
+
+/* Older kernels only let the SQPOLL thread access registered files */
+#ifndef IORING_FEAT_SQPOLL_NONFIXED
+#define IORING_FEAT_SQPOLL_NONFIXED (1U << 7)
+#endif
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
+    /* The node opted in to fixed buffers */
+    bool fixed_buffers;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
     /*
@@ -51,13 +73,351 @@ typedef struct LuringState {
 
     struct io_uring ring;
 
+    /*
+     * A kernel thread polls the submission queue, io_uring_submit() only
+     * enters the kernel to wake it up after it went idle.
+     */
+    bool sqpoll;
+    Stat64 sqpoll_wakeups;
+
     /* io queue for submit at batch.  Protected by AioContext lock. */
     LuringQueue io_q;
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Registered file table.  Each slot holds the fd registered in it, or -1
+     * if the slot is free.
+     */
+    bool use_fixed_files;
+    int fixed_fds[MAX_FIXED_FILES];
+
+    /*
+     * Guest RAM registered as fixed buffers, a copy of luring_ram.blocks
+     * taken at generation @fixed_buf_gen.  Only registered while at least
+     * one node that opted in to fixed buffers uses the ring, those nodes
+     * are counted in @fixed_buf_users.
+     */
+    unsigned int fixed_buf_users;
+    unsigned int fixed_buf_gen;
+    unsigned int nr_fixed_bufs;
+    struct iovec *fixed_bufs;
 } LuringState;
 
+/*
+ * Guest RAM blocks for rings that use fixed buffers.  The RAMBlock notifier
+ * and the reference counting run under the BQL; rings read the list from their
+ * own AioContext, so updates are also protected by @lock.  @gen changes
+ * whenever the list does and tells rings to re-register their buffers.
+ */
+static struct {
+    QemuMutex lock;
+    GArray *blocks;
+    unsigned int gen;
+    unsigned int users;
+    RAMBlockNotifier notifier;
+} luring_ram;
+
+static void __attribute__((constructor)) luring_ram_init(void)
+{
+    qemu_mutex_init(&luring_ram.lock);
+    luring_ram.gen = 1;
+}
+
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size)
+{
+    struct iovec iov = {
+        .iov_base = host,
+        .iov_len = size,
+    };
+
+    if (!host || !size) {
+        return;
+    }
+
+    qemu_mutex_lock(&luring_ram.lock);
+    g_array_append_val(luring_ram.blocks, iov);
+    qatomic_set(&luring_ram.gen, luring_ram.gen + 1);
+    qemu_mutex_unlock(&luring_ram.lock);
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size)
+{
+    guint i;
+
+    qemu_mutex_lock(&luring_ram.lock);
+    for (i = 0; i < luring_ram.blocks->len; i++) {
+        if (g_array_index(luring_ram.blocks, struct iovec, i).iov_base ==
+            host) {
+            g_array_remove_index_fast(luring_ram.blocks, i);
+            break;
+        }
+    }
+    qatomic_set(&luring_ram.gen, luring_ram.gen + 1);
+    qemu_mutex_unlock(&luring_ram.lock);
+}
+
+static int luring_ram_block_init(RAMBlock *rb, void *opaque)
+{
+    luring_ram_block_added(&luring_ram.notifier, qemu_ram_get_host_addr(rb),
+                           qemu_ram_get_used_length(rb));
+    return 0;
+}
+
+/*
+ * Fixed buffers stay pinned for as long as they are registered, so discarding
+ * guest RAM (balloon, virtio-mem) has to be disabled while any ring uses them.
+ */
+static int luring_ram_ref(Error **errp)
+{
+    int ret;
+
+    if (luring_ram.users++) {
+        return 0;
+    }
+
+    ret = ram_block_discard_disable(true);
+    if (ret) {
+        luring_ram.users--;
+        error_setg_errno(errp, -ret, "Cannot disable RAM discard for "
+                         "io_uring fixed buffers");
+        return ret;
+    }
+
+    luring_ram.blocks = g_array_new(false, false, sizeof(struct iovec));
+    luring_ram.notifier.ram_block_added = luring_ram_block_added;
+    luring_ram.notifier.ram_block_removed = luring_ram_block_removed;
+    ram_block_notifier_add(&luring_ram.notifier);
+    qemu_ram_foreach_block(luring_ram_block_init, NULL);
+    return 0;
+}
+
+static void luring_ram_unref(void)
+{
+    assert(luring_ram.users);
+    if (--luring_ram.users) {
+        return;
+    }
+
+    ram_block_notifier_remove(&luring_ram.notifier);
+    qemu_mutex_lock(&luring_ram.lock);
+    g_array_free(luring_ram.blocks, true);
+    luring_ram.blocks = NULL;
+    qatomic_set(&luring_ram.gen, luring_ram.gen + 1);
+    qemu_mutex_unlock(&luring_ram.lock);
+    ram_block_discard_disable(false);
+}
+
+/**
+ * luring_update_fixed_buffers:
+ *
+ * Register the current guest RAM layout with the ring if it changed since the
+ * last registration.  Buffers can only be replaced while no request that may
+ * reference them is queued or in flight, so this is retried on the next
+ * submission when the ring is busy.
+ */
+static void luring_update_fixed_buffers(LuringState *s)
+{
+    struct iovec *bufs;
+    unsigned int nr = 0;
+    unsigned int gen;
+    guint i;
+    int ret;
+
+    if (s->io_q.in_queue || s->io_q.in_flight) {
+        return;
+    }
+
+    qemu_mutex_lock(&luring_ram.lock);
+    gen = luring_ram.gen;
+    bufs = g_new(struct iovec, MAX_FIXED_BUFFERS);
+    for (i = 0; i < luring_ram.blocks->len && nr < MAX_FIXED_BUFFERS; i++) {
+        struct iovec *block = &g_array_index(luring_ram.blocks,
+                                             struct iovec, i);
+        size_t done = 0;
+
+        while (done < block->iov_len && nr < MAX_FIXED_BUFFERS) {
+            bufs[nr].iov_base = block->iov_base + done;
+            bufs[nr].iov_len = MIN(block->iov_len - done,
+                                   FIXED_BUFFER_MAX_LEN);
+            done += bufs[nr].iov_len;
+            nr++;
+        }
+    }
+    qemu_mutex_unlock(&luring_ram.lock);
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+    }
+    g_free(s->fixed_bufs);
+
+    ret = nr ? io_uring_register_buffers(&s->ring, bufs, nr) : 0;
+    trace_luring_register_buffers(s, nr, ret);
+    if (ret < 0) {
+        nr = 0;
+    }
+    if (!nr) {
+        g_free(bufs);
+        bufs = NULL;
+    }
+
+    s->fixed_bufs = bufs;
+    s->nr_fixed_bufs = nr;
+    s->fixed_buf_gen = gen;
+}
+
+/**
+ * luring_fixed_buffer:
+ *
+ * Returns the index of the registered buffer that contains all of @qiov, or
+ * -1 if the request has to use readv/writev.
+ */
+static int luring_fixed_buffer(LuringState *s, LuringAIOCB *luringcb)
+{
+    QEMUIOVector *qiov = luringcb->qiov;
+    uintptr_t base, len;
+    unsigned int i;
+
+    if (!luringcb->fixed_buffers || !s->fixed_buf_users) {
+        return -1;
+    }
+    if (s->fixed_buf_gen != qatomic_read(&luring_ram.gen)) {
+        luring_update_fixed_buffers(s);
+        /* A stale table may alias memory that is now mapped elsewhere */
+        if (s->fixed_buf_gen != qatomic_read(&luring_ram.gen)) {
+            return -1;
+        }
+    }
+    if (qiov->niov != 1) {
+        return -1;
+    }
+
+    base = (uintptr_t)qiov->iov[0].iov_base;
+    len = qiov->iov[0].iov_len;
+    for (i = 0; i < s->nr_fixed_bufs; i++) {
+        uintptr_t start = (uintptr_t)s->fixed_bufs[i].iov_base;
+
+        if (base >= start && base - start + len <= s->fixed_bufs[i].iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * luring_fixed_file:
+ *
+ * Returns the registered file table slot for @fd, registering it on first
+ * use, or -1 if the request has to use the plain fd.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int free_slot = -1;
+    int i, ret;
+
+    if (!s->use_fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            return i;
+        }
+        if (s->fixed_fds[i] == -1 && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+    trace_luring_register_file(s, fd, free_slot, ret);
+    if (ret != 1) {
+        return -1;
+    }
+    s->fixed_fds[free_slot] = fd;
+    return free_slot;
+}
+
+/**
+ * luring_unregister_fd:
+ *
+ * Drop @fd from the registered file table of @s.  Must be called before @fd
+ * is closed, or the ring would keep the file open and a new file could be
+ * reached through the stale slot.
+ */
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int unused = -1;
+    int i, ret;
+
+    if (!s->use_fixed_files) {
+        return;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            ret = io_uring_register_files_update(&s->ring, i, &unused, 1);
+            trace_luring_register_file(s, -1, i, ret);
+            s->fixed_fds[i] = -1;
+        }
+    }
+}
+
+/**
+ * luring_fixed_buffers_ref:
+ *
+ * Called for each node that opts in to fixed buffers when it starts using
+ * @s.  The first reference makes @s register guest RAM with the kernel, and
+ * from then on the requests of nodes that opted in use fixed buffers if they
+ * fall inside it.
+ */
+int luring_fixed_buffers_ref(LuringState *s, Error **errp)
+{
+    int ret;
+
+    if (s->fixed_buf_users++) {
+        return 0;
+    }
+
+    ret = luring_ram_ref(errp);
+    if (ret < 0) {
+        s->fixed_buf_users--;
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * luring_fixed_buffers_unref:
+ *
+ * Drop the reference taken by luring_fixed_buffers_ref().  The node must be
+ * drained.  When the last node goes away, guest RAM is unregistered from @s
+ * and, if no other ring uses it either, RAM discard is enabled again.
+ */
+void luring_fixed_buffers_unref(LuringState *s)
+{
+    assert(s->fixed_buf_users);
+    if (--s->fixed_buf_users) {
+        return;
+    }
+
+    /* No remaining node can have a request that uses the buffers */
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        trace_luring_register_buffers(s, 0, 0);
+    }
+    g_free(s->fixed_bufs);
+    s->fixed_bufs = NULL;
+    s->nr_fixed_bufs = 0;
+    s->fixed_buf_gen = 0;
+    luring_ram_unref();
+}
+
 /**
  * luring_resubmit:
  *
@@ -103,6 +463,11 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
                       remaining);
 
     /* Update sqe */
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* resubmit_qiov has no single buffer, fall back to readv */
+        luringcb->sqeq.opcode = IORING_OP_READV;
+        luringcb->sqeq.buf_index = 0;
+    }
     luringcb->sqeq.off = nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
@@ -210,6 +575,7 @@ end:
 static int ioq_submit(LuringState *s)
 {
     int ret = 0;
+    bool sqpoll_wakeup;
     LuringAIOCB *luringcb, *luringcb_next;
 
     while (s->io_q.in_queue > 0) {
@@ -227,8 +593,13 @@ static int ioq_submit(LuringState *s)
             *sqes = luringcb->sqeq;
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
         }
+        sqpoll_wakeup = s->sqpoll &&
+            (qatomic_read(s->ring.sq.kflags) & IORING_SQ_NEED_WAKEUP);
         ret = io_uring_submit(&s->ring);
-        trace_luring_io_uring_submit(s, ret);
+        trace_luring_io_uring_submit(s, ret, sqpoll_wakeup);
+        if (sqpoll_wakeup) {
+            stat64_add(&s->sqpoll_wakeups, 1);
+        }
         /* Prevent infinite loop if submission is refused */
         if (ret <= 0) {
             if (ret == -EAGAIN || ret == -EINTR) {
@@ -328,15 +699,35 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int file = luring_fixed_file(s, fd);
+    int buf_index = -1;
+
+    if (file >= 0) {
+        fd = file;
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        buf_index = luring_fixed_buffer(s, luringcb);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        buf_index = luring_fixed_buffer(s, luringcb);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -346,6 +737,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (file >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -363,14 +757,16 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                  uint64_t offset, QEMUIOVector *qiov, int type)
+                                  uint64_t offset, QEMUIOVector *qiov, int type,
+                                  bool fixed_buffers)
 {
     int ret;
     LuringAIOCB luringcb = {
-        .co         = qemu_coroutine_self(),
-        .ret        = -EINPROGRESS,
-        .qiov       = qiov,
-        .is_read    = (type == QEMU_AIO_READ),
+        .co             = qemu_coroutine_self(),
+        .ret            = -EINPROGRESS,
+        .qiov           = qiov,
+        .is_read        = (type == QEMU_AIO_READ),
+        .fixed_buffers  = fixed_buffers,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
@@ -402,29 +798,66 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
-    trace_luring_init_state(s, sizeof(*s));
+    trace_luring_init_state(s, sizeof(*s), sqpoll, sqpoll_cpu);
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        if (sqpoll_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sqpoll_cpu;
+        }
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        g_free(s);
+        return NULL;
+    }
+
+    if (sqpoll && !(params.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        error_setg(errp, "io_uring SQPOLL needs a host kernel that supports "
+                   "unregistered files");
+        io_uring_queue_exit(ring);
         g_free(s);
         return NULL;
     }
+    s->sqpoll = sqpoll;
+    stat64_init(&s->sqpoll_wakeups, 0);
 
     ioq_init(&s->io_q);
+
+    /*
+     * Start with an empty registered file table, files are added to it when
+     * they are first used.  Older kernels cannot register sparse tables, in
+     * which case requests just keep using plain fds.
+     */
+    memset(s->fixed_fds, -1, sizeof(s->fixed_fds));
+    rc = io_uring_register_files(ring, s->fixed_fds, MAX_FIXED_FILES);
+    s->use_fixed_files = rc == 0;
+
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    /* Nodes drop their reference before the AioContext goes away */
+    assert(!s->fixed_buf_users);
     io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
+
+uint64_t luring_get_sqpoll_wakeups(LuringState *s)
+{
+    return stat64_get(&s->sqpoll_wakeups);
+}
@@ -34,6 +34,7 @@
 #include "qemu/uri.h"
 #include "qemu/option.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 
 #include "qapi/qapi-visit-sockets.h"
@@ -46,9 +47,10 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_MULTI_CONN      16
 
-#define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
-#define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
+#define HANDLE_TO_INDEX(cs, handle) ((handle) ^ (uint64_t)(intptr_t)(cs))
+#define INDEX_TO_HANDLE(cs, index)  ((index)  ^ (uint64_t)(intptr_t)(cs))
 
 typedef struct {
     Coroutine *coroutine;
@@ -104,7 +106,13 @@ typedef struct NBDConnectThread {
     AioContext *bh_ctx; /* where to schedule bh (NULL means don't schedule) */
 } NBDConnectThread;
 
-typedef struct BDRVNBDState {
+typedef struct BDRVNBDState BDRVNBDState;
+
+/* State of one of the connections to the server */
+typedef struct NBDConnState {
+    BDRVNBDState *s;
+    unsigned int index;
+
     QIOChannelSocket *sioc; /* The master data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
     NBDExportInfo info;
@@ -114,7 +122,6 @@ typedef struct BDRVNBDState {
     Coroutine *connection_co;
     Coroutine *teardown_co;
     QemuCoSleepState *connection_co_sleep_ns_state;
-    bool drained;
     bool wait_drained_end;
     int in_flight;
     NBDClientState state;
@@ -126,9 +133,45 @@ typedef struct BDRVNBDState {
 
     NBDClientRequest requests[MAX_NBD_REQUESTS];
     NBDReply reply;
+
+    bool wait_connect;
+    NBDConnectThread *connect_thread;
+
+    /* Statistics for query-blockstats */
+    uint64_t nr_requests;
+    uint64_t rd_bytes;
+    uint64_t wr_bytes;
+} NBDConnState;
+
+struct BDRVNBDState {
+    /*
+     * Requests are striped across all connections.  Only the first one is
+     * used unless the server advertises NBD_FLAG_CAN_MULTI_CONN, which
+     * guarantees that a flush on one connection covers writes completed on
+     * any of them.
+     */
+    NBDConnState *conns[MAX_MULTI_CONN];
+    uint32_t num_conns;
+    uint32_t next_conn;
+
+    /*
+     * The export parameters negotiated when the first connection was
+     * opened.  Every connection and reconnection must agree with them.
+     */
+    NBDExportInfo info;
+
+    /*
+     * If a reconnection finds that the server stopped advertising
+     * NBD_FLAG_CAN_MULTI_CONN, all requests go to that connection from
+     * then on, and the others are not reconnected any more.
+     */
+    NBDConnState *single_conn;
+
+    bool drained;
     BlockDriverState *bs;
 
     /* Connection parameters */
+    uint32_t multi_conn;
     uint32_t reconnect_delay;
     SocketAddress *saddr;
     char *export, *tlscredsid;
@@ -136,18 +179,14 @@ typedef struct BDRVNBDState {
     const char *hostname;
     char *x_dirty_bitmap;
     bool alloc_depth;
-
-    bool wait_connect;
-    NBDConnectThread *connect_thread;
-} BDRVNBDState;
+};
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
                                                   Error **errp);
-static QIOChannelSocket *nbd_co_establish_connection(BlockDriverState *bs,
+static QIOChannelSocket *nbd_co_establish_connection(NBDConnState *cs,
                                                      Error **errp);
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
-                                               bool detach);
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static void nbd_co_establish_connection_cancel(NBDConnState *cs, bool detach);
+static int nbd_client_handshake(NBDConnState *cs, QIOChannelSocket *sioc,
                                 Error **errp);
 
 static void nbd_clear_bdrvstate(BDRVNBDState *s)
@@ -163,27 +202,27 @@ static void nbd_clear_bdrvstate(BDRVNBDState *s)
     s->x_dirty_bitmap = NULL;
 }
 
-static void nbd_channel_error(BDRVNBDState *s, int ret)
+static void nbd_channel_error(NBDConnState *cs, int ret)
 {
     if (ret == -EIO) {
-        if (s->state == NBD_CLIENT_CONNECTED) {
-            s->state = s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
+        if (cs->state == NBD_CLIENT_CONNECTED) {
+            cs->state = cs->s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
                                             NBD_CLIENT_CONNECTING_NOWAIT;
         }
     } else {
-        if (s->state == NBD_CLIENT_CONNECTED) {
-            qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        if (cs->state == NBD_CLIENT_CONNECTED) {
+            qio_channel_shutdown(cs->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
         }
-        s->state = NBD_CLIENT_QUIT;
+        cs->state = NBD_CLIENT_QUIT;
     }
 }
 
-static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
+static void nbd_recv_coroutines_wake_all(NBDConnState *cs)
 {
     int i;
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        NBDClientRequest *req = &s->requests[i];
+        NBDClientRequest *req = &cs->requests[i];
 
         if (req->coroutine && req->receiving) {
             aio_co_wake(req->coroutine);
@@ -191,56 +230,62 @@ static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
     }
 }
 
-static void reconnect_delay_timer_del(BDRVNBDState *s)
+static void reconnect_delay_timer_del(NBDConnState *cs)
 {
-    if (s->reconnect_delay_timer) {
-        timer_del(s->reconnect_delay_timer);
-        timer_free(s->reconnect_delay_timer);
-        s->reconnect_delay_timer = NULL;
+    if (cs->reconnect_delay_timer) {
+        timer_del(cs->reconnect_delay_timer);
+        timer_free(cs->reconnect_delay_timer);
+        cs->reconnect_delay_timer = NULL;
     }
 }
 
 static void reconnect_delay_timer_cb(void *opaque)
 {
-    BDRVNBDState *s = opaque;
+    NBDConnState *cs = opaque;
 
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-        while (qemu_co_enter_next(&s->free_sema, NULL)) {
+    if (cs->state == NBD_CLIENT_CONNECTING_WAIT) {
+        cs->state = NBD_CLIENT_CONNECTING_NOWAIT;
+        while (qemu_co_enter_next(&cs->free_sema, NULL)) {
             /* Resume all queued requests */
         }
     }
 
-    reconnect_delay_timer_del(s);
+    reconnect_delay_timer_del(cs);
 }
 
-static void reconnect_delay_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
+static void reconnect_delay_timer_init(NBDConnState *cs,
+                                       uint64_t expire_time_ns)
 {
-    if (s->state != NBD_CLIENT_CONNECTING_WAIT) {
+    if (cs->state != NBD_CLIENT_CONNECTING_WAIT) {
         return;
     }
 
-    assert(!s->reconnect_delay_timer);
-    s->reconnect_delay_timer = aio_timer_new(bdrv_get_aio_context(s->bs),
-                                             QEMU_CLOCK_REALTIME,
-                                             SCALE_NS,
-                                             reconnect_delay_timer_cb, s);
-    timer_mod(s->reconnect_delay_timer, expire_time_ns);
+    assert(!cs->reconnect_delay_timer);
+    cs->reconnect_delay_timer = aio_timer_new(bdrv_get_aio_context(cs->s->bs),
+                                              QEMU_CLOCK_REALTIME,
+                                              SCALE_NS,
+                                              reconnect_delay_timer_cb, cs);
+    timer_mod(cs->reconnect_delay_timer, expire_time_ns);
 }
 
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
+
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnState *cs = s->conns[i];
 
-    /* Timer is deleted in nbd_client_co_drain_begin() */
-    assert(!s->reconnect_delay_timer);
-    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+        /* Timer is deleted in nbd_client_co_drain_begin() */
+        assert(!cs->reconnect_delay_timer);
+        qio_channel_detach_aio_context(QIO_CHANNEL(cs->ioc));
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = opaque;
+    BlockDriverState *bs = cs->s->bs;
 
     /*
      * The node is still drained, so we know the coroutine has yielded in
@@ -248,7 +293,7 @@ static void nbd_client_attach_aio_context_bh(void *opaque)
      * entered for the first time. Both places are safe for entering the
      * coroutine.
      */
-    qemu_aio_coroutine_enter(bs->aio_context, s->connection_co);
+    qemu_aio_coroutine_enter(bs->aio_context, cs->connection_co);
     bdrv_dec_in_flight(bs);
 }
 
@@ -256,118 +301,150 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
                                           AioContext *new_context)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    /*
-     * s->connection_co is either yielded from nbd_receive_reply or from
-     * nbd_co_reconnect_loop()
-     */
-    if (s->state == NBD_CLIENT_CONNECTED) {
-        qio_channel_attach_aio_context(QIO_CHANNEL(s->ioc), new_context);
-    }
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnState *cs = s->conns[i];
 
-    bdrv_inc_in_flight(bs);
+        /*
+         * cs->connection_co is either yielded from nbd_receive_reply or from
+         * nbd_co_reconnect_loop()
+         */
+        if (cs->state == NBD_CLIENT_CONNECTED) {
+            qio_channel_attach_aio_context(QIO_CHANNEL(cs->ioc), new_context);
+        }
 
-    /*
-     * Need to wait here for the BH to run because the BH must run while the
-     * node is still drained.
-     */
-    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, bs);
+        bdrv_inc_in_flight(bs);
+
+        /*
+         * Need to wait here for the BH to run because the BH must run while
+         * the node is still drained.
+         */
+        aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, cs);
+    }
 }
 
 static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
     s->drained = true;
-    if (s->connection_co_sleep_ns_state) {
-        qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
-    }
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnState *cs = s->conns[i];
 
-    nbd_co_establish_connection_cancel(bs, false);
+        if (cs->connection_co_sleep_ns_state) {
+            qemu_co_sleep_wake(cs->connection_co_sleep_ns_state);
+        }
 
-    reconnect_delay_timer_del(s);
+        nbd_co_establish_connection_cancel(cs, false);
 
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-        qemu_co_queue_restart_all(&s->free_sema);
+        reconnect_delay_timer_del(cs);
+
+        if (cs->state == NBD_CLIENT_CONNECTING_WAIT) {
+            cs->state = NBD_CLIENT_CONNECTING_NOWAIT;
+            qemu_co_queue_restart_all(&cs->free_sema);
+        }
     }
 }
 
 static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
     s->drained = false;
-    if (s->wait_drained_end) {
-        s->wait_drained_end = false;
-        aio_co_wake(s->connection_co);
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        if (cs->wait_drained_end) {
+            cs->wait_drained_end = false;
+            aio_co_wake(cs->connection_co);
+        }
     }
 }
 
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(NBDConnState *cs)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
-    if (s->ioc) {
+    if (cs->ioc) {
         /* finish any pending coroutines */
-        qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
-    } else if (s->sioc) {
+        qio_channel_shutdown(cs->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    } else if (cs->sioc) {
         /* abort negotiation */
-        qio_channel_shutdown(QIO_CHANNEL(s->sioc), QIO_CHANNEL_SHUTDOWN_BOTH,
+        qio_channel_shutdown(QIO_CHANNEL(cs->sioc), QIO_CHANNEL_SHUTDOWN_BOTH,
                              NULL);
     }
 
-    s->state = NBD_CLIENT_QUIT;
-    if (s->connection_co) {
-        if (s->connection_co_sleep_ns_state) {
-            qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
+    cs->state = NBD_CLIENT_QUIT;
+    if (cs->connection_co) {
+        if (cs->connection_co_sleep_ns_state) {
+            qemu_co_sleep_wake(cs->connection_co_sleep_ns_state);
         }
-        nbd_co_establish_connection_cancel(bs, true);
+        nbd_co_establish_connection_cancel(cs, true);
     }
     if (qemu_in_coroutine()) {
-        s->teardown_co = qemu_coroutine_self();
+        cs->teardown_co = qemu_coroutine_self();
         /* connection_co resumes us when it terminates */
         qemu_coroutine_yield();
-        s->teardown_co = NULL;
+        cs->teardown_co = NULL;
     } else {
-        BDRV_POLL_WHILE(bs, s->connection_co);
+        BDRV_POLL_WHILE(cs->s->bs, cs->connection_co);
     }
-    assert(!s->connection_co);
+    assert(!cs->connection_co);
 }
 
-static bool nbd_client_connecting(BDRVNBDState *s)
+static bool nbd_client_connecting(NBDConnState *cs)
 {
-    return s->state == NBD_CLIENT_CONNECTING_WAIT ||
-        s->state == NBD_CLIENT_CONNECTING_NOWAIT;
+    return cs->state == NBD_CLIENT_CONNECTING_WAIT ||
+        cs->state == NBD_CLIENT_CONNECTING_NOWAIT;
 }
 
-static bool nbd_client_connecting_wait(BDRVNBDState *s)
+static bool nbd_client_connecting_wait(NBDConnState *cs)
 {
-    return s->state == NBD_CLIENT_CONNECTING_WAIT;
+    return cs->state == NBD_CLIENT_CONNECTING_WAIT;
+}
+
+/* Whether @cs was given up after the server lost multi-conn support */
+static bool nbd_conn_abandoned(NBDConnState *cs)
+{
+    return cs->s->single_conn && cs->s->single_conn != cs;
+}
+
+/*
+ * Return the connection on which to retry a request that failed on @cs, or
+ * NULL if it must not be retried.  Requests wait for their connection to
+ * come back, unless it has been abandoned.
+ */
+static NBDConnState *nbd_retry_conn(NBDConnState *cs)
+{
+    if (nbd_conn_abandoned(cs)) {
+        return cs->s->single_conn;
+    }
+    return nbd_client_connecting_wait(cs) ? cs : NULL;
 }
 
 static void connect_bh(void *opaque)
 {
-    BDRVNBDState *state = opaque;
+    NBDConnState *state = opaque;
 
     assert(state->wait_connect);
     state->wait_connect = false;
     aio_co_wake(state->connection_co);
 }
 
-static void nbd_init_connect_thread(BDRVNBDState *s)
+static void nbd_init_connect_thread(NBDConnState *cs)
 {
-    s->connect_thread = g_new(NBDConnectThread, 1);
+    cs->connect_thread = g_new(NBDConnectThread, 1);
 
-    *s->connect_thread = (NBDConnectThread) {
-        .saddr = QAPI_CLONE(SocketAddress, s->saddr),
+    *cs->connect_thread = (NBDConnectThread) {
+        .saddr = QAPI_CLONE(SocketAddress, cs->s->saddr),
         .state = CONNECT_THREAD_NONE,
         .bh_func = connect_bh,
-        .bh_opaque = s,
+        .bh_opaque = cs,
     };
 
-    qemu_mutex_init(&s->connect_thread->mutex);
+    qemu_mutex_init(&cs->connect_thread->mutex);
 }
 
 static void nbd_free_connect_thread(NBDConnectThread *thr)
@@ -425,12 +502,11 @@ static void *connect_thread_func(void *opaque)
 }
 
 static QIOChannelSocket *coroutine_fn
-nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
+nbd_co_establish_connection(NBDConnState *cs, Error **errp)
 {
     QemuThread thread;
-    BDRVNBDState *s = bs->opaque;
     QIOChannelSocket *res;
-    NBDConnectThread *thr = s->connect_thread;
+    NBDConnectThread *thr = cs->connect_thread;
 
     qemu_mutex_lock(&thr->mutex);
 
@@ -470,7 +546,7 @@ nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
      * doesn't need mutex protection, it used only inside home aio context of
      * bs.
      */
-    s->wait_connect = true;
+    cs->wait_connect = true;
     qemu_coroutine_yield();
 
     qemu_mutex_lock(&thr->mutex);
@@ -517,14 +593,12 @@ nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
  * allow drained section to begin.
  *
  * If detach is true, also cleanup the state (or if thread is running, move it
- * to CONNECT_THREAD_RUNNING_DETACHED state). s->connect_thread becomes NULL if
+ * to CONNECT_THREAD_RUNNING_DETACHED state). cs->connect_thread becomes NULL if
  * detach is true.
  */
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
-                                               bool detach)
+static void nbd_co_establish_connection_cancel(NBDConnState *cs, bool detach)
 {
-    BDRVNBDState *s = bs->opaque;
-    NBDConnectThread *thr = s->connect_thread;
+    NBDConnectThread *thr = cs->connect_thread;
     bool wake = false;
     bool do_free = false;
 
@@ -533,13 +607,13 @@ static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
     if (thr->state == CONNECT_THREAD_RUNNING) {
         /* We can cancel only in running state, when bh is not yet scheduled */
         thr->bh_ctx = NULL;
-        if (s->wait_connect) {
-            s->wait_connect = false;
+        if (cs->wait_connect) {
+            cs->wait_connect = false;
             wake = true;
         }
         if (detach) {
             thr->state = CONNECT_THREAD_RUNNING_DETACHED;
-            s->connect_thread = NULL;
+            cs->connect_thread = NULL;
         }
     } else if (detach) {
         do_free = true;
@@ -549,40 +623,40 @@ static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
 
     if (do_free) {
         nbd_free_connect_thread(thr);
-        s->connect_thread = NULL;
+        cs->connect_thread = NULL;
     }
 
     if (wake) {
-        aio_co_wake(s->connection_co);
+        aio_co_wake(cs->connection_co);
     }
 }
 
-static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
+static coroutine_fn void nbd_reconnect_attempt(NBDConnState *cs)
 {
     int ret;
     Error *local_err = NULL;
     QIOChannelSocket *sioc;
 
-    if (!nbd_client_connecting(s)) {
+    if (!nbd_client_connecting(cs) || nbd_conn_abandoned(cs)) {
         return;
     }
 
     /* Wait for completion of all in-flight requests */
 
-    qemu_co_mutex_lock(&s->send_mutex);
+    qemu_co_mutex_lock(&cs->send_mutex);
 
-    while (s->in_flight > 0) {
-        qemu_co_mutex_unlock(&s->send_mutex);
-        nbd_recv_coroutines_wake_all(s);
-        s->wait_in_flight = true;
+    while (cs->in_flight > 0) {
+        qemu_co_mutex_unlock(&cs->send_mutex);
+        nbd_recv_coroutines_wake_all(cs);
+        cs->wait_in_flight = true;
         qemu_coroutine_yield();
-        s->wait_in_flight = false;
-        qemu_co_mutex_lock(&s->send_mutex);
+        cs->wait_in_flight = false;
+        qemu_co_mutex_lock(&cs->send_mutex);
     }
 
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&cs->send_mutex);
 
-    if (!nbd_client_connecting(s)) {
+    if (!nbd_client_connecting(cs)) {
         return;
     }
 
@@ -592,27 +666,27 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
      */
 
     /* Finalize previous connection if any */
-    if (s->ioc) {
-        qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
-        object_unref(OBJECT(s->sioc));
-        s->sioc = NULL;
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+    if (cs->ioc) {
+        qio_channel_detach_aio_context(QIO_CHANNEL(cs->ioc));
+        object_unref(OBJECT(cs->sioc));
+        cs->sioc = NULL;
+        object_unref(OBJECT(cs->ioc));
+        cs->ioc = NULL;
     }
 
-    sioc = nbd_co_establish_connection(s->bs, &local_err);
+    sioc = nbd_co_establish_connection(cs, &local_err);
     if (!sioc) {
         ret = -ECONNREFUSED;
         goto out;
     }
 
-    bdrv_dec_in_flight(s->bs);
+    bdrv_dec_in_flight(cs->s->bs);
 
-    ret = nbd_client_handshake(s->bs, sioc, &local_err);
+    ret = nbd_client_handshake(cs, sioc, &local_err);
 
-    if (s->drained) {
-        s->wait_drained_end = true;
-        while (s->drained) {
+    if (cs->s->drained) {
+        cs->wait_drained_end = true;
+        while (cs->s->drained) {
             /*
              * We may be entered once from nbd_client_attach_aio_context_bh
              * and then from nbd_client_co_drain_end. So here is a loop.
@@ -620,49 +694,50 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
             qemu_coroutine_yield();
         }
     }
-    bdrv_inc_in_flight(s->bs);
+    bdrv_inc_in_flight(cs->s->bs);
 
 out:
-    s->connect_status = ret;
-    error_free(s->connect_err);
-    s->connect_err = NULL;
-    error_propagate(&s->connect_err, local_err);
+    cs->connect_status = ret;
+    error_free(cs->connect_err);
+    cs->connect_err = NULL;
+    error_propagate(&cs->connect_err, local_err);
 
     if (ret >= 0) {
         /* successfully connected */
-        s->state = NBD_CLIENT_CONNECTED;
-        qemu_co_queue_restart_all(&s->free_sema);
+        cs->state = NBD_CLIENT_CONNECTED;
+        qemu_co_queue_restart_all(&cs->free_sema);
     }
 }
 
-static coroutine_fn void nbd_co_reconnect_loop(BDRVNBDState *s)
+static coroutine_fn void nbd_co_reconnect_loop(NBDConnState *cs)
 {
     uint64_t timeout = 1 * NANOSECONDS_PER_SECOND;
     uint64_t max_timeout = 16 * NANOSECONDS_PER_SECOND;
 
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        reconnect_delay_timer_init(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
-                                   s->reconnect_delay * NANOSECONDS_PER_SECOND);
+    if (cs->state == NBD_CLIENT_CONNECTING_WAIT) {
+        reconnect_delay_timer_init(cs, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                                   cs->s->reconnect_delay *
+                                   NANOSECONDS_PER_SECOND);
     }
 
-    nbd_reconnect_attempt(s);
+    nbd_reconnect_attempt(cs);
 
-    while (nbd_client_connecting(s)) {
-        if (s->drained) {
-            bdrv_dec_in_flight(s->bs);
-            s->wait_drained_end = true;
-            while (s->drained) {
+    while (nbd_client_connecting(cs)) {
+        if (cs->s->drained) {
+            bdrv_dec_in_flight(cs->s->bs);
+            cs->wait_drained_end = true;
+            while (cs->s->drained) {
                 /*
                  * We may be entered once from nbd_client_attach_aio_context_bh
                  * and then from nbd_client_co_drain_end. So here is a loop.
                  */
                 qemu_coroutine_yield();
             }
-            bdrv_inc_in_flight(s->bs);
+            bdrv_inc_in_flight(cs->s->bs);
         } else {
             qemu_co_sleep_ns_wakeable(QEMU_CLOCK_REALTIME, timeout,
-                                      &s->connection_co_sleep_ns_state);
-            if (s->drained) {
+                                      &cs->connection_co_sleep_ns_state);
+            if (cs->s->drained) {
                 continue;
             }
             if (timeout < max_timeout) {
@@ -670,20 +745,20 @@ static coroutine_fn void nbd_co_reconnect_loop(BDRVNBDState *s)
             }
         }
 
-        nbd_reconnect_attempt(s);
+        nbd_reconnect_attempt(cs);
     }
 
-    reconnect_delay_timer_del(s);
+    reconnect_delay_timer_del(cs);
 }
 
 static coroutine_fn void nbd_connection_entry(void *opaque)
 {
-    BDRVNBDState *s = opaque;
+    NBDConnState *cs = opaque;
     uint64_t i;
     int ret = 0;
     Error *local_err = NULL;
 
-    while (s->state != NBD_CLIENT_QUIT) {
+    while (cs->state != NBD_CLIENT_QUIT) {
         /*
          * The NBD client can only really be considered idle when it has
          * yielded from qio_channel_readv_all_eof(), waiting for data. This is
@@ -694,16 +769,16 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * only drop it temporarily here.
          */
 
-        if (nbd_client_connecting(s)) {
-            nbd_co_reconnect_loop(s);
+        if (nbd_client_connecting(cs)) {
+            nbd_co_reconnect_loop(cs);
         }
 
-        if (s->state != NBD_CLIENT_CONNECTED) {
+        if (cs->state != NBD_CLIENT_CONNECTED) {
             continue;
         }
 
-        assert(s->reply.handle == 0);
-        ret = nbd_receive_reply(s->bs, s->ioc, &s->reply, &local_err);
+        assert(cs->reply.handle == 0);
+        ret = nbd_receive_reply(cs->s->bs, cs->ioc, &cs->reply, &local_err);
 
         if (local_err) {
             trace_nbd_read_reply_entry_fail(ret, error_get_pretty(local_err));
@@ -711,7 +786,7 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
             local_err = NULL;
         }
         if (ret <= 0) {
-            nbd_channel_error(s, ret ? ret : -EIO);
+            nbd_channel_error(cs, ret ? ret : -EIO);
             continue;
         }
 
@@ -720,13 +795,13 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * handler acts as a synchronization point and ensures that only
          * one coroutine is called until the reply finishes.
          */
-        i = HANDLE_TO_INDEX(s, s->reply.handle);
+        i = HANDLE_TO_INDEX(cs, cs->reply.handle);
         if (i >= MAX_NBD_REQUESTS ||
-            !s->requests[i].coroutine ||
-            !s->requests[i].receiving ||
-            (nbd_reply_is_structured(&s->reply) && !s->info.structured_reply))
+            !cs->requests[i].coroutine ||
+            !cs->requests[i].receiving ||
+            (nbd_reply_is_structured(&cs->reply) && !cs->info.structured_reply))
         {
-            nbd_channel_error(s, -EINVAL);
+            nbd_channel_error(cs, -EINVAL);
             continue;
         }
 
@@ -742,50 +817,51 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          *   connection_co happens through a bottom half, which can only
          *   run after we yield.
          */
-        aio_co_wake(s->requests[i].coroutine);
+        aio_co_wake(cs->requests[i].coroutine);
         qemu_coroutine_yield();
     }
 
-    qemu_co_queue_restart_all(&s->free_sema);
-    nbd_recv_coroutines_wake_all(s);
-    bdrv_dec_in_flight(s->bs);
+    qemu_co_queue_restart_all(&cs->free_sema);
+    nbd_recv_coroutines_wake_all(cs);
+    bdrv_dec_in_flight(cs->s->bs);
 
-    s->connection_co = NULL;
-    if (s->ioc) {
-        qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
-        object_unref(OBJECT(s->sioc));
-        s->sioc = NULL;
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+    cs->connection_co = NULL;
+    if (cs->ioc) {
+        qio_channel_detach_aio_context(QIO_CHANNEL(cs->ioc));
+        object_unref(OBJECT(cs->sioc));
+        cs->sioc = NULL;
+        object_unref(OBJECT(cs->ioc));
+        cs->ioc = NULL;
     }
 
-    if (s->teardown_co) {
-        aio_co_wake(s->teardown_co);
+    if (cs->teardown_co) {
+        aio_co_wake(cs->teardown_co);
     }
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(NBDConnState *cs,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
-    qemu_co_mutex_lock(&s->send_mutex);
-    while (s->in_flight == MAX_NBD_REQUESTS || nbd_client_connecting_wait(s)) {
-        qemu_co_queue_wait(&s->free_sema, &s->send_mutex);
+    qemu_co_mutex_lock(&cs->send_mutex);
+    while (cs->in_flight == MAX_NBD_REQUESTS ||
+           (nbd_client_connecting_wait(cs) && !nbd_conn_abandoned(cs)))
+    {
+        qemu_co_queue_wait(&cs->free_sema, &cs->send_mutex);
     }
 
-    if (s->state != NBD_CLIENT_CONNECTED) {
+    if (cs->state != NBD_CLIENT_CONNECTED) {
         rc = -EIO;
         goto err;
     }
 
-    s->in_flight++;
+    cs->in_flight++;
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (s->requests[i].coroutine == NULL) {
+        if (cs->requests[i].coroutine == NULL) {
             break;
         }
     }
@@ -793,44 +869,53 @@ static int nbd_co_send_request(BlockDriverState *bs,
     g_assert(qemu_in_coroutine());
     assert(i < MAX_NBD_REQUESTS);
 
-    s->requests[i].coroutine = qemu_coroutine_self();
-    s->requests[i].offset = request->from;
-    s->requests[i].receiving = false;
+    cs->requests[i].coroutine = qemu_coroutine_self();
+    cs->requests[i].offset = request->from;
+    cs->requests[i].receiving = false;
 
-    request->handle = INDEX_TO_HANDLE(s, i);
+    request->handle = INDEX_TO_HANDLE(cs, i);
 
-    assert(s->ioc);
+    assert(cs->ioc);
 
     if (qiov) {
-        qio_channel_set_cork(s->ioc, true);
-        rc = nbd_send_request(s->ioc, request);
-        if (rc >= 0 && s->state == NBD_CLIENT_CONNECTED) {
-            if (qio_channel_writev_all(s->ioc, qiov->iov, qiov->niov,
+        qio_channel_set_cork(cs->ioc, true);
+        rc = nbd_send_request(cs->ioc, request);
+        if (rc >= 0 && cs->state == NBD_CLIENT_CONNECTED) {
+            if (qio_channel_writev_all(cs->ioc, qiov->iov, qiov->niov,
                                        NULL) < 0) {
                 rc = -EIO;
             }
         } else if (rc >= 0) {
             rc = -EIO;
         }
-        qio_channel_set_cork(s->ioc, false);
+        qio_channel_set_cork(cs->ioc, false);
     } else {
-        rc = nbd_send_request(s->ioc, request);
+        rc = nbd_send_request(cs->ioc, request);
+    }
+
+    if (rc >= 0) {
+        cs->nr_requests++;
+        if (request->type == NBD_CMD_READ) {
+            cs->rd_bytes += request->len;
+        } else if (request->type == NBD_CMD_WRITE) {
+            cs->wr_bytes += request->len;
+        }
     }
 
 err:
     if (rc < 0) {
-        nbd_channel_error(s, rc);
+        nbd_channel_error(cs, rc);
         if (i != -1) {
-            s->requests[i].coroutine = NULL;
-            s->in_flight--;
+            cs->requests[i].coroutine = NULL;
+            cs->in_flight--;
         }
-        if (s->in_flight == 0 && s->wait_in_flight) {
-            aio_co_wake(s->connection_co);
+        if (cs->in_flight == 0 && cs->wait_in_flight) {
+            aio_co_wake(cs->connection_co);
         } else {
-            qemu_co_queue_next(&s->free_sema);
+            qemu_co_queue_next(&cs->free_sema);
         }
     }
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&cs->send_mutex);
     return rc;
 }
 
@@ -852,7 +937,7 @@ static inline uint64_t payload_advance64(uint8_t **payload)
     return ldq_be_p(*payload - 8);
 }
 
-static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
+static int nbd_parse_offset_hole_payload(NBDConnState *cs,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_offset,
                                          QEMUIOVector *qiov, Error **errp)
@@ -875,8 +960,8 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block &&
-        !QEMU_IS_ALIGNED(hole_size, s->info.min_block)) {
+    if (cs->info.min_block &&
+        !QEMU_IS_ALIGNED(hole_size, cs->info.min_block)) {
         trace_nbd_structured_read_compliance("hole");
     }
 
@@ -890,7 +975,7 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
  * Based on our request, we expect only one extent in reply, for the
  * base:allocation context.
  */
-static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
+static int nbd_parse_blockstatus_payload(NBDConnState *cs,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_length,
                                          NBDExtent *extent, Error **errp)
@@ -905,11 +990,11 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
     }
 
     context_id = payload_advance32(&payload);
-    if (s->info.context_id != context_id) {
+    if (cs->info.context_id != context_id) {
         error_setg(errp, "Protocol error: unexpected context id %d for "
                          "NBD_REPLY_TYPE_BLOCK_STATUS, when negotiated context "
                          "id is %d", context_id,
-                         s->info.context_id);
+                         cs->info.context_id);
         return -EINVAL;
     }
 
@@ -934,14 +1019,14 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
      * up to the full block and change the status to fully-allocated
      * (always a safe status, even if it loses information).
      */
-    if (s->info.min_block && !QEMU_IS_ALIGNED(extent->length,
-                                                   s->info.min_block)) {
+    if (cs->info.min_block && !QEMU_IS_ALIGNED(extent->length,
+                                                   cs->info.min_block)) {
         trace_nbd_parse_blockstatus_compliance("extent length is unaligned");
-        if (extent->length > s->info.min_block) {
+        if (extent->length > cs->info.min_block) {
             extent->length = QEMU_ALIGN_DOWN(extent->length,
-                                             s->info.min_block);
+                                             cs->info.min_block);
         } else {
-            extent->length = s->info.min_block;
+            extent->length = cs->info.min_block;
             extent->flags = 0;
         }
     }
@@ -968,7 +1053,7 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
      * since nbd_client_co_block_status is only expecting the low two
      * bits to be set.
      */
-    if (s->alloc_depth && extent->flags > 2) {
+    if (cs->s->alloc_depth && extent->flags > 2) {
         extent->flags = 2;
     }
 
@@ -1017,7 +1102,7 @@ static int nbd_parse_error_payload(NBDStructuredReplyChunk *chunk,
     return 0;
 }
 
-static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
+static int nbd_co_receive_offset_data_payload(NBDConnState *cs,
                                               uint64_t orig_offset,
                                               QEMUIOVector *qiov, Error **errp)
 {
@@ -1025,9 +1110,9 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
     uint64_t offset;
     size_t data_size;
     int ret;
-    NBDStructuredReplyChunk *chunk = &s->reply.structured;
+    NBDStructuredReplyChunk *chunk = &cs->reply.structured;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&cs->reply));
 
     /* The NBD spec requires at least one byte of payload */
     if (chunk->length <= sizeof(offset)) {
@@ -1036,7 +1121,7 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
         return -EINVAL;
     }
 
-    if (nbd_read64(s->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
+    if (nbd_read64(cs->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
         return -EIO;
     }
 
@@ -1048,13 +1133,13 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block && !QEMU_IS_ALIGNED(data_size, s->info.min_block)) {
+    if (cs->info.min_block && !QEMU_IS_ALIGNED(data_size, cs->info.min_block)) {
         trace_nbd_structured_read_compliance("data");
     }
 
     qemu_iovec_init(&sub_qiov, qiov->niov);
     qemu_iovec_concat(&sub_qiov, qiov, offset - orig_offset, data_size);
-    ret = qio_channel_readv_all(s->ioc, sub_qiov.iov, sub_qiov.niov, errp);
+    ret = qio_channel_readv_all(cs->ioc, sub_qiov.iov, sub_qiov.niov, errp);
     qemu_iovec_destroy(&sub_qiov);
 
     return ret < 0 ? -EIO : 0;
@@ -1062,14 +1147,14 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
 
 #define NBD_MAX_MALLOC_PAYLOAD 1000
 static coroutine_fn int nbd_co_receive_structured_payload(
-        BDRVNBDState *s, void **payload, Error **errp)
+        NBDConnState *cs, void **payload, Error **errp)
 {
     int ret;
     uint32_t len;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&cs->reply));
 
-    len = s->reply.structured.length;
+    len = cs->reply.structured.length;
 
     if (len == 0) {
         return 0;
@@ -1086,7 +1171,7 @@ static coroutine_fn int nbd_co_receive_structured_payload(
     }
 
     *payload = g_new(char, len);
-    ret = nbd_read(s->ioc, *payload, len, "structured payload", errp);
+    ret = nbd_read(cs->ioc, *payload, len, "structured payload", errp);
     if (ret < 0) {
         g_free(*payload);
         *payload = NULL;
@@ -1112,11 +1197,11 @@ static coroutine_fn int nbd_co_receive_structured_payload(
  * corresponding to the server's error reply), and errp is unchanged.
  */
 static coroutine_fn int nbd_co_do_receive_one_chunk(
-        BDRVNBDState *s, uint64_t handle, bool only_structured,
+        NBDConnState *cs, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, void **payload, Error **errp)
 {
     int ret;
-    int i = HANDLE_TO_INDEX(s, handle);
+    int i = HANDLE_TO_INDEX(cs, handle);
     void *local_payload = NULL;
     NBDStructuredReplyChunk *chunk;
 
@@ -1126,36 +1211,36 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
     *request_ret = 0;
 
     /* Wait until we're woken up by nbd_connection_entry.  */
-    s->requests[i].receiving = true;
+    cs->requests[i].receiving = true;
     qemu_coroutine_yield();
-    s->requests[i].receiving = false;
-    if (s->state != NBD_CLIENT_CONNECTED) {
+    cs->requests[i].receiving = false;
+    if (cs->state != NBD_CLIENT_CONNECTED) {
         error_setg(errp, "Connection closed");
         return -EIO;
     }
-    assert(s->ioc);
+    assert(cs->ioc);
 
-    assert(s->reply.handle == handle);
+    assert(cs->reply.handle == handle);
 
-    if (nbd_reply_is_simple(&s->reply)) {
+    if (nbd_reply_is_simple(&cs->reply)) {
         if (only_structured) {
             error_setg(errp, "Protocol error: simple reply when structured "
                              "reply chunk was expected");
             return -EINVAL;
         }
 
-        *request_ret = -nbd_errno_to_system_errno(s->reply.simple.error);
+        *request_ret = -nbd_errno_to_system_errno(cs->reply.simple.error);
         if (*request_ret < 0 || !qiov) {
             return 0;
         }
 
-        return qio_channel_readv_all(s->ioc, qiov->iov, qiov->niov,
+        return qio_channel_readv_all(cs->ioc, qiov->iov, qiov->niov,
                                      errp) < 0 ? -EIO : 0;
     }
 
     /* handle structured reply chunk */
-    assert(s->info.structured_reply);
-    chunk = &s->reply.structured;
+    assert(cs->info.structured_reply);
+    chunk = &cs->reply.structured;
 
     if (chunk->type == NBD_REPLY_TYPE_NONE) {
         if (!(chunk->flags & NBD_REPLY_FLAG_DONE)) {
@@ -1177,7 +1262,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
             return -EINVAL;
         }
 
-        return nbd_co_receive_offset_data_payload(s, s->requests[i].offset,
+        return nbd_co_receive_offset_data_payload(cs, cs->requests[i].offset,
                                                   qiov, errp);
     }
 
@@ -1185,7 +1270,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
         payload = &local_payload;
     }
 
-    ret = nbd_co_receive_structured_payload(s, payload, errp);
+    ret = nbd_co_receive_structured_payload(cs, payload, errp);
     if (ret < 0) {
         return ret;
     }
@@ -1201,33 +1286,33 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
 
 /*
  * nbd_co_receive_one_chunk
- * Read reply, wake up connection_co and set s->quit if needed.
+ * Read reply, wake up connection_co and set cs->quit if needed.
  * Return value is a fatal error code or normal nbd reply error code
  */
 static coroutine_fn int nbd_co_receive_one_chunk(
-        BDRVNBDState *s, uint64_t handle, bool only_structured,
+        NBDConnState *cs, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, NBDReply *reply, void **payload,
         Error **errp)
 {
-    int ret = nbd_co_do_receive_one_chunk(s, handle, only_structured,
+    int ret = nbd_co_do_receive_one_chunk(cs, handle, only_structured,
                                           request_ret, qiov, payload, errp);
 
     if (ret < 0) {
         memset(reply, 0, sizeof(*reply));
-        nbd_channel_error(s, ret);
+        nbd_channel_error(cs, ret);
     } else {
         /* For assert at loop start in nbd_connection_entry */
-        *reply = s->reply;
+        *reply = cs->reply;
     }
-    s->reply.handle = 0;
+    cs->reply.handle = 0;
 
-    if (s->connection_co && !s->wait_in_flight) {
+    if (cs->connection_co && !cs->wait_in_flight) {
         /*
-         * We must check s->wait_in_flight, because we may entered by
+         * We must check cs->wait_in_flight, because we may entered by
          * nbd_recv_coroutines_wake_all(), in this case we should not
          * wake connection_co here, it will woken by last request.
          */
-        aio_co_wake(s->connection_co);
+        aio_co_wake(cs->connection_co);
     }
 
     return ret;
@@ -1269,16 +1354,16 @@ static void nbd_iter_request_error(NBDReplyChunkIter *iter, int ret)
  * NBD_FOREACH_REPLY_CHUNK
  * The pointer stored in @payload requires g_free() to free it.
  */
-#define NBD_FOREACH_REPLY_CHUNK(s, iter, handle, structured, \
+#define NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, structured, \
                                 qiov, reply, payload) \
     for (iter = (NBDReplyChunkIter) { .only_structured = structured }; \
-         nbd_reply_chunk_iter_receive(s, &iter, handle, qiov, reply, payload);)
+         nbd_reply_chunk_iter_receive(cs, &iter, handle, qiov, reply, payload);)
 
 /*
  * nbd_reply_chunk_iter_receive
  * The pointer stored in @payload requires g_free() to free it.
  */
-static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
+static bool nbd_reply_chunk_iter_receive(NBDConnState *cs,
                                          NBDReplyChunkIter *iter,
                                          uint64_t handle,
                                          QEMUIOVector *qiov, NBDReply *reply,
@@ -1288,7 +1373,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     NBDReply local_reply;
     NBDStructuredReplyChunk *chunk;
     Error *local_err = NULL;
-    if (s->state != NBD_CLIENT_CONNECTED) {
+    if (cs->state != NBD_CLIENT_CONNECTED) {
         error_setg(&local_err, "Connection closed");
         nbd_iter_channel_error(iter, -EIO, &local_err);
         goto break_loop;
@@ -1303,7 +1388,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
         reply = &local_reply;
     }
 
-    ret = nbd_co_receive_one_chunk(s, handle, iter->only_structured,
+    ret = nbd_co_receive_one_chunk(cs, handle, iter->only_structured,
                                    &request_ret, qiov, reply, payload,
                                    &local_err);
     if (ret < 0) {
@@ -1313,7 +1398,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     }
 
     /* Do not execute the body of NBD_FOREACH_REPLY_CHUNK for simple reply. */
-    if (nbd_reply_is_simple(reply) || s->state != NBD_CLIENT_CONNECTED) {
+    if (nbd_reply_is_simple(reply) || cs->state != NBD_CLIENT_CONNECTED) {
         goto break_loop;
     }
 
@@ -1335,26 +1420,26 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     return true;
 
 break_loop:
-    s->requests[HANDLE_TO_INDEX(s, handle)].coroutine = NULL;
+    cs->requests[HANDLE_TO_INDEX(cs, handle)].coroutine = NULL;
 
-    qemu_co_mutex_lock(&s->send_mutex);
-    s->in_flight--;
-    if (s->in_flight == 0 && s->wait_in_flight) {
-        aio_co_wake(s->connection_co);
+    qemu_co_mutex_lock(&cs->send_mutex);
+    cs->in_flight--;
+    if (cs->in_flight == 0 && cs->wait_in_flight) {
+        aio_co_wake(cs->connection_co);
     } else {
-        qemu_co_queue_next(&s->free_sema);
+        qemu_co_queue_next(&cs->free_sema);
     }
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&cs->send_mutex);
 
     return false;
 }
 
-static int nbd_co_receive_return_code(BDRVNBDState *s, uint64_t handle,
+static int nbd_co_receive_return_code(NBDConnState *cs, uint64_t handle,
                                       int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, false, NULL, NULL, NULL) {
+    NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, false, NULL, NULL, NULL) {
         /* nbd_reply_chunk_iter_receive does all the work */
     }
 
@@ -1363,7 +1448,7 @@ static int nbd_co_receive_return_code(BDRVNBDState *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
+static int nbd_co_receive_cmdread_reply(NBDConnState *cs, uint64_t handle,
                                         uint64_t offset, QEMUIOVector *qiov,
                                         int *request_ret, Error **errp)
 {
@@ -1372,7 +1457,7 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
     void *payload = NULL;
     Error *local_err = NULL;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->info.structured_reply,
+    NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, cs->info.structured_reply,
                             qiov, &reply, &payload)
     {
         int ret;
@@ -1388,17 +1473,17 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
              */
             break;
         case NBD_REPLY_TYPE_OFFSET_HOLE:
-            ret = nbd_parse_offset_hole_payload(s, &reply.structured, payload,
+            ret = nbd_parse_offset_hole_payload(cs, &reply.structured, payload,
                                                 offset, qiov, &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(cs, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
                 /* not allowed reply type */
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(cs, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) for CMD_READ",
                            chunk->type, nbd_reply_type_lookup(chunk->type));
@@ -1415,7 +1500,7 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
+static int nbd_co_receive_blockstatus_reply(NBDConnState *cs,
                                             uint64_t handle, uint64_t length,
                                             NBDExtent *extent,
                                             int *request_ret, Error **errp)
@@ -1427,7 +1512,7 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     bool received = false;
 
     assert(!extent->length);
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, false, NULL, &reply, &payload) {
+    NBD_FOREACH_REPLY_CHUNK(cs, iter, handle, false, NULL, &reply, &payload) {
         int ret;
         NBDStructuredReplyChunk *chunk = &reply.structured;
 
@@ -1436,23 +1521,23 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
         switch (chunk->type) {
         case NBD_REPLY_TYPE_BLOCK_STATUS:
             if (received) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(cs, -EINVAL);
                 error_setg(&local_err, "Several BLOCK_STATUS chunks in reply");
                 nbd_iter_channel_error(&iter, -EINVAL, &local_err);
             }
             received = true;
 
-            ret = nbd_parse_blockstatus_payload(s, &reply.structured,
+            ret = nbd_parse_blockstatus_payload(cs, &reply.structured,
                                                 payload, length, extent,
                                                 &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(cs, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(cs, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) "
                            "for CMD_BLOCK_STATUS",
@@ -1475,12 +1560,38 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     return iter.ret;
 }
 
-static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
+/*
+ * Pick the connection for the next request.  Requests are striped across
+ * the connections round-robin, skipping those that are currently down.  If
+ * none is connected, the request waits for or fails with the next one.
+ */
+static NBDConnState *nbd_choose_conn(BDRVNBDState *s)
+{
+    NBDConnState *cs;
+    int i;
+
+    if (s->single_conn) {
+        return s->single_conn;
+    }
+
+    for (i = 0; i < s->num_conns; i++) {
+        cs = s->conns[s->next_conn];
+        s->next_conn = (s->next_conn + 1) % s->num_conns;
+        if (cs->state == NBD_CLIENT_CONNECTED) {
+            return cs;
+        }
+    }
+
+    cs = s->conns[s->next_conn];
+    s->next_conn = (s->next_conn + 1) % s->num_conns;
+    return cs;
+}
+
+static int nbd_co_request(NBDConnState *cs, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1491,12 +1602,12 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        ret = nbd_co_send_request(cs, request, write_qiov);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_return_code(s, request->handle,
+        ret = nbd_co_receive_return_code(cs, request->handle,
                                          &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request->from, request->len,
@@ -1507,7 +1618,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && (cs = nbd_retry_conn(cs)));
 
     return ret ? ret : request_ret;
 }
@@ -1518,6 +1629,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = nbd_choose_conn(s);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1536,13 +1648,13 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
      * advertised size because the block layer rounded size up, then
      * truncate the request to the server and tail-pad with zero.
      */
-    if (offset >= s->info.size) {
+    if (offset >= cs->info.size) {
         assert(bytes < BDRV_SECTOR_SIZE);
         qemu_iovec_memset(qiov, 0, 0, bytes);
         return 0;
     }
-    if (offset + bytes > s->info.size) {
-        uint64_t slop = offset + bytes - s->info.size;
+    if (offset + bytes > cs->info.size) {
+        uint64_t slop = offset + bytes - cs->info.size;
 
         assert(slop < BDRV_SECTOR_SIZE);
         qemu_iovec_memset(qiov, bytes - slop, 0, slop);
@@ -1550,12 +1662,12 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(cs, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_cmdread_reply(s, request.handle, offset, qiov,
+        ret = nbd_co_receive_cmdread_reply(cs, request.handle, offset, qiov,
                                            &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -1565,7 +1677,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && (cs = nbd_retry_conn(cs)));
 
     return ret ? ret : request_ret;
 }
@@ -1574,15 +1686,16 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                  uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = nbd_choose_conn(s);
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
         .len = bytes,
     };
 
-    assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
+    assert(!(cs->info.flags & NBD_FLAG_READ_ONLY));
     if (flags & BDRV_REQ_FUA) {
-        assert(s->info.flags & NBD_FLAG_SEND_FUA);
+        assert(cs->info.flags & NBD_FLAG_SEND_FUA);
         request.flags |= NBD_CMD_FLAG_FUA;
     }
 
@@ -1591,73 +1704,76 @@ static int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, qiov);
+    return nbd_co_request(cs, &request, qiov);
 }
 
 static int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                        int bytes, BdrvRequestFlags flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = nbd_choose_conn(s);
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
         .len = bytes,
     };
 
-    assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
-    if (!(s->info.flags & NBD_FLAG_SEND_WRITE_ZEROES)) {
+    assert(!(cs->info.flags & NBD_FLAG_READ_ONLY));
+    if (!(cs->info.flags & NBD_FLAG_SEND_WRITE_ZEROES)) {
         return -ENOTSUP;
     }
 
     if (flags & BDRV_REQ_FUA) {
-        assert(s->info.flags & NBD_FLAG_SEND_FUA);
+        assert(cs->info.flags & NBD_FLAG_SEND_FUA);
         request.flags |= NBD_CMD_FLAG_FUA;
     }
     if (!(flags & BDRV_REQ_MAY_UNMAP)) {
         request.flags |= NBD_CMD_FLAG_NO_HOLE;
     }
     if (flags & BDRV_REQ_NO_FALLBACK) {
-        assert(s->info.flags & NBD_FLAG_SEND_FAST_ZERO);
+        assert(cs->info.flags & NBD_FLAG_SEND_FAST_ZERO);
         request.flags |= NBD_CMD_FLAG_FAST_ZERO;
     }
 
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(cs, &request, NULL);
 }
 
 static int nbd_client_co_flush(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = nbd_choose_conn(s);
     NBDRequest request = { .type = NBD_CMD_FLUSH };
 
-    if (!(s->info.flags & NBD_FLAG_SEND_FLUSH)) {
+    if (!(cs->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
 
     request.from = 0;
     request.len = 0;
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(cs, &request, NULL);
 }
 
 static int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset,
                                   int bytes)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = nbd_choose_conn(s);
     NBDRequest request = {
         .type = NBD_CMD_TRIM,
         .from = offset,
         .len = bytes,
     };
 
-    assert(!(s->info.flags & NBD_FLAG_READ_ONLY));
-    if (!(s->info.flags & NBD_FLAG_SEND_TRIM) || !bytes) {
+    assert(!(cs->info.flags & NBD_FLAG_READ_ONLY));
+    if (!(cs->info.flags & NBD_FLAG_SEND_TRIM) || !bytes) {
         return 0;
     }
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(cs, &request, NULL);
 }
 
 static int coroutine_fn nbd_client_co_block_status(
@@ -1667,17 +1783,18 @@ static int coroutine_fn nbd_client_co_block_status(
     int ret, request_ret;
     NBDExtent extent = { 0 };
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs = nbd_choose_conn(s);
     Error *local_err = NULL;
 
     NBDRequest request = {
         .type = NBD_CMD_BLOCK_STATUS,
         .from = offset,
         .len = MIN(QEMU_ALIGN_DOWN(INT_MAX, bs->bl.request_alignment),
-                   MIN(bytes, s->info.size - offset)),
+                   MIN(bytes, cs->info.size - offset)),
         .flags = NBD_CMD_FLAG_REQ_ONE,
     };
 
-    if (!s->info.base_allocation) {
+    if (!cs->info.base_allocation) {
         *pnum = bytes;
         *map = offset;
         *file = bs;
@@ -1691,23 +1808,23 @@ static int coroutine_fn nbd_client_co_block_status(
      * up, we truncated the request to the server (above), or are
      * called on just the hole.
      */
-    if (offset >= s->info.size) {
+    if (offset >= cs->info.size) {
         *pnum = bytes;
         assert(bytes < BDRV_SECTOR_SIZE);
         /* Intentionally don't report offset_valid for the hole */
         return BDRV_BLOCK_ZERO;
     }
 
-    if (s->info.min_block) {
-        assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
+    if (cs->info.min_block) {
+        assert(QEMU_IS_ALIGNED(request.len, cs->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(cs, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_blockstatus_reply(s, request.handle, bytes,
+        ret = nbd_co_receive_blockstatus_reply(cs, request.handle, bytes,
                                                &extent, &request_ret,
                                                &local_err);
         if (local_err) {
@@ -1718,7 +1835,7 @@ static int coroutine_fn nbd_client_co_block_status(
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && (cs = nbd_retry_conn(cs)));
 
     if (ret < 0 || request_ret < 0) {
         return ret ? ret : request_ret;
@@ -1737,8 +1854,9 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
                                      BlockReopenQueue *queue, Error **errp)
 {
     BDRVNBDState *s = (BDRVNBDState *)state->bs->opaque;
+    NBDExportInfo *info = &s->info;
 
-    if ((state->flags & BDRV_O_RDWR) && (s->info.flags & NBD_FLAG_READ_ONLY)) {
+    if ((state->flags & BDRV_O_RDWR) && (info->flags & NBD_FLAG_READ_ONLY)) {
         error_setg(errp, "Can't reopen read-only NBD mount as read/write");
         return -EACCES;
     }
@@ -1749,12 +1867,21 @@ static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
-    }
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnState *cs = s->conns[i];
+
+        if (cs->ioc) {
+            nbd_send_request(cs->ioc, &request);
+        }
 
-    nbd_teardown_connection(bs);
+        nbd_teardown_connection(cs);
+        error_free(cs->connect_err);
+        g_free(cs);
+        s->conns[i] = NULL;
+    }
+    s->num_conns = 0;
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -1778,36 +1905,55 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
 }
 
 /* nbd_client_handshake takes ownership on sioc. On failure it is unref'ed. */
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static int nbd_client_handshake(NBDConnState *cs, QIOChannelSocket *sioc,
                                 Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = cs->s;
+    BlockDriverState *bs = s->bs;
     AioContext *aio_context = bdrv_get_aio_context(bs);
     int ret;
 
     trace_nbd_client_handshake(s->export);
 
-    s->sioc = sioc;
+    cs->sioc = sioc;
 
     qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
     qio_channel_attach_aio_context(QIO_CHANNEL(sioc), aio_context);
 
-    s->info.request_sizes = true;
-    s->info.structured_reply = true;
-    s->info.base_allocation = true;
-    s->info.x_dirty_bitmap = g_strdup(s->x_dirty_bitmap);
-    s->info.name = g_strdup(s->export ?: "");
+    cs->info.request_sizes = true;
+    cs->info.structured_reply = true;
+    cs->info.base_allocation = true;
+    cs->info.x_dirty_bitmap = g_strdup(s->x_dirty_bitmap);
+    cs->info.name = g_strdup(s->export ?: "");
     ret = nbd_receive_negotiate(aio_context, QIO_CHANNEL(sioc), s->tlscreds,
-                                s->hostname, &s->ioc, &s->info, errp);
-    g_free(s->info.x_dirty_bitmap);
-    g_free(s->info.name);
+                                s->hostname, &cs->ioc, &cs->info, errp);
+    g_free(cs->info.x_dirty_bitmap);
+    g_free(cs->info.name);
     if (ret < 0) {
         object_unref(OBJECT(sioc));
-        s->sioc = NULL;
+        cs->sioc = NULL;
         return ret;
     }
+    if (s->num_conns) {
+        /*
+         * Requests may go to any connection, and the block layer was set up
+         * with the parameters of the first one, so they must all agree.  A
+         * server losing multi-conn support is handled below.
+         */
+        if (cs->info.size != s->info.size ||
+            ((cs->info.flags ^ s->info.flags) & ~NBD_FLAG_CAN_MULTI_CONN) ||
+            cs->info.min_block != s->info.min_block ||
+            cs->info.max_block != s->info.max_block ||
+            cs->info.structured_reply != s->info.structured_reply ||
+            cs->info.base_allocation != s->info.base_allocation) {
+            error_setg(errp, "NBD server reported different export parameters "
+                       "on connection %u", cs->index);
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
     if (s->x_dirty_bitmap) {
-        if (!s->info.base_allocation) {
+        if (!cs->info.base_allocation) {
             error_setg(errp, "requested x-dirty-bitmap %s not found",
                        s->x_dirty_bitmap);
             ret = -EINVAL;
@@ -1817,26 +1963,45 @@ static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
             s->alloc_depth = true;
         }
     }
-    if (s->info.flags & NBD_FLAG_READ_ONLY) {
+    if (cs->info.flags & NBD_FLAG_READ_ONLY) {
         ret = bdrv_apply_auto_read_only(bs, "NBD export is read-only", errp);
         if (ret < 0) {
             goto fail;
         }
     }
-    if (s->info.flags & NBD_FLAG_SEND_FUA) {
+    if (cs->info.flags & NBD_FLAG_SEND_FUA) {
         bs->supported_write_flags = BDRV_REQ_FUA;
         bs->supported_zero_flags |= BDRV_REQ_FUA;
     }
-    if (s->info.flags & NBD_FLAG_SEND_WRITE_ZEROES) {
+    if (cs->info.flags & NBD_FLAG_SEND_WRITE_ZEROES) {
         bs->supported_zero_flags |= BDRV_REQ_MAY_UNMAP;
-        if (s->info.flags & NBD_FLAG_SEND_FAST_ZERO) {
+        if (cs->info.flags & NBD_FLAG_SEND_FAST_ZERO) {
             bs->supported_zero_flags |= BDRV_REQ_NO_FALLBACK;
         }
     }
 
-    if (!s->ioc) {
-        s->ioc = QIO_CHANNEL(sioc);
-        object_ref(OBJECT(s->ioc));
+    if (!cs->ioc) {
+        cs->ioc = QIO_CHANNEL(sioc);
+        object_ref(OBJECT(cs->ioc));
+    }
+
+    /*
+     * Without NBD_FLAG_CAN_MULTI_CONN, a flush on this connection need not
+     * cover the writes on the others, so stop using them.  Requests waiting
+     * for them to reconnect are retried here.
+     */
+    if (s->num_conns && s->multi_conn > 1 && !s->single_conn &&
+        !(cs->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        int i;
+
+        warn_report("NBD server no longer supports multiple connections, "
+                    "using only one of them");
+        s->single_conn = cs;
+        for (i = 0; i < s->num_conns; i++) {
+            if (s->conns[i] != cs) {
+                qemu_co_queue_restart_all(&s->conns[i]->free_sema);
+            }
+        }
     }
 
     trace_nbd_client_handshake_success(s->export);
@@ -1851,10 +2016,10 @@ static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
     {
         NBDRequest request = { .type = NBD_CMD_DISC };
 
-        nbd_send_request(s->ioc ?: QIO_CHANNEL(sioc), &request);
+        nbd_send_request(cs->ioc ?: QIO_CHANNEL(sioc), &request);
 
         object_unref(OBJECT(sioc));
-        s->sioc = NULL;
+        cs->sioc = NULL;
 
         return ret;
     }
@@ -2174,6 +2339,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open to the server if it "
+                    "supports multiple connections. Default 1",
+        },
         { /* end of list */ }
     },
 };
@@ -2230,6 +2401,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > MAX_MULTI_CONN) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_MULTI_CONN);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -2240,21 +2418,18 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
-static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
-                    Error **errp)
+/* Open connection number s->num_conns and start its connection coroutine */
+static int nbd_open_conn(BDRVNBDState *s, Error **errp)
 {
-    int ret;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnState *cs;
     QIOChannelSocket *sioc;
+    int ret;
 
-    ret = nbd_process_options(bs, options, errp);
-    if (ret < 0) {
-        return ret;
-    }
-
-    s->bs = bs;
-    qemu_co_mutex_init(&s->send_mutex);
-    qemu_co_queue_init(&s->free_sema);
+    cs = g_new0(NBDConnState, 1);
+    cs->s = s;
+    cs->index = s->num_conns;
+    qemu_co_mutex_init(&cs->send_mutex);
+    qemu_co_queue_init(&cs->free_sema);
 
     /*
      * establish TCP connection, return error if it fails
@@ -2262,22 +2437,73 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
      */
     sioc = nbd_establish_connection(s->saddr, errp);
     if (!sioc) {
+        g_free(cs);
         return -ECONNREFUSED;
     }
 
-    ret = nbd_client_handshake(bs, sioc, errp);
+    s->conns[cs->index] = cs;
+    ret = nbd_client_handshake(cs, sioc, errp);
     if (ret < 0) {
-        nbd_clear_bdrvstate(s);
+        s->conns[cs->index] = NULL;
+        g_free(cs);
         return ret;
     }
     /* successfully connected */
-    s->state = NBD_CLIENT_CONNECTED;
+    cs->state = NBD_CLIENT_CONNECTED;
+    if (!s->num_conns) {
+        s->info = cs->info;
+        s->info.x_dirty_bitmap = NULL;
+        s->info.name = NULL;
+    }
+    s->num_conns++;
+
+    nbd_init_connect_thread(cs);
 
-    nbd_init_connect_thread(s);
+    cs->connection_co = qemu_coroutine_create(nbd_connection_entry, cs);
+    bdrv_inc_in_flight(s->bs);
+    aio_co_schedule(bdrv_get_aio_context(s->bs), cs->connection_co);
+
+    return 0;
+}
+
+static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
+                    Error **errp)
+{
+    int ret;
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+    ret = nbd_process_options(bs, options, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->bs = bs;
+
+    ret = nbd_open_conn(s, errp);
+    if (ret < 0) {
+        nbd_clear_bdrvstate(s);
+        return ret;
+    }
+
+    /*
+     * Without NBD_FLAG_CAN_MULTI_CONN, a flush on one connection need not
+     * cover writes on the others, so stick to a single one.
+     */
+    if (s->multi_conn > 1 &&
+        !(s->conns[0]->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        warn_report("NBD server does not support multiple connections, "
+                    "using 1 instead of %" PRIu32, s->multi_conn);
+        s->multi_conn = 1;
+    }
+
+    while (s->num_conns < s->multi_conn) {
+        ret = nbd_open_conn(s, errp);
+        if (ret < 0) {
+            nbd_client_close(bs);
+            nbd_clear_bdrvstate(s);
+            return ret;
+        }
+    }
 
     return 0;
 }
@@ -2290,8 +2516,9 @@ static int nbd_co_flush(BlockDriverState *bs)
 static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-    uint32_t min = s->info.min_block;
-    uint32_t max = MIN_NON_ZERO(NBD_MAX_BUFFER_SIZE, s->info.max_block);
+    NBDExportInfo *info = &s->info;
+    uint32_t min = info->min_block;
+    uint32_t max = MIN_NON_ZERO(NBD_MAX_BUFFER_SIZE, info->max_block);
 
     /*
      * If the server did not advertise an alignment:
@@ -2306,8 +2533,8 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
      *   sub-sector requests
      */
     if (!min) {
-        min = (!QEMU_IS_ALIGNED(s->info.size, BDRV_SECTOR_SIZE) ||
-               s->info.base_allocation) ? 1 : BDRV_SECTOR_SIZE;
+        min = (!QEMU_IS_ALIGNED(info->size, BDRV_SECTOR_SIZE) ||
+               info->base_allocation) ? 1 : BDRV_SECTOR_SIZE;
     }
 
     bs->bl.request_alignment = min;
@@ -2315,9 +2542,9 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
     bs->bl.max_pwrite_zeroes = max;
     bs->bl.max_transfer = max;
 
-    if (s->info.opt_block &&
-        s->info.opt_block > bs->bl.opt_transfer) {
-        bs->bl.opt_transfer = s->info.opt_block;
+    if (info->opt_block &&
+        info->opt_block > bs->bl.opt_transfer) {
+        bs->bl.opt_transfer = info->opt_block;
     }
 }
 
@@ -2329,6 +2556,31 @@ static void nbd_close(BlockDriverState *bs)
     nbd_clear_bdrvstate(s);
 }
 
+static BlockStatsSpecific *nbd_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVNBDState *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    int i;
+
+    stats->driver = BLOCKDEV_DRIVER_NBD;
+
+    for (i = s->num_conns - 1; i >= 0; i--) {
+        NBDConnState *cs = s->conns[i];
+        BlockStatsNbdConnection *conn = g_new(BlockStatsNbdConnection, 1);
+
+        *conn = (BlockStatsNbdConnection) {
+            .connected = cs->state == NBD_CLIENT_CONNECTED,
+            .in_flight = cs->in_flight,
+            .requests = cs->nr_requests,
+            .rd_bytes = cs->rd_bytes,
+            .wr_bytes = cs->wr_bytes,
+        };
+        QAPI_LIST_PREPEND(stats->u.nbd.connections, conn);
+    }
+
+    return stats;
+}
+
 /*
  * NBD cannot truncate, but if the caller asks to truncate to the same size, or
  * to a smaller size with exact=false, there is no reason to fail the
@@ -2342,13 +2594,14 @@ static int coroutine_fn nbd_co_truncate(BlockDriverState *bs, int64_t offset,
                                         BdrvRequestFlags flags, Error **errp)
 {
     BDRVNBDState *s = bs->opaque;
+    NBDExportInfo *info = &s->info;
 
-    if (offset != s->info.size && exact) {
+    if (offset != info->size && exact) {
         error_setg(errp, "Cannot resize NBD nodes");
         return -ENOTSUP;
     }
 
-    if (offset > s->info.size) {
+    if (offset > info->size) {
         error_setg(errp, "Cannot grow NBD nodes");
         return -EINVAL;
     }
@@ -2443,6 +2696,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_co_drain_end          = nbd_client_co_drain_end,
     .bdrv_refresh_filename      = nbd_refresh_filename,
     .bdrv_co_block_status       = nbd_client_co_block_status,
+    .bdrv_get_specific_stats    = nbd_get_specific_stats,
     .bdrv_dirname               = nbd_dirname,
     .strong_runtime_opts        = nbd_strong_runtime_opts,
 };
@@ -2471,6 +2725,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_co_drain_end          = nbd_client_co_drain_end,
     .bdrv_refresh_filename      = nbd_refresh_filename,
     .bdrv_co_block_status       = nbd_client_co_block_status,
+    .bdrv_get_specific_stats    = nbd_get_specific_stats,
     .bdrv_dirname               = nbd_dirname,
     .strong_runtime_opts        = nbd_strong_runtime_opts,
 };
@@ -2499,6 +2754,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_co_drain_end          = nbd_client_co_drain_end,
     .bdrv_refresh_filename      = nbd_refresh_filename,
     .bdrv_co_block_status       = nbd_client_co_block_status,
+    .bdrv_get_specific_stats    = nbd_get_specific_stats,
     .bdrv_dirname               = nbd_dirname,
     .strong_runtime_opts        = nbd_strong_runtime_opts,
 };
@@ -52,6 +52,7 @@ typedef struct {
 typedef struct {
     BlockCompletionFunc *cb;
     void *opaque;
+    uint32_t *result; /* If set, receives dword 0 of the completion entry */
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
@@ -76,6 +77,7 @@ typedef struct {
     NVMeRequest reqs[NVME_NUM_REQS];
     int         need_kick;
     int         inflight;
+    bool        busy_polled; /* holds a busy poll reference on the context */
 
     /* Thread-safe, no lock necessary */
     QEMUBH      *completion_bh;
@@ -84,6 +86,9 @@ typedef struct {
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
+/* Upper limit for the num-io-queues option */
+#define NVME_MAX_IO_QUEUES 64
+
 /* This driver shares a single MSIX IRQ for the admin and I/O queues */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
@@ -104,6 +109,9 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    unsigned next_io_queue; /* round-robin index for nvme_get_io_queue() */
+    bool polled; /* I/O completion queues are polled instead of using IRQs */
+    int busy_polled_queues; /* polled I/O queues with requests in flight */
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -138,6 +146,8 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_IO_QUEUES "num-io-queues"
+#define NVME_BLOCK_OPT_POLLED "polled"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -155,6 +165,17 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_IO_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
+        {
+            .name = NVME_BLOCK_OPT_POLLED,
+            .type = QEMU_OPT_BOOL,
+            .help = "Reap I/O completions by polling instead of "
+                    "interrupts (default: off)",
+        },
         { /* end of list */ }
     },
 };
@@ -263,6 +284,33 @@ fail:
     return NULL;
 }
 
+/*
+ * With q->lock
+ *
+ * Polled I/O queues do not raise interrupts, so nothing but nvme_poll_cb()
+ * finds their completions.  Keep the AioContext busy polling while any of
+ * them has requests in flight.
+ */
+static void nvme_update_busy_poll(NVMeQueuePair *q)
+{
+    BDRVNVMeState *s = q->s;
+    bool busy = q->inflight > 0;
+
+    if (!s->polled || q->index == INDEX_ADMIN || busy == q->busy_polled) {
+        return;
+    }
+    q->busy_polled = busy;
+    if (busy) {
+        if (qatomic_fetch_inc(&s->busy_polled_queues) == 0) {
+            aio_context_begin_busy_poll(s->aio_context);
+            /* Make sure that aio_poll() polls our handler */
+            event_notifier_set(&s->irq_notifier[MSIX_SHARED_IRQ_IDX]);
+        }
+    } else if (qatomic_fetch_dec(&s->busy_polled_queues) == 1) {
+        aio_context_end_busy_poll(s->aio_context);
+    }
+}
+
 /* With q->lock */
 static void nvme_kick(NVMeQueuePair *q)
 {
@@ -278,6 +326,7 @@ static void nvme_kick(NVMeQueuePair *q)
     *q->sq.doorbell = cpu_to_le32(q->sq.tail);
     q->inflight += q->need_kick;
     q->need_kick = 0;
+    nvme_update_busy_poll(q);
 }
 
 /* Find a free request element if any, otherwise:
@@ -408,8 +457,12 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         nvme_put_free_req_locked(q, preq);
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         q->inflight--;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, ret);
@@ -424,6 +477,7 @@ static bool nvme_process_completion(NVMeQueuePair *q)
     }
 
     qemu_bh_cancel(q->completion_bh);
+    nvme_update_busy_poll(q);
 
     return progress;
 }
@@ -486,8 +540,12 @@ static void nvme_cmd_sync_cb(void *opaque, int ret)
     aio_wait_kick();
 }
 
-static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
-                         NvmeCmd *cmd)
+/*
+ * Run @cmd on @q and wait for it to complete.  If @result is not NULL, it
+ * receives dword 0 of the completion entry.
+ */
+static int nvme_cmd_sync_result(BlockDriverState *bs, NVMeQueuePair *q,
+                                NvmeCmd *cmd, uint32_t *result)
 {
     AioContext *aio_context = bdrv_get_aio_context(bs);
     NVMeRequest *req;
@@ -496,12 +554,19 @@ static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(q, req, cmd, nvme_cmd_sync_cb, &ret);
 
     AIO_WAIT_WHILE(aio_context, ret == -EINPROGRESS);
     return ret;
 }
 
+static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
+                         NvmeCmd *cmd)
+{
+    return nvme_cmd_sync_result(bs, q, cmd, NULL);
+}
+
 static void nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
@@ -653,7 +718,8 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | (n & 0xFFFF)),
-        .cdw11 = cpu_to_le32(0x3),
+        /* Physically contiguous, interrupts enabled unless polled */
+        .cdw11 = cpu_to_le32(s->polled ? 0x1 : 0x3),
     };
     if (nvme_cmd_sync(bs, s->queues[INDEX_ADMIN], &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%d]", n);
@@ -678,6 +744,52 @@ out_error:
     return false;
 }
 
+/*
+ * Ask the controller for *@num_io_queues I/O submission and completion
+ * queues.  The controller may allocate fewer than requested, in which case
+ * *@num_io_queues is lowered to what it allocated.  This must happen before
+ * any I/O queue is created.
+ */
+static bool nvme_set_num_io_queues(BlockDriverState *bs, int *num_io_queues,
+                                   Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((*num_io_queues - 1) << 16) |
+                             (*num_io_queues - 1)),
+    };
+    uint32_t result;
+    int nsqa, ncqa;
+
+    if (nvme_cmd_sync_result(bs, s->queues[INDEX_ADMIN], &cmd, &result)) {
+        error_setg(errp, "Failed to allocate %d I/O queues", *num_io_queues);
+        return false;
+    }
+
+    /* Both counts are 0's based */
+    nsqa = (result & 0xffff) + 1;
+    ncqa = (result >> 16) + 1;
+    trace_nvme_set_num_io_queues(s, *num_io_queues, nsqa, ncqa);
+    if (MIN(nsqa, ncqa) < *num_io_queues) {
+        warn_report("NVMe controller only allocated %d I/O queues, "
+                    "using them instead of the %d requested",
+                    MIN(nsqa, ncqa), *num_io_queues);
+        *num_io_queues = MIN(nsqa, ncqa);
+    }
+    return true;
+}
+
+/* Spread requests over the I/O queue pairs */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    int nr_io_queues = s->nr_queues - INDEX_IO(0);
+
+    assert(nr_io_queues > 0);
+    return s->queues[INDEX_IO(s->next_io_queue++ % nr_io_queues)];
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -689,11 +801,12 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     int num_io_queues, bool polled, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     AioContext *aio_context = bdrv_get_aio_context(bs);
     int ret;
+    int i;
     uint64_t cap;
     uint64_t timeout_ms;
     uint64_t deadline, now;
@@ -704,6 +817,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     qemu_co_queue_init(&s->dma_flush_queue);
     s->device = g_strdup(device);
     s->nsid = namespace;
+    s->polled = polled;
     s->aio_context = bdrv_get_aio_context(bs);
     ret = event_notifier_init(&s->irq_notifier[MSIX_SHARED_IRQ_IDX], 0);
     if (ret) {
@@ -735,6 +849,12 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
 
     s->page_size = MAX(4096, 1 << NVME_CAP_MPSMIN(cap));
     s->doorbell_scale = (4 << NVME_CAP_DSTRD(cap)) / sizeof(uint32_t);
+    if ((num_io_queues + 1) * s->doorbell_scale * sizeof(*s->doorbells) >
+        NVME_DOORBELL_SIZE) {
+        error_setg(errp, "Too many I/O queues for the doorbell stride");
+        ret = -EINVAL;
+        goto out;
+    }
     bs->bl.opt_mem_alignment = s->page_size;
     timeout_ms = MIN(500 * NVME_CAP_TO(cap), 30000);
 
@@ -809,8 +929,16 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (num_io_queues > 1 &&
+        !nvme_set_num_io_queues(bs, &num_io_queues, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    for (i = 0; i < num_io_queues; i++) {
+        if (!nvme_add_io_queue(bs, errp)) {
+            ret = -EIO;
+            goto out;
+        }
     }
 out:
     if (regs) {
@@ -902,6 +1030,8 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t num_io_queues;
+    bool polled;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -917,7 +1047,15 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    num_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_IO_QUEUES, 1);
+    if (num_io_queues < 1 || num_io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_IO_QUEUES "' must be between "
+                   "1 and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    polled = qemu_opt_get_bool(opts, NVME_BLOCK_OPT_POLLED, false);
+    ret = nvme_init(bs, device, namespace, num_io_queues, polled, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1088,7 +1226,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1205,7 +1343,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1236,7 +1374,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = ((bytes >> s->blkshift) - 1) & 0xFFFF;
@@ -1289,7 +1427,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
@@ -45,10 +45,16 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->max_threads) {
+        s->nb_threads_queued++;
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
+        s->nb_threads_queued--;
     }
     s->nb_threads++;
+    if (s->nb_threads < s->max_threads) {
+        /* The limit may have been raised while we waited, pass it on */
+        qemu_co_queue_next(&s->thread_task_queue);
+    }
     qemu_co_mutex_unlock(&s->lock);
 
     ret = thread_pool_submit_co(pool, func, arg);
@@ -80,6 +80,12 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            QEMUIOVector *qiov,
                            size_t qiov_offset);
 
+typedef struct Qcow2CompressedBatch Qcow2CompressedBatch;
+static int coroutine_fn
+qcow2_co_preadv_compressed_batch(BlockDriverState *bs,
+                                 Qcow2CompressedBatch *batch,
+                                 QEMUIOVector *qiov);
+
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
     const QCowHeader *cow_header = (const void *)buf;
@@ -316,10 +322,11 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, QCOW2_MAX_THREADS, errp);
+                                           bs, cflags, s->max_threads, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
+            s->crypto_max_threads = s->max_threads;
         }   break;
 
         case QCOW2_EXT_MAGIC_BITMAPS:
@@ -697,6 +704,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_MAX_THREADS,
     NULL
 };
 
@@ -808,6 +816,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_MAX_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of concurrent compression and "
+                    "encryption tasks (default: number of host CPUs)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -967,9 +981,21 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    int max_threads;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
+/* By default, let each host CPU work on a compression or encryption task */
+static int qcow2_default_max_threads(void)
+{
+    long host_procs = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return MAX(1, MIN(host_procs, QCOW2_MAX_THREADS));
+}
+
 static int qcow2_update_options_prepare(BlockDriverState *bs,
                                         Qcow2ReopenState *r,
                                         QDict *options, int flags,
@@ -980,6 +1006,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t max_threads;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1071,6 +1098,23 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    max_threads = qemu_opt_get_number(opts, QCOW2_OPT_MAX_THREADS,
+                                      qcow2_default_max_threads());
+    if (max_threads < 1 || max_threads > QCOW2_MAX_THREADS) {
+        error_setg(errp, QCOW2_OPT_MAX_THREADS " must be between 1 and %d",
+                   QCOW2_MAX_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->crypto && max_threads > s->crypto_max_threads) {
+        /* Every encryption task needs a cipher of its own */
+        error_setg(errp, QCOW2_OPT_MAX_THREADS " cannot be raised above %d "
+                   "on an open encrypted image", s->crypto_max_threads);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->max_threads = max_threads;
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1221,6 +1265,14 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /*
+     * Reopen runs drained, so no task is waiting for a slot here.  Should
+     * one be queued anyway, it is woken and wakes the next one for as long
+     * as the raised limit leaves free slots.
+     */
+    s->max_threads = r->max_threads;
+    qemu_co_enter_next(&s->thread_task_queue, NULL);
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1289,6 +1341,186 @@ static int validate_compression_type(BDRVQcow2State *s, Error **errp)
     return 0;
 }
 
+static void qcow2_decompressed_cache_init(BDRVQcow2State *s)
+{
+    s->decompressed_cache_size = MAX(1, QCOW2_DECOMPRESSED_CACHE_SIZE /
+                                        s->cluster_size);
+    s->decompressed_cache = g_new0(Qcow2DecompressedCluster,
+                                   s->decompressed_cache_size);
+}
+
+static void qcow2_decompressed_cache_destroy(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        qemu_vfree(s->decompressed_cache[i].data);
+    }
+    g_free(s->decompressed_cache);
+    s->decompressed_cache = NULL;
+    s->decompressed_cache_size = 0;
+}
+
+/*
+ * Copy @bytes at guest @offset of the compressed cluster @descriptor to @qiov
+ * if the cluster is in the decompressed cluster cache.
+ */
+static bool qcow2_decompressed_cache_read(BDRVQcow2State *s,
+                                          uint64_t descriptor,
+                                          uint64_t offset, uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset)
+{
+    int i;
+
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (c->descriptor == descriptor) {
+            c->lru_counter = ++s->decompressed_cache_lru_counter;
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                c->data + offset_into_cluster(s, offset),
+                                bytes);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Add a decompressed cluster to the cache, which takes ownership of @data.
+ * @gen is the cache generation from before the compressed data was read;
+ * if clusters were discarded since then, the data may be stale.
+ */
+static void qcow2_decompressed_cache_put(BDRVQcow2State *s,
+                                         uint64_t descriptor, uint8_t *data,
+                                         uint64_t gen)
+{
+    Qcow2DecompressedCluster *victim = NULL;
+    int i;
+
+    if (gen != s->decompressed_cache_gen) {
+        qemu_vfree(data);
+        return;
+    }
+
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (c->descriptor == descriptor) {
+            /* Decompressed concurrently by another request */
+            qemu_vfree(data);
+            return;
+        }
+        if (!victim || c->lru_counter < victim->lru_counter) {
+            victim = c;
+        }
+    }
+
+    if (!victim) {
+        qemu_vfree(data);
+        return;
+    }
+
+    qemu_vfree(victim->data);
+    *victim = (Qcow2DecompressedCluster) {
+        .descriptor = descriptor,
+        .lru_counter = ++s->decompressed_cache_lru_counter,
+        .data = data,
+    };
+}
+
+/*
+ * Drop cached clusters whose compressed data starts at @host_offset, which is
+ * about to be overwritten with a new compressed cluster.
+ */
+static void qcow2_decompressed_cache_discard(BDRVQcow2State *s,
+                                             uint64_t host_offset)
+{
+    int i;
+
+    s->decompressed_cache_gen++;
+    for (i = 0; i < s->decompressed_cache_size; i++) {
+        Qcow2DecompressedCluster *c = &s->decompressed_cache[i];
+
+        if (c->descriptor &&
+            (c->descriptor & s->cluster_offset_mask) == host_offset) {
+            qemu_vfree(c->data);
+            *c = (Qcow2DecompressedCluster) {};
+        }
+    }
+}
+
+static void qcow2_parse_compressed_descriptor(BDRVQcow2State *s,
+                                              uint64_t descriptor,
+                                              uint64_t *coffset, int *csize)
+{
+    int nb_csectors;
+
+    *coffset = descriptor & s->cluster_offset_mask;
+    nb_csectors = ((descriptor >> s->csize_shift) & s->csize_mask) + 1;
+    *csize = nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE -
+        (*coffset & ~QCOW2_COMPRESSED_SECTOR_MASK);
+}
+
+typedef struct Qcow2CompressedBatchEntry {
+    uint64_t descriptor;
+    uint64_t offset;
+    uint64_t bytes;
+    size_t qiov_offset;
+} Qcow2CompressedBatchEntry;
+
+/* Compressed clusters whose data is read from the image file at once */
+struct Qcow2CompressedBatch {
+    uint64_t host_offset;
+    uint64_t host_bytes;
+    int nb_clusters;
+    Qcow2CompressedBatchEntry clusters[QCOW2_MAX_COMPRESSED_BATCH];
+};
+
+/*
+ * Add a compressed cluster to @batch.  Returns false if the batch is full or
+ * the compressed data does not directly follow the data already in it.
+ */
+static bool qcow2_compressed_batch_add(BDRVQcow2State *s,
+                                       Qcow2CompressedBatch *batch,
+                                       uint64_t descriptor, uint64_t offset,
+                                       uint64_t bytes, size_t qiov_offset)
+{
+    uint64_t coffset;
+    int csize;
+
+    qcow2_parse_compressed_descriptor(s, descriptor, &coffset, &csize);
+
+    if (batch->nb_clusters == 0) {
+        batch->host_offset = coffset;
+        batch->host_bytes = csize;
+    } else {
+        Qcow2CompressedBatchEntry *prev =
+            &batch->clusters[batch->nb_clusters - 1];
+
+        /*
+         * Compressed clusters are packed one after another, the last sector
+         * of one can hold the start of the next.
+         */
+        if (batch->nb_clusters == QCOW2_MAX_COMPRESSED_BATCH ||
+            coffset <= (prev->descriptor & s->cluster_offset_mask) ||
+            coffset > batch->host_offset + batch->host_bytes) {
+            return false;
+        }
+        batch->host_bytes = MAX(batch->host_bytes,
+                                coffset + csize - batch->host_offset);
+    }
+
+    batch->clusters[batch->nb_clusters++] = (Qcow2CompressedBatchEntry) {
+        .descriptor = descriptor,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov_offset = qiov_offset,
+    };
+    return true;
+}
+
 /* Called with s->lock held.  */
 static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
                                       int flags, Error **errp)
@@ -1669,11 +1901,12 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            NULL, NULL, cflags,
-                                           QCOW2_MAX_THREADS, errp);
+                                           s->max_threads, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
             }
+            s->crypto_max_threads = s->max_threads;
         } else if (!(flags & BDRV_O_NO_IO)) {
             error_setg(errp, "Missing CRYPTO header for crypt method %d",
                        s->crypt_method_header);
@@ -1832,6 +2065,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qcow2_decompressed_cache_init(s);
 
     return ret;
 
@@ -2181,6 +2415,7 @@ typedef struct Qcow2AioTask {
     QEMUIOVector *qiov;
     uint64_t qiov_offset;
     QCowL2Meta *l2meta; /* only for write */
+    Qcow2CompressedBatch *batch; /* only for batched compressed reads */
 } Qcow2AioTask;
 
 static coroutine_fn int qcow2_co_preadv_task_entry(AioTask *task);
@@ -2274,11 +2509,46 @@ static coroutine_fn int qcow2_co_preadv_task_entry(AioTask *task)
 
     assert(!t->l2meta);
 
+    if (t->batch) {
+        int ret = qcow2_co_preadv_compressed_batch(t->bs, t->batch, t->qiov);
+        g_free(t->batch);
+        return ret;
+    }
+
     return qcow2_co_preadv_task(t->bs, t->subcluster_type,
                                 t->host_offset, t->offset, t->bytes,
                                 t->qiov, t->qiov_offset);
 }
 
+static coroutine_fn int
+qcow2_add_compressed_batch_task(BlockDriverState *bs, AioTaskPool *pool,
+                                Qcow2CompressedBatch *batch,
+                                QEMUIOVector *qiov)
+{
+    Qcow2AioTask local_task;
+    Qcow2AioTask *task = pool ? g_new(Qcow2AioTask, 1) : &local_task;
+
+    *task = (Qcow2AioTask) {
+        .task.func = qcow2_co_preadv_task_entry,
+        .bs = bs,
+        .subcluster_type = QCOW2_SUBCLUSTER_COMPRESSED,
+        .qiov = qiov,
+        .batch = batch,
+    };
+
+    trace_qcow2_add_compressed_batch(qemu_coroutine_self(), bs, pool,
+                                     batch->nb_clusters, batch->host_offset,
+                                     batch->host_bytes);
+
+    if (!pool) {
+        return qcow2_co_preadv_task_entry(&task->task);
+    }
+
+    aio_task_pool_start_task(pool, &task->task);
+
+    return 0;
+}
+
 static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
                                              uint64_t offset, uint64_t bytes,
                                              QEMUIOVector *qiov,
@@ -2290,6 +2560,7 @@ static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
     uint64_t host_offset = 0;
     QCow2SubclusterType type;
     AioTaskPool *aio = NULL;
+    Qcow2CompressedBatch *batch = NULL;
 
     while (bytes != 0 && aio_task_pool_status(aio) == 0) {
         /* prepare next request */
@@ -2313,6 +2584,31 @@ static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
             (type == QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC && !bs->backing))
         {
             qemu_iovec_memset(qiov, qiov_offset, 0, cur_bytes);
+        } else if (type == QCOW2_SUBCLUSTER_COMPRESSED &&
+                   qcow2_decompressed_cache_read(s, host_offset, offset,
+                                                 cur_bytes, qiov,
+                                                 qiov_offset)) {
+            /* Served from the decompressed cluster cache */
+        } else if (type == QCOW2_SUBCLUSTER_COMPRESSED &&
+                   (batch || cur_bytes != bytes)) {
+            /* Collect adjacent compressed clusters to read them at once */
+            if (batch &&
+                !qcow2_compressed_batch_add(s, batch, host_offset, offset,
+                                            cur_bytes, qiov_offset)) {
+                if (!aio) {
+                    aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+                }
+                ret = qcow2_add_compressed_batch_task(bs, aio, batch, qiov);
+                batch = NULL;
+                if (ret < 0) {
+                    goto out;
+                }
+            }
+            if (!batch) {
+                batch = g_new0(Qcow2CompressedBatch, 1);
+                qcow2_compressed_batch_add(s, batch, host_offset, offset,
+                                           cur_bytes, qiov_offset);
+            }
         } else {
             if (!aio && cur_bytes != bytes) {
                 aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
@@ -2330,7 +2626,13 @@ static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
         qiov_offset += cur_bytes;
     }
 
+    if (batch && aio_task_pool_status(aio) == 0) {
+        ret = qcow2_add_compressed_batch_task(bs, aio, batch, qiov);
+        batch = NULL;
+    }
+
 out:
+    g_free(batch);
     if (aio) {
         aio_task_pool_wait_all(aio);
         if (ret == 0) {
@@ -2696,6 +2998,7 @@ static void qcow2_close(BlockDriverState *bs)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompressed_cache_destroy(s);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4533,6 +4836,7 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
         qemu_co_mutex_unlock(&s->lock);
         goto fail;
     }
+    qcow2_decompressed_cache_discard(s, cluster_offset);
 
     ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
     qemu_co_mutex_unlock(&s->lock);
@@ -4630,6 +4934,29 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+static int coroutine_fn
+qcow2_co_decompress_cluster(BlockDriverState *bs, uint64_t cluster_descriptor,
+                            const uint8_t *buf, int csize, uint64_t cache_gen,
+                            uint64_t offset, uint64_t bytes,
+                            QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint8_t *out_buf;
+
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        qemu_vfree(out_buf);
+        return -EIO;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+    qcow2_decompressed_cache_put(s, cluster_descriptor, out_buf, cache_gen);
+
+    return 0;
+}
+
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t cluster_descriptor,
@@ -4639,38 +4966,105 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret = 0, csize, nb_csectors;
+    int ret = 0, csize;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint64_t cache_gen = s->decompressed_cache_gen;
+    uint8_t *buf;
 
-    coffset = cluster_descriptor & s->cluster_offset_mask;
-    nb_csectors = ((cluster_descriptor >> s->csize_shift) & s->csize_mask) + 1;
-    csize = nb_csectors * QCOW2_COMPRESSED_SECTOR_SIZE -
-        (coffset & ~QCOW2_COMPRESSED_SECTOR_MASK);
+    qcow2_parse_compressed_descriptor(s, cluster_descriptor, &coffset, &csize);
 
     buf = g_try_malloc(csize);
     if (!buf) {
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
     BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
-    if (ret < 0) {
-        goto fail;
+    if (ret >= 0) {
+        ret = qcow2_co_decompress_cluster(bs, cluster_descriptor, buf, csize,
+                                          cache_gen, offset, bytes, qiov,
+                                          qiov_offset);
     }
 
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
+    g_free(buf);
+
+    return ret;
+}
+
+typedef struct Qcow2DecompressTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    const uint8_t *buf;
+    int csize;
+    uint64_t cache_gen;
+    Qcow2CompressedBatchEntry *entry;
+    QEMUIOVector *qiov;
+} Qcow2DecompressTask;
+
+static coroutine_fn int qcow2_co_decompress_task_entry(AioTask *task)
+{
+    Qcow2DecompressTask *t = container_of(task, Qcow2DecompressTask, task);
+
+    return qcow2_co_decompress_cluster(t->bs, t->entry->descriptor, t->buf,
+                                       t->csize, t->cache_gen,
+                                       t->entry->offset, t->entry->bytes,
+                                       t->qiov, t->entry->qiov_offset);
+}
+
+/*
+ * Read the compressed data of all clusters in @batch with a single request
+ * and decompress the clusters in parallel.
+ */
+static int coroutine_fn
+qcow2_co_preadv_compressed_batch(BlockDriverState *bs,
+                                 Qcow2CompressedBatch *batch,
+                                 QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    AioTaskPool *aio;
+    uint64_t cache_gen = s->decompressed_cache_gen;
+    uint8_t *buf;
+    int i, ret;
+
+    buf = g_try_malloc(batch->host_bytes);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, batch->host_offset, batch->host_bytes,
+                        buf, 0);
+    if (ret < 0) {
         goto fail;
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+    aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    for (i = 0; i < batch->nb_clusters && aio_task_pool_status(aio) == 0;
+         i++)
+    {
+        Qcow2DecompressTask *t = g_new(Qcow2DecompressTask, 1);
+        uint64_t coffset;
+        int csize;
+
+        qcow2_parse_compressed_descriptor(s, batch->clusters[i].descriptor,
+                                          &coffset, &csize);
+        *t = (Qcow2DecompressTask) {
+            .task.func = qcow2_co_decompress_task_entry,
+            .bs = bs,
+            .buf = buf + (coffset - batch->host_offset),
+            .csize = csize,
+            .cache_gen = cache_gen,
+            .entry = &batch->clusters[i],
+            .qiov = qiov,
+        };
+        aio_task_pool_start_task(aio, &t->task);
+    }
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    g_free(aio);
 
 fail:
-    qemu_vfree(out_buf);
     g_free(buf);
 
     return ret;
@@ -5059,6 +5453,21 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2 = (BlockStatsSpecificQcow2) {
+        .max_threads = s->max_threads,
+        .threads_in_flight = s->nb_threads,
+        .threads_queued = s->nb_threads_queued,
+    };
+
+    return stats;
+}
+
 static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
                                                   Error **errp)
 {
@@ -5912,6 +6321,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
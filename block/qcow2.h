@@ -71,6 +71,12 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Maximum number of adjacent compressed clusters read with one request */
+#define QCOW2_MAX_COMPRESSED_BATCH 16
+
+/* Memory for keeping recently decompressed clusters, at least one cluster */
+#define QCOW2_DECOMPRESSED_CACHE_SIZE (1 * MiB)
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -150,6 +156,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_MAX_THREADS "max-threads"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -315,6 +322,12 @@ typedef uint64_t Qcow2GetRefcountFunc(const void *refcount_array,
 typedef void Qcow2SetRefcountFunc(void *refcount_array,
                                   uint64_t index, uint64_t value);
 
+typedef struct Qcow2DecompressedCluster {
+    uint64_t descriptor; /* compressed cluster descriptor, 0 if unused */
+    uint64_t lru_counter;
+    uint8_t *data;
+} Qcow2DecompressedCluster;
+
 typedef struct Qcow2BitmapHeaderExt {
     uint32_t nb_bitmaps;
     uint32_t reserved32;
@@ -322,7 +335,11 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Upper limit for the max-threads option, matching the maximum size of the
+ * AioContext thread pool.  Encrypted images get a cipher for each of these.
+ */
+#define QCOW2_MAX_THREADS 64
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -406,8 +423,27 @@ typedef struct BDRVQcow2State {
     char *image_backing_format;
     char *image_data_file;
 
+    /*
+     * Compression, decompression and encryption tasks running in the thread
+     * pool (at most max_threads) and waiting for a free slot, protected by
+     * lock.
+     */
     CoQueue thread_task_queue;
     int nb_threads;
+    int nb_threads_queued;
+    int max_threads;
+    /* Number of ciphers in crypto, which bounds max_threads when reopening */
+    int crypto_max_threads;
+
+    /*
+     * Recently decompressed clusters, so that reading a compressed cluster in
+     * several small requests only decompresses it once.  Only accessed
+     * without yielding, so it does not need a lock.
+     */
+    Qcow2DecompressedCluster *decompressed_cache;
+    int decompressed_cache_size;
+    uint64_t decompressed_cache_lru_counter;
+    uint64_t decompressed_cache_gen; /* incremented on discard */
 
     BdrvChild *data_file;
 
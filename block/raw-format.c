@@ -568,6 +568,19 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
                                  read_flags, write_flags);
 }
 
+static int raw_get_host_fd(BlockDriverState *bs, int64_t offset,
+                           int64_t bytes, int64_t *host_offset)
+{
+    uint64_t file_offset = offset;
+    int ret;
+
+    ret = raw_adjust_offset(bs, &file_offset, bytes, false);
+    if (ret) {
+        return ret;
+    }
+    return bdrv_get_host_fd(bs->file->bs, file_offset, bytes, host_offset);
+}
+
 static const char *const raw_strong_runtime_opts[] = {
     "offset",
     "size",
@@ -592,6 +605,7 @@ BlockDriver bdrv_raw = {
     .bdrv_co_block_status = &raw_co_block_status,
     .bdrv_co_copy_range_from = &raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = &raw_co_copy_range_to,
+    .bdrv_get_host_fd     = &raw_get_host_fd,
     .bdrv_co_truncate     = &raw_co_truncate,
     .bdrv_getlength       = &raw_getlength,
     .is_format            = true,
@@ -295,7 +295,9 @@ ERST
 
 SRST
   ``info opcount``
-    Show dynamic compiler opcode counters
+    Show dynamic compiler opcode counters: for each opcode, how many
+    were emitted and how many were eliminated by the optimizer and the
+    liveness analysis
 ERST
 
     {
@@ -43,6 +43,16 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * IOThreads from the vq-iothread property and the AioContext that
+     * processes each virtqueue.  The BlockBackend stays in ctx, so virtqueues
+     * in other AioContexts take ctx's lock while they are processed.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    AioContext **vq_aio_context;
+    bool external_disabled;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -88,10 +98,25 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->num_vq_iothreads > conf->num_queues) {
+        error_setg(errp, "vq-iothread has more entries (%" PRIu32 ") than "
+                   "num-queues (%" PRIu16 ")", conf->num_vq_iothreads,
+                   conf->num_queues);
+        return false;
+    }
+    for (i = 0; i < conf->num_vq_iothreads; i++) {
+        if (!conf->vq_iothreads[i] || !iothread_by_id(conf->vq_iothreads[i])) {
+            error_setg(errp, "vq-iothread[%u]: iothread '%s' not found", i,
+                       conf->vq_iothreads[i] ? conf->vq_iothreads[i] : "");
+            return false;
+        }
+    }
+
+    if (conf->iothread || conf->num_vq_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -120,8 +145,18 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
+    if (conf->num_vq_iothreads) {
+        s->num_vq_iothreads = conf->num_vq_iothreads;
+        s->vq_iothreads = g_new(IOThread *, s->num_vq_iothreads);
+        for (i = 0; i < s->num_vq_iothreads; i++) {
+            s->vq_iothreads[i] = iothread_by_id(conf->vq_iothreads[i]);
+            object_ref(OBJECT(s->vq_iothreads[i]));
+        }
+    }
+
+    if (conf->iothread || s->vq_iothreads) {
+        /* The BlockBackend lives in the first vq-iothread by default */
+        s->iothread = conf->iothread ? conf->iothread : s->vq_iothreads[0];
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
@@ -130,6 +165,18 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
+    /* Virtqueues are assigned to vq-iothread entries round-robin */
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        if (s->vq_iothreads) {
+            IOThread *iothread = s->vq_iothreads[i % s->num_vq_iothreads];
+
+            s->vq_aio_context[i] = iothread_get_aio_context(iothread);
+        } else {
+            s->vq_aio_context[i] = s->ctx;
+        }
+    }
+
     *dataplane = s;
 
     return true;
@@ -139,6 +186,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -151,6 +199,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -158,11 +211,97 @@ static bool virtio_blk_data_plane_handle_output(VirtIODevice *vdev,
                                                 VirtQueue *vq)
 {
     VirtIOBlock *s = (VirtIOBlock *)vdev;
+    VirtIOBlockDataPlane *dp = s->dataplane;
+    AioContext *ctx = qemu_get_current_aio_context();
+    bool progress;
 
     assert(s->dataplane);
     assert(s->dataplane_started);
 
-    return virtio_blk_handle_vq(s, vq);
+    if (ctx == dp->ctx) {
+        return virtio_blk_handle_vq(s, vq);
+    }
+
+    /*
+     * The virtqueue is processed in a different IOThread than the one the
+     * BlockBackend lives in.  ctx's lock serializes virtqueue accesses with
+     * request completion, and requests are handed over to dp->ctx by the
+     * block layer.  A drained section may have begun while we were waiting
+     * for the lock; in that case leave the requests in the virtqueue until
+     * virtio_blk_data_plane_drained_end() kicks it again.
+     */
+    aio_context_acquire(dp->ctx);
+    if (aio_external_disabled(ctx)) {
+        aio_context_release(dp->ctx);
+        return false;
+    }
+    progress = virtio_blk_handle_vq(s, vq);
+    aio_context_release(dp->ctx);
+    return progress;
+}
+
+/* Is @i the first virtqueue that is processed in its AioContext? */
+static bool virtio_blk_data_plane_first_vq_in_ctx(VirtIOBlockDataPlane *s,
+                                                  unsigned i)
+{
+    unsigned j;
+
+    for (j = 0; j < i; j++) {
+        if (s->vq_aio_context[j] == s->vq_aio_context[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The block layer only quiesces the BlockBackend's AioContext, stop
+ * processing virtqueues in the other AioContexts too.
+ *
+ * Context: BlockBackend AioContext acquired
+ */
+void virtio_blk_data_plane_drained_begin(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    if (!s->vq_iothreads || s->external_disabled) {
+        return;
+    }
+
+    for (i = 0; i < s->conf->num_queues; i++) {
+        if (s->vq_aio_context[i] != s->ctx &&
+            virtio_blk_data_plane_first_vq_in_ctx(s, i)) {
+            aio_disable_external(s->vq_aio_context[i]);
+        }
+    }
+    s->external_disabled = true;
+}
+
+/* Context: BlockBackend AioContext acquired */
+void virtio_blk_data_plane_drained_end(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    if (!s->external_disabled) {
+        return;
+    }
+
+    for (i = 0; i < s->conf->num_queues; i++) {
+        if (s->vq_aio_context[i] != s->ctx &&
+            virtio_blk_data_plane_first_vq_in_ctx(s, i)) {
+            aio_enable_external(s->vq_aio_context[i]);
+        }
+    }
+    s->external_disabled = false;
+
+    /* Pick up requests that were left behind during the drained section */
+    for (i = 0; i < s->conf->num_queues; i++) {
+        if (s->vq_aio_context[i] != s->ctx) {
+            VirtQueue *vq = virtio_get_queue(s->vdev, i);
+
+            event_notifier_set(virtio_queue_get_host_notifier(vq));
+        }
+    }
 }
 
 /* Context: QEMU global mutex held */
@@ -183,7 +322,13 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
     s->starting = true;
 
-    if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    /*
+     * Batched notifications are only used by the BlockBackend's AioContext,
+     * so they are not possible when completions for a virtqueue can race
+     * with the IOThread that processes it.
+     */
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX) &&
+        !s->vq_iothreads) {
         s->batch_notifications = true;
     } else {
         s->batch_notifications = false;
@@ -231,14 +376,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -260,12 +406,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vq_aio_context[i] == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
+        }
     }
 }
 
@@ -292,6 +441,17 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    /* Virtqueues in other IOThreads must stop before the BlockBackend moves */
+    for (i = 0; i < nvqs; i++) {
+        AioContext *ctx = s->vq_aio_context[i];
+
+        if (ctx != s->ctx && virtio_blk_data_plane_first_vq_in_ctx(s, i)) {
+            aio_context_acquire(ctx);
+            aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+            aio_context_release(ctx);
+        }
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
@@ -22,6 +22,7 @@
 #include "qemu/event_notifier.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
+#include "qemu/stats64.h"
 
 typedef struct BlockAIOCB BlockAIOCB;
 typedef void BlockCompletionFunc(void *opaque, int ret);
@@ -51,6 +52,9 @@ typedef void QEMUBHFunc(void *opaque);
 typedef bool AioPollFn(void *opaque);
 typedef void IOHandler(void *opaque);
 
+/* Number of buckets in the polling inter-arrival time histograms */
+#define AIO_POLL_HISTOGRAM_BUCKETS 20
+
 struct Coroutine;
 struct ThreadPool;
 struct LinuxAioState;
@@ -211,6 +215,10 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /* Parameters for linux_io_uring, see aio_context_set_io_uring_params() */
+    bool linux_io_uring_sqpoll;
+    int linux_io_uring_sqpoll_cpu;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -226,11 +234,24 @@ struct AioContext {
     /* Number of AioHandlers without .io_poll() */
     int poll_disable_cnt;
 
+    /* Number of aio_context_begin_busy_poll() calls without matching end */
+    int busy_poll_cnt;
+
     /* Polling mode parameters */
     int64_t poll_ns;        /* current polling time in nanoseconds */
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    int64_t poll_percentile; /* target event percentile, 0 for grow/shrink */
+
+    /*
+     * Polling statistics.  Updated by the event loop thread and read by
+     * query-iothreads.  Bucket 0 of the inter-arrival time histogram counts
+     * intervals below 1024 ns, bucket i intervals below 1024 << i ns and the
+     * last bucket everything else.
+     */
+    Stat64 poll_time_ns;
+    Stat64 poll_histogram[AIO_POLL_HISTOGRAM_BUCKETS];
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -492,6 +513,12 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/*
+ * Return how often the SQPOLL kernel thread of the LuringState bound to this
+ * AioContext had to be woken up, or 0 if there is none.
+ */
+uint64_t aio_get_linux_io_uring_sqpoll_wakeups(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -720,11 +747,64 @@ void aio_context_use_g_source(AioContext *ctx);
  * @max_ns: how long to busy poll for, in nanoseconds
  * @grow: polling time growth factor
  * @shrink: polling time shrink factor
+ * @percentile: percentile of event inter-arrival times to cover, 1-100
  *
  * Poll mode can be disabled by setting poll_max_ns to 0.
+ *
+ * If @percentile is non-zero, @grow and @shrink are ignored.  Instead the
+ * polling time is chosen from a histogram of inter-arrival times kept for
+ * each handler, so that @percentile percent of the events on the busiest
+ * handler arrive within the polling time.
  */
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
-                                 Error **errp);
+                                 int64_t percentile, Error **errp);
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @histogram: array of AIO_POLL_HISTOGRAM_BUCKETS elements to fill in
+ *
+ * Return the time spent polling in nanoseconds and store the number of
+ * events per inter-arrival time bucket in @histogram.
+ */
+uint64_t aio_context_get_poll_stats(AioContext *ctx, uint64_t *histogram);
+
+/**
+ * aio_context_begin_busy_poll:
+ * @ctx: the aio context
+ *
+ * Make aio_poll() keep calling the ->io_poll() handlers of @ctx until the
+ * next timer expires instead of waiting for file descriptors, regardless
+ * of the polling time.  This is for handlers whose device does not signal
+ * completions, so that only polling can find them.  Calls nest and must be
+ * matched by aio_context_end_busy_poll().
+ *
+ * The handlers are only polled after they have been dispatched once, and
+ * not after they were idle for a while, so the caller must make sure that
+ * they are, e.g. by signalling their event notifier.
+ */
+void aio_context_begin_busy_poll(AioContext *ctx);
+
+/**
+ * aio_context_end_busy_poll:
+ * @ctx: the aio context
+ *
+ * Undo aio_context_begin_busy_poll().
+ */
+void aio_context_end_busy_poll(AioContext *ctx);
+
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: whether a kernel thread polls the submission queue
+ * @sqpoll_cpu: host CPU the kernel thread is bound to, or -1
+ *
+ * Set up the io_uring used for block I/O with IORING_SETUP_SQPOLL so that
+ * submitting requests does not need a system call while the kernel thread is
+ * awake.  Must be called before the ring is created.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int sqpoll_cpu, Error **errp);
 
 #endif
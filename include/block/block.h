@@ -836,4 +836,18 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                     BdrvChild *dst, uint64_t dst_offset,
                                     uint64_t bytes, BdrvRequestFlags read_flags,
                                     BdrvRequestFlags write_flags);
+
+/**
+ * bdrv_get_host_fd:
+ *
+ * Look up a host file descriptor that holds the data of @bs in
+ * [@offset, @offset + @bytes) unchanged, for zero-copy transfers that bypass
+ * the block layer.  The file descriptor is only valid until the node is
+ * drained, so callers must keep an in-flight reference while using it.
+ *
+ * Returns: the file descriptor, with the offset of the data in it stored in
+ * @host_offset; negative error code if the data cannot be read this way.
+ **/
+int bdrv_get_host_fd(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     int64_t *host_offset);
 #endif
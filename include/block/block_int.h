@@ -324,6 +324,17 @@ struct BlockDriver {
                                               BdrvRequestFlags read_flags,
                                               BdrvRequestFlags write_flags);
 
+    /*
+     * Map [offset, offset + bytes) onto a host file descriptor from which the
+     * data can be read directly, e.g. with sendfile(2).  Drivers that pass
+     * data through unchanged map the range onto their child and call
+     * bdrv_get_host_fd(); the protocol driver owning the file descriptor
+     * returns it and stores the offset of the data in @host_offset.  Return
+     * -errno if the data cannot be read from a file descriptor as is.
+     */
+    int (*bdrv_get_host_fd)(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, int64_t *host_offset);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
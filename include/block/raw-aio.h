@@ -60,14 +60,19 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s);
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                uint64_t offset, QEMUIOVector *qiov, int type);
+                                uint64_t offset, QEMUIOVector *qiov, int type,
+                                bool fixed_buffers);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
 void luring_io_unplug(BlockDriverState *bs, LuringState *s);
+void luring_unregister_fd(LuringState *s, int fd);
+int luring_fixed_buffers_ref(LuringState *s, Error **errp);
+void luring_fixed_buffers_unref(LuringState *s);
+uint64_t luring_get_sqpoll_wakeups(LuringState *s);
 #endif
 
 #ifdef _WIN32
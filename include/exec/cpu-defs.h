@@ -79,8 +79,15 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * The victim tlb is a hash table of sets of CPU_VTLB_WAYS entries.  It
+ * starts as a single, fully associative set and is resized on flush
+ * depending on how many entries were evicted into it, see
+ * tlb_vtlb_resize_locked().
+ */
+#define CPU_VTLB_WAYS 8
+#define CPU_VTLB_MIN_SIZE CPU_VTLB_WAYS
+#define CPU_VTLB_MAX_SIZE 256
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -171,11 +178,17 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
+    /* The next way to use in a set of the tlb victim table.  */
     size_t vindex;
+    /* The number of entries of the tlb victim table, a power of 2.  */
+    size_t vsize;
+    /* Entries evicted into the victim table since the last flush.  */
+    size_t n_victims;
+    /* maximum number of evictions observed in the window */
+    size_t window_max_victims;
     /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
+    CPUTLBEntry *vtable;
+    CPUIOTLBEntry *viotlb;
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
 } CPUTLBDesc;
@@ -211,6 +224,8 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t vtlb_hit_count;
+    size_t vtlb_miss_count;
 } CPUTLBCommon;
 
 /*
@@ -466,6 +466,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_TIER0       0x00100000 /* Unoptimized, counts its executions */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
@@ -475,6 +476,9 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Number of times a CF_TIER0 TB was entered, see gen_tb_start() */
+    uint32_t exec_count;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -544,6 +548,16 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end);
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs);
 #endif
 void tb_flush(CPUState *cpu);
+/* Associativity of the jump cache, fixed before the vCPUs are created */
+extern unsigned int tb_jmp_cache_ways;
+/*
+ * Number of executions after which a CF_TIER0 TB is retranslated with
+ * the optimizer enabled; 0 disables tiered translation.  A threshold of
+ * 1 would translate every block twice, so it is rejected.
+ */
+extern unsigned int tcg_tier_up_threshold;
+#define TCG_TIER_UP_MIN_THRESHOLD 2
+#define TCG_TIER_UP_MAX_THRESHOLD 1000000
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
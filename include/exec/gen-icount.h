@@ -61,6 +61,23 @@ static inline void gen_tb_start(TranslationBlock *tb)
 
     tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->exitreq_label);
 
+    if (tb_cflags(tb) & CF_TIER0) {
+        /*
+         * Count the executions of the TB and go back to the main loop
+         * once it is hot, so that tb_find() retranslates it.
+         */
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+        TCGv_i32 execs = tcg_temp_new_i32();
+
+        tcg_gen_ld_i32(execs, ptr, 0);
+        tcg_gen_addi_i32(execs, execs, 1);
+        tcg_gen_st_i32(execs, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_GEU, execs, tcg_tier_up_threshold,
+                            tcg_ctx->exitreq_label);
+        tcg_temp_free_i32(execs);
+        tcg_temp_free_ptr(ptr);
+    }
+
     if (tb_cflags(tb) & CF_USE_ICOUNT) {
         tcg_gen_st16_i32(count, cpu_env,
                          offsetof(ArchCPU, neg.icount_decr.u16.low) -
@@ -600,6 +600,18 @@ struct MemoryListener {
      */
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
 
+    /**
+     * @log_sync_global:
+     *
+     * This is the global version of @log_sync, for listeners that cannot
+     * synchronize the dirty log with a finer granularity than the whole
+     * guest.  A listener must not define both @log_sync and
+     * @log_sync_global.
+     *
+     * @listener: The #MemoryListener.
+     */
+    void (*log_sync_global)(MemoryListener *listener);
+
     /**
      * @log_clear:
      *
@@ -59,6 +59,12 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 
 #endif /* CONFIG_SOFTMMU */
 
+/* First entry of the jump cache set that can hold a TB for @pc */
+static inline unsigned int tb_jmp_cache_set(target_ulong pc)
+{
+    return tb_jmp_cache_hash_func(pc) & ~(tb_jmp_cache_ways - 1);
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc, uint32_t flags,
                       uint32_t cf_mask, uint32_t trace_vcpu_dstate)
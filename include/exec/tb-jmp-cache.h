@@ -0,0 +1,48 @@
+/*
+ * Set-associative per-vCPU jump cache
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef EXEC_TB_JMP_CACHE_H
+#define EXEC_TB_JMP_CACHE_H
+
+#include "qemu/atomic.h"
+
+/*
+ * The jump cache is split in sets of 'ways' consecutive entries, and the
+ * first entry of a set is the index returned by the jump cache hash with
+ * its low bits cleared.  Each set is kept in most-recently-used order, so
+ * that the common case of a hit in the first way costs the same as with a
+ * direct-mapped cache.
+ *
+ * A set never straddles a TB_JMP_PAGE_SIZE boundary, so flushing the hash
+ * range of a page still flushes every set the page's TBs can live in.
+ */
+#define TB_JMP_CACHE_MAX_WAYS 8
+
+struct TranslationBlock;
+
+/**
+ * tb_jmp_cache_promote:
+ * @set: first entry of the set
+ * @way: way to free, entries before it are moved down by one
+ * @tb: TB to store in the first way
+ *
+ * Used both to move a hit to the front of its set (@way is where @tb was
+ * found) and to insert a new TB (@way is the last way, which is evicted).
+ * Other threads may concurrently clear entries of the set, and may thus
+ * see @tb twice or not at all; this is harmless since stale entries are
+ * caught by CF_INVALID.
+ */
+static inline void tb_jmp_cache_promote(struct TranslationBlock **set,
+                                        unsigned int way,
+                                        struct TranslationBlock *tb)
+{
+    for (; way > 0; way--) {
+        qatomic_set(&set[way], qatomic_read(&set[way - 1]));
+    }
+    qatomic_set(&set[0], tb);
+}
+
+#endif /* EXEC_TB_JMP_CACHE_H */
@@ -15,6 +15,7 @@
 
 #include "exec/exec-all.h"
 #include "exec/tb-hash.h"
+#include "exec/tb-jmp-cache.h"
 
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *
@@ -23,28 +24,36 @@ tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
     TranslationBlock *tb;
-    uint32_t hash;
+    unsigned int ways = tb_jmp_cache_ways;
+    unsigned int set, way;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
-    hash = tb_jmp_cache_hash_func(*pc);
-    tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
+    set = tb_jmp_cache_set(*pc);
 
     cf_mask &= ~CF_CLUSTER_MASK;
     cf_mask |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
-    if (likely(tb &&
-               tb->pc == *pc &&
-               tb->cs_base == *cs_base &&
-               tb->flags == *flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
-        return tb;
+    for (way = 0; way < ways; way++) {
+        tb = qatomic_rcu_read(&cpu->tb_jmp_cache[set + way]);
+        if (likely(tb &&
+                   tb->pc == *pc &&
+                   tb->cs_base == *cs_base &&
+                   tb->flags == *flags &&
+                   tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+                   (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
+            if (way) {
+                tb_jmp_cache_promote(&cpu->tb_jmp_cache[set], way, tb);
+            }
+            cpu->tb_jmp_cache_hits++;
+            return tb;
+        }
     }
+    cpu->tb_jmp_cache_misses++;
     tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
     if (tb == NULL) {
         return NULL;
     }
-    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_promote(&cpu->tb_jmp_cache[set], ways - 1, tb);
     return tb;
 }
 
@@ -278,6 +278,7 @@ typedef struct SavedIOTLB {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
 
 struct hax_vcpu_state;
 
@@ -348,6 +349,9 @@ struct qemu_work_item;
  * @opaque: User data.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_dirty_gfns: Dirty ring of this vCPU, mmap'ed from @kvm_fd.
+ * @kvm_fetch_index: Index of the next entry to harvest in @kvm_dirty_gfns.
+ * @dirty_pages: Number of pages harvested from @kvm_dirty_gfns so far.
  * @work_mutex: Lock to prevent multiple access to @work_list.
  * @work_list: List of pending asynchronous work.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -409,6 +413,9 @@ struct CPUState {
 
     /* Accessed in parallel; all accesses must be atomic */
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /* Only written by the vCPU thread, read racily by 'info jit' */
+    uint64_t tb_jmp_cache_hits;
+    uint64_t tb_jmp_cache_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -431,6 +438,9 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    uint64_t dirty_pages;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -458,6 +468,8 @@ struct CPUState {
      * autoconverge
      */
     bool throttle_thread_scheduled;
+    /* Throttling of this vCPU alone, see cpu_throttle_set_vcpu() */
+    int throttle_percentage;
 
     bool ignore_memory_transaction_failures;
 
@@ -264,6 +264,9 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                                    int bytes, BdrvRequestFlags read_flags,
                                    BdrvRequestFlags write_flags);
 
+int blk_get_host_fd(BlockBackend *blk, int64_t offset, int64_t bytes,
+                    int64_t *host_offset);
+
 const BdrvChild *blk_root(BlockBackend *blk);
 
 int blk_make_empty(BlockBackend *blk, Error **errp);
@@ -65,4 +65,23 @@ bool cpu_throttle_active(void);
  */
 int cpu_throttle_get_percentage(void);
 
+/**
+ * cpu_throttle_set_vcpu:
+ * @cpu: The vcpu to throttle.
+ * @new_throttle_pct: Percent of sleep time, 0 to stop throttling @cpu.
+ *
+ * Throttles @cpu alone, like cpu_throttle_set does for all vcpus.  When
+ * both are in effect, @cpu sleeps for the higher of the two percentages.
+ */
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct);
+
+/**
+ * cpu_throttle_get_vcpu_percentage:
+ * @cpu: The vcpu.
+ *
+ * Returns: The throttle percentage set by cpu_throttle_set_vcpu for @cpu,
+ * 0 if @cpu is not throttled on its own.
+ */
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu);
+
 #endif /* SYSEMU_CPU_THROTTLE_H */
@@ -37,6 +37,11 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+    int64_t poll_percentile;
+
+    /* AioContext io_uring parameters */
+    bool io_uring_sqpoll;
+    int64_t io_uring_sqpoll_cpu;
 };
 typedef struct IOThread IOThread;
 
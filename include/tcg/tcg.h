@@ -277,6 +277,7 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 #define TCG_MAX_INSNS 512
+#define TCG_MAX_CC_GLOBALS 8
 
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
@@ -581,6 +582,8 @@ typedef struct TCGProfile {
     int64_t restore_count;
     int64_t restore_time;
     int64_t table_op_count[NB_OPS];
+    /* ops removed by the optimizer and the liveness pass, per opcode */
+    int64_t table_del_op_count[NB_OPS];
 } TCGProfile;
 
 struct TCGContext {
@@ -632,6 +635,8 @@ struct TCGContext {
     void *code_gen_highwater;
 
     size_t tb_phys_invalidate_count;
+    /* condition code computations removed by the liveness pass */
+    size_t cc_ops_eliminated;
 
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
@@ -666,6 +671,10 @@ struct TCGContext {
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
 
+    /* globals holding condition codes, see tcg_global_mark_cc() */
+    int nb_cc_globals;
+    uint16_t cc_globals[TCG_MAX_CC_GLOBALS];
+
     QTAILQ_HEAD(, TCGOp) ops, free_ops;
     QSIMPLEQ_HEAD(, TCGLabel) labels;
 
@@ -843,6 +852,7 @@ size_t tcg_code_capacity(void);
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
 size_t tcg_tb_phys_invalidate_count(void);
+size_t tcg_cc_ops_eliminated(void);
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
 void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
 size_t tcg_nb_tbs(void);
@@ -877,6 +887,7 @@ void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
 
 TCGTemp *tcg_global_mem_new_internal(TCGType, TCGv_ptr,
                                      intptr_t, const char *);
+void tcg_global_mark_cc(TCGTemp *ts);
 TCGTemp *tcg_temp_new_internal(TCGType, bool);
 void tcg_temp_free_internal(TCGTemp *);
 TCGv_vec tcg_temp_new_vec(TCGType type);
@@ -928,6 +939,16 @@ static inline TCGv_i64 tcg_global_mem_new_i64(TCGv_ptr reg, intptr_t offset,
     return temp_tcgv_i64(t);
 }
 
+static inline void tcg_global_mark_cc_i32(TCGv_i32 v)
+{
+    tcg_global_mark_cc(tcgv_i32_temp(v));
+}
+
+static inline void tcg_global_mark_cc_i64(TCGv_i64 v)
+{
+    tcg_global_mark_cc(tcgv_i64_temp(v));
+}
+
 static inline TCGv_i64 tcg_temp_new_i64(void)
 {
     TCGTemp *t = tcg_temp_new_internal(TCG_TYPE_I64, false);
@@ -1043,6 +1064,7 @@ TCGOp *tcg_op_insert_before(TCGContext *s, TCGOp *op, TCGOpcode opc);
 TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *op, TCGOpcode opc);
 
 void tcg_optimize(TCGContext *s);
+void tcg_optimize_env(TCGContext *s);
 
 TCGv_i32 tcg_const_i32(int32_t val);
 TCGv_i64 tcg_const_i64(int64_t val);
@@ -113,6 +113,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->io_uring_sqpoll_cpu = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -182,7 +183,14 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                                 iothread->poll_max_ns,
                                 iothread->poll_grow,
                                 iothread->poll_shrink,
+                                iothread->poll_percentile,
                                 &local_error);
+    if (!local_error) {
+        aio_context_set_io_uring_params(iothread->ctx,
+                                        iothread->io_uring_sqpoll,
+                                        iothread->io_uring_sqpoll_cpu,
+                                        &local_error);
+    }
     if (local_error) {
         error_propagate(errp, local_error);
         aio_context_unref(iothread->ctx);
@@ -208,16 +216,20 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    int64_t max;
 } PollParamInfo;
 
 static PollParamInfo poll_max_ns_info = {
-    "poll-max-ns", offsetof(IOThread, poll_max_ns),
+    "poll-max-ns", offsetof(IOThread, poll_max_ns), INT64_MAX,
 };
 static PollParamInfo poll_grow_info = {
-    "poll-grow", offsetof(IOThread, poll_grow),
+    "poll-grow", offsetof(IOThread, poll_grow), INT64_MAX,
 };
 static PollParamInfo poll_shrink_info = {
-    "poll-shrink", offsetof(IOThread, poll_shrink),
+    "poll-shrink", offsetof(IOThread, poll_shrink), INT64_MAX,
+};
+static PollParamInfo poll_percentile_info = {
+    "poll-percentile", offsetof(IOThread, poll_percentile), 100,
 };
 
 static void iothread_get_poll_param(Object *obj, Visitor *v,
@@ -242,9 +254,9 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
         return;
     }
 
-    if (value < 0) {
+    if (value < 0 || value > info->max) {
         error_setg(errp, "%s value must be in range [0, %" PRId64 "]",
-                   info->name, INT64_MAX);
+                   info->name, info->max);
         return;
     }
 
@@ -255,10 +267,59 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
                                     iothread->poll_max_ns,
                                     iothread->poll_grow,
                                     iothread->poll_shrink,
+                                    iothread->poll_percentile,
                                     errp);
     }
 }
 
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value,
+                                         Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "io-uring-sqpoll cannot be changed at run-time");
+        return;
+    }
+    iothread->io_uring_sqpoll = value;
+}
+
+static void iothread_get_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->io_uring_sqpoll_cpu, errp);
+}
+
+static void iothread_set_io_uring_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed at run-time", name);
+        return;
+    }
+    if (value < -1 || value > INT_MAX) {
+        error_setg(errp, "%s value must be -1 or a host CPU index", name);
+        return;
+    }
+    iothread->io_uring_sqpoll_cpu = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -276,6 +337,17 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "poll-percentile", "int",
+                              iothread_get_poll_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_percentile_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              iothread_get_io_uring_sqpoll_cpu,
+                              iothread_set_io_uring_sqpoll_cpu,
+                              NULL, NULL);
 }
 
 static const TypeInfo iothread_info = {
@@ -326,6 +398,28 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->poll_percentile = iothread->poll_percentile;
+    info->io_uring_sqpoll = iothread->io_uring_sqpoll;
+    if (iothread->io_uring_sqpoll && iothread->ctx) {
+        info->has_io_uring_sqpoll_wakeups = true;
+        info->io_uring_sqpoll_wakeups =
+            aio_get_linux_io_uring_sqpoll_wakeups(iothread->ctx);
+    }
+    if (iothread->ctx) {
+        uint64_t histogram[AIO_POLL_HISTOGRAM_BUCKETS];
+        uint64List **tail = &info->poll_histogram;
+        int i;
+
+        info->has_poll_time_ns = true;
+        info->poll_time_ns = aio_context_get_poll_stats(iothread->ctx,
+                                                        histogram);
+        info->has_poll_histogram = true;
+        for (i = 0; i < AIO_POLL_HISTOGRAM_BUCKETS; i++) {
+            *tail = g_new0(uint64List, 1);
+            (*tail)->value = histogram[i];
+            tail = &(*tail)->next;
+        }
+    }
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
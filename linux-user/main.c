@@ -374,6 +374,19 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tier_up_threshold(const char *arg)
+{
+    if (qemu_strtoui(arg, NULL, 0, &tcg_tier_up_threshold) ||
+        (tcg_tier_up_threshold &&
+         (tcg_tier_up_threshold < TCG_TIER_UP_MIN_THRESHOLD ||
+          tcg_tier_up_threshold > TCG_TIER_UP_MAX_THRESHOLD))) {
+        fprintf(stderr, "Invalid tier-up threshold: %s (must be 0 or "
+                "between %d and %d)\n", arg, TCG_TIER_UP_MIN_THRESHOLD,
+                TCG_TIER_UP_MAX_THRESHOLD);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -452,6 +465,10 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tier-up-threshold", "QEMU_TIER_UP_THRESHOLD", true,
+     handle_arg_tier_up_threshold,
+     "n",          "translate blocks without optimization until they have "
+     "run 'n' times (0 disables tiered translation)"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -15,14 +15,23 @@
 #include "qapi/error.h"
 #include "cpu.h"
 #include "exec/ramblock.h"
+#include "exec/memory.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/main-loop.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-visit-migration.h"
+#include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
+#include "migration/misc.h"
+#include "migration.h"
 #include "ram.h"
 #include "trace.h"
 #include "dirtyrate.h"
 
 static int CalculatingState = DIRTY_RATE_STATUS_UNSTARTED;
 static struct DirtyRateStat DirtyStat;
+static struct DirtyLimitState *DirtyLimit;
 
 static int64_t set_sample_page_period(int64_t msec, int64_t initial_time)
 {
@@ -72,20 +81,32 @@ static struct DirtyRateInfo *query_dirty_rate_info(void)
     info->status = CalculatingState;
     info->start_time = DirtyStat.start_time;
     info->calc_time = DirtyStat.calc_time;
+    info->mode = DirtyStat.mode;
+
+    if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURED &&
+        DirtyStat.vcpu_dirty_rate) {
+        info->has_vcpu_dirty_rate = true;
+        info->vcpu_dirty_rate = QAPI_CLONE(DirtyRateVcpuList,
+                                           DirtyStat.vcpu_dirty_rate);
+    }
 
     trace_query_dirty_rate_info(DirtyRateStatus_str(CalculatingState));
 
     return info;
 }
 
-static void init_dirtyrate_stat(int64_t start_time, int64_t calc_time)
+static void init_dirtyrate_stat(int64_t start_time,
+                                struct DirtyRateConfig config)
 {
     DirtyStat.total_dirty_samples = 0;
     DirtyStat.total_sample_count = 0;
     DirtyStat.total_block_mem_MB = 0;
     DirtyStat.dirty_rate = -1;
     DirtyStat.start_time = start_time;
-    DirtyStat.calc_time = calc_time;
+    DirtyStat.calc_time = config.sample_period_seconds;
+    DirtyStat.mode = config.mode;
+    qapi_free_DirtyRateVcpuList(DirtyStat.vcpu_dirty_rate);
+    DirtyStat.vcpu_dirty_rate = NULL;
 }
 
 static void update_dirtyrate_stat(struct RamblockDirtyInfo *info)
@@ -355,12 +376,128 @@ out:
     rcu_unregister_thread();
 }
 
+/* Number of entries needed to index per-vCPU arrays with cpu_index */
+static int vcpu_index_count(void)
+{
+    CPUState *cpu;
+    int count = 0;
+
+    CPU_FOREACH(cpu) {
+        count = MAX(count, cpu->cpu_index + 1);
+    }
+
+    return count;
+}
+
+/*
+ * Sample the number of pages harvested from the KVM dirty ring of each
+ * vCPU into @dirty_pages, indexed by cpu_index.  Called with the BQL held.
+ */
+static void vcpu_dirty_pages_sample(uint64_t *dirty_pages, int count)
+{
+    CPUState *cpu;
+
+    /* Harvest the pages that are still in the rings */
+    memory_global_dirty_log_sync();
+
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index < count) {
+            dirty_pages[cpu->cpu_index] = cpu->dirty_pages;
+        }
+    }
+}
+
+static int64_t vcpu_dirty_rate(uint64_t start_pages, uint64_t end_pages,
+                               int64_t msec)
+{
+    uint64_t bytes;
+
+    /* The vCPU may have been replaced by hotplug in the meantime */
+    if (end_pages < start_pages || msec <= 0) {
+        return 0;
+    }
+
+    bytes = (end_pages - start_pages) * qemu_real_host_page_size;
+
+    return (bytes * 1000 / msec) >> 20;
+}
+
+/*
+ * Measure the dirty rate of each vCPU from the pages harvested from its
+ * KVM dirty ring; the dirty rate of the VM is their sum.
+ */
+static void calculate_dirtyrate_dirty_ring(struct DirtyRateConfig config)
+{
+    DirtyRateVcpuList *head = NULL, **tail = &head;
+    uint64_t *start_pages, *end_pages;
+    int64_t initial_time, msec;
+    int64_t dirty_rate = 0;
+    bool start_log;
+    CPUState *cpu;
+    int count;
+
+    qemu_mutex_lock_iothread();
+    count = vcpu_index_count();
+    start_pages = g_new0(uint64_t, count);
+    end_pages = g_new0(uint64_t, count);
+
+    /* Migration may already have enabled dirty logging */
+    start_log = !global_dirty_log;
+    if (start_log) {
+        memory_global_dirty_log_start();
+    }
+    initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    vcpu_dirty_pages_sample(start_pages, count);
+    qemu_mutex_unlock_iothread();
+
+    msec = config.sample_period_seconds * 1000;
+    msec = set_sample_page_period(msec, initial_time);
+    DirtyStat.start_time = initial_time / 1000;
+    DirtyStat.calc_time = msec / 1000;
+
+    qemu_mutex_lock_iothread();
+    vcpu_dirty_pages_sample(end_pages, count);
+
+    /* Leave dirty logging alone if a migration started in the meantime */
+    if (start_log && global_dirty_log &&
+        !migration_is_active(migrate_get_current())) {
+        memory_global_dirty_log_stop();
+    }
+
+    CPU_FOREACH(cpu) {
+        DirtyRateVcpu *rate;
+        DirtyRateVcpuList *entry;
+
+        if (cpu->cpu_index >= count) {
+            continue;
+        }
+
+        rate = g_new0(DirtyRateVcpu, 1);
+        rate->id = cpu->cpu_index;
+        rate->dirty_rate = vcpu_dirty_rate(start_pages[cpu->cpu_index],
+                                           end_pages[cpu->cpu_index], msec);
+        trace_calculate_vcpu_dirty_rate(rate->id, rate->dirty_rate);
+        dirty_rate += rate->dirty_rate;
+
+        entry = g_new0(DirtyRateVcpuList, 1);
+        entry->value = rate;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    qemu_mutex_unlock_iothread();
+
+    DirtyStat.dirty_rate = dirty_rate;
+    DirtyStat.vcpu_dirty_rate = head;
+
+    g_free(start_pages);
+    g_free(end_pages);
+}
+
 void *get_dirtyrate_thread(void *arg)
 {
     struct DirtyRateConfig config = *(struct DirtyRateConfig *)arg;
     int ret;
     int64_t start_time;
-    int64_t calc_time;
 
     ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_UNSTARTED,
                               DIRTY_RATE_STATUS_MEASURING);
@@ -370,10 +507,13 @@ void *get_dirtyrate_thread(void *arg)
     }
 
     start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) / 1000;
-    calc_time = config.sample_period_seconds;
-    init_dirtyrate_stat(start_time, calc_time);
+    init_dirtyrate_stat(start_time, config);
 
-    calculate_dirtyrate(config);
+    if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        calculate_dirtyrate_dirty_ring(config);
+    } else {
+        calculate_dirtyrate(config);
+    }
 
     ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_MEASURING,
                               DIRTY_RATE_STATUS_MEASURED);
@@ -383,7 +523,8 @@ void *get_dirtyrate_thread(void *arg)
     return NULL;
 }
 
-void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
+void qmp_calc_dirty_rate(int64_t calc_time, bool has_mode,
+                         DirtyRateMeasureMode mode, Error **errp)
 {
     static struct DirtyRateConfig config;
     QemuThread thread;
@@ -404,6 +545,16 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
         return;
     }
 
+    if (!has_mode) {
+        mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
+    }
+
+    if (mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING &&
+        !kvm_dirty_ring_enabled()) {
+        error_setg(errp, "mode dirty-ring requires the KVM dirty ring.");
+        return;
+    }
+
     /*
      * Init calculation state as unstarted.
      */
@@ -416,6 +567,7 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
 
     config.sample_period_seconds = calc_time;
     config.sample_pages_per_gigabytes = DIRTYRATE_DEFAULT_SAMPLE_PAGES;
+    config.mode = mode;
     qemu_thread_create(&thread, "get_dirtyrate", get_dirtyrate_thread,
                        (void *)&config, QEMU_THREAD_DETACHED);
 }
@@ -424,3 +576,165 @@ struct DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
 {
     return query_dirty_rate_info();
 }
+
+/*
+ * The dirty rate of a vCPU is proportional to the time it runs, so aim for
+ * the running time that brings it down to @quota.
+ */
+static void dirty_limit_throttle_vcpu(CPUState *cpu, int64_t dirty_rate,
+                                      uint64_t quota)
+{
+    int max_pct = migrate_get_current()->parameters.max_cpu_throttle;
+    int pct = cpu_throttle_get_vcpu_percentage(cpu);
+    int new_pct = 0;
+    double run_ratio;
+
+    if (dirty_rate <= quota && !pct) {
+        return;
+    }
+
+    if (dirty_rate > 0) {
+        run_ratio = (100 - pct) / 100.0 * quota / dirty_rate;
+        new_pct = 100 - (int)(run_ratio * 100);
+        new_pct = MAX(MIN(new_pct, max_pct), 0);
+    }
+
+    if (new_pct != pct) {
+        trace_dirty_limit_throttle_vcpu(cpu->cpu_index, dirty_rate, new_pct);
+        cpu_throttle_set_vcpu(cpu, new_pct);
+    }
+}
+
+static void dirty_limit_timer_tick(void *opaque)
+{
+    struct DirtyLimitState *dl = opaque;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    int64_t msec = now - dl->sample_time;
+    int count = vcpu_index_count();
+    CPUState *cpu;
+    int i;
+
+    /* Make room for hotplugged vCPUs */
+    if (count > dl->max_cpus) {
+        dl->dirty_pages = g_renew(uint64_t, dl->dirty_pages, count);
+        dl->dirty_rate = g_renew(int64_t, dl->dirty_rate, count);
+        for (i = dl->max_cpus; i < count; i++) {
+            dl->dirty_pages[i] = 0;
+            dl->dirty_rate[i] = 0;
+        }
+        dl->max_cpus = count;
+    }
+
+    /*
+     * Harvest the pages that are in the rings, without kicking the vCPUs
+     * as a log sync would: doing that every period would stall the whole
+     * guest.  Pages still in the hardware buffers are counted next time.
+     */
+    kvm_dirty_ring_reap_all();
+
+    CPU_FOREACH(cpu) {
+        i = cpu->cpu_index;
+        dl->dirty_rate[i] = vcpu_dirty_rate(dl->dirty_pages[i],
+                                            cpu->dirty_pages, msec);
+        dl->dirty_pages[i] = cpu->dirty_pages;
+        dirty_limit_throttle_vcpu(cpu, dl->dirty_rate[i], dl->quota);
+    }
+
+    dl->sample_time = now;
+    timer_mod(dl->timer, now + DIRTY_LIMIT_PERIOD_MS);
+}
+
+/*
+ * Start throttling the vCPUs whose dirty rate is above @quota MB/s, or
+ * update the quota if the dirty limit is already in service.  Called with
+ * the BQL held.
+ */
+void dirty_limit_start(uint64_t quota)
+{
+    struct DirtyLimitState *dl = DirtyLimit;
+    CPUState *cpu;
+
+    trace_dirty_limit_start(quota);
+
+    if (dl) {
+        dl->quota = quota;
+        return;
+    }
+
+    dl = g_new0(struct DirtyLimitState, 1);
+    dl->quota = quota;
+    dl->max_cpus = vcpu_index_count();
+    dl->dirty_pages = g_new0(uint64_t, dl->max_cpus);
+    dl->dirty_rate = g_new0(int64_t, dl->max_cpus);
+    CPU_FOREACH(cpu) {
+        dl->dirty_pages[cpu->cpu_index] = cpu->dirty_pages;
+    }
+
+    dl->sample_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    dl->timer = timer_new_ms(QEMU_CLOCK_REALTIME, dirty_limit_timer_tick, dl);
+    timer_mod(dl->timer, dl->sample_time + DIRTY_LIMIT_PERIOD_MS);
+
+    DirtyLimit = dl;
+}
+
+/* Stop throttling the vCPUs; called with the BQL held */
+void dirty_limit_stop(void)
+{
+    struct DirtyLimitState *dl = DirtyLimit;
+    CPUState *cpu;
+
+    if (!dl) {
+        return;
+    }
+
+    trace_dirty_limit_stop();
+
+    timer_del(dl->timer);
+    timer_free(dl->timer);
+    CPU_FOREACH(cpu) {
+        cpu_throttle_set_vcpu(cpu, 0);
+    }
+
+    g_free(dl->dirty_pages);
+    g_free(dl->dirty_rate);
+    g_free(dl);
+    DirtyLimit = NULL;
+}
+
+bool dirty_limit_in_service(void)
+{
+    return DirtyLimit != NULL;
+}
+
+DirtyLimitInfoList *qmp_query_vcpu_dirty_limit(Error **errp)
+{
+    struct DirtyLimitState *dl = DirtyLimit;
+    DirtyLimitInfoList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    if (!dl) {
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        DirtyLimitInfo *info;
+        DirtyLimitInfoList *entry;
+
+        if (cpu->cpu_index >= dl->max_cpus) {
+            continue;
+        }
+
+        info = g_new0(DirtyLimitInfo, 1);
+        info->cpu_index = cpu->cpu_index;
+        info->limit_rate = dl->quota;
+        info->current_rate = dl->dirty_rate[cpu->cpu_index];
+        info->throttle_percentage = cpu_throttle_get_vcpu_percentage(cpu);
+
+        entry = g_new0(DirtyLimitInfoList, 1);
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
@@ -13,6 +13,9 @@
 #ifndef QEMU_MIGRATION_DIRTYRATE_H
 #define QEMU_MIGRATION_DIRTYRATE_H
 
+#include "qapi/qapi-types-migration.h"
+#include "qemu/timer.h"
+
 /*
  * Sample 512 pages per GB as default.
  * TODO: Make it configurable.
@@ -35,9 +38,15 @@
 #define MIN_FETCH_DIRTYRATE_TIME_SEC              1
 #define MAX_FETCH_DIRTYRATE_TIME_SEC              60
 
+/*
+ * Period of the per-vCPU dirty rate measurement of the dirty limit
+ */
+#define DIRTY_LIMIT_PERIOD_MS                     1000
+
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
     int64_t sample_period_seconds; /* time duration between two sampling */
+    DirtyRateMeasureMode mode; /* how to measure the dirty rate */
 };
 
 /*
@@ -63,7 +72,25 @@ struct DirtyRateStat {
     int64_t dirty_rate; /* dirty rate in MB/s */
     int64_t start_time; /* calculation start time in units of second */
     int64_t calc_time; /* time duration of two sampling in units of second */
+    DirtyRateMeasureMode mode; /* how the dirty rate is measured */
+    DirtyRateVcpuList *vcpu_dirty_rate; /* per-vCPU rates in dirty-ring mode */
+};
+
+/*
+ * State of the per-vCPU dirty limit, only present while it is in service.
+ */
+struct DirtyLimitState {
+    QEMUTimer *timer; /* fires every DIRTY_LIMIT_PERIOD_MS */
+    uint64_t quota; /* dirty rate limit of each vCPU in MB/s */
+    int64_t sample_time; /* time of the last sample in ms */
+    int max_cpus; /* size of the arrays below, indexed by cpu_index */
+    uint64_t *dirty_pages; /* CPUState.dirty_pages at the last sample */
+    int64_t *dirty_rate; /* dirty rate over the last period in MB/s */
 };
 
 void *get_dirtyrate_thread(void *arg);
+
+void dirty_limit_start(uint64_t quota);
+void dirty_limit_stop(void);
+bool dirty_limit_in_service(void);
 #endif
@@ -20,10 +20,12 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -56,6 +58,7 @@
 #include "net/announce.h"
 #include "qemu/queue.h"
 #include "multifd.h"
+#include "dirtyrate.h"
 
 #ifdef CONFIG_VFIO
 #include "hw/vfio/vfio-common.h"
@@ -106,6 +109,13 @@
  */
 #define DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH 0
 
+/* Per-vCPU dirty page rate limit for the dirty-limit capability, in MB/s */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT 1
+
+/* Host pages requested ahead of a postcopy page fault, 0 means disabled */
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 0
+#define MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES 64
+
 /*
  * Parameters for self_announce_delay giving a stream of RARP/ARP
  * packets after migration.
@@ -130,6 +140,9 @@ enum mig_rp_message_type {
     MIG_RP_MSG_REQ_PAGES,    /* data (start: be64, len: be32) */
     MIG_RP_MSG_RECV_BITMAP,  /* send recved_bitmap back to source */
     MIG_RP_MSG_RESUME_ACK,   /* tell source that we are ready to resume */
+    /* Like REQ_PAGES(_ID), for pages requested ahead of a fault */
+    MIG_RP_MSG_PREFETCH_PAGES_ID,
+    MIG_RP_MSG_PREFETCH_PAGES,
 
     MIG_RP_MSG_MAX
 };
@@ -177,6 +190,7 @@ void migration_object_init(void)
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
     qemu_mutex_init(&current_incoming->page_request_mutex);
     current_incoming->page_requested = g_tree_new(page_request_addr_cmp);
+    qemu_sem_init(&current_incoming->postcopy_qemufile_dst_done, 0);
 
     if (!migration_object_check(current_migration, &err)) {
         error_report_err(err);
@@ -236,6 +250,11 @@ void migration_incoming_state_destroy(void)
         qemu_fclose(mis->from_src_file);
         mis->from_src_file = NULL;
     }
+    if (mis->postcopy_qemufile_dst) {
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
+    memset(mis->last_recv_block, 0, sizeof(mis->last_recv_block));
     if (mis->postcopy_remote_fds) {
         g_array_free(mis->postcopy_remote_fds, TRUE);
         mis->postcopy_remote_fds = NULL;
@@ -323,9 +342,11 @@ error:
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
+ *   prefetch: no vCPU is waiting for the page yet
  */
-int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+static int migrate_send_rp_message_pages(MigrationIncomingState *mis,
+                                         RAMBlock *rb, ram_addr_t start,
+                                         bool prefetch)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
@@ -353,14 +374,36 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
         bufc[msglen++] = rbname_len;
         memcpy(bufc + msglen, rbname, rbname_len);
         msglen += rbname_len;
-        msg_type = MIG_RP_MSG_REQ_PAGES_ID;
+        msg_type = prefetch ? MIG_RP_MSG_PREFETCH_PAGES_ID :
+                              MIG_RP_MSG_REQ_PAGES_ID;
     } else {
-        msg_type = MIG_RP_MSG_REQ_PAGES;
+        msg_type = prefetch ? MIG_RP_MSG_PREFETCH_PAGES :
+                              MIG_RP_MSG_REQ_PAGES;
     }
 
     return migrate_send_rp_message(mis, msg_type, msglen, bufc);
 }
 
+int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
+                                      RAMBlock *rb, ram_addr_t start)
+{
+    return migrate_send_rp_message_pages(mis, rb, start, false);
+}
+
+/*
+ * Request a page that no vCPU has faulted on yet.  The source sends it with
+ * a lower priority than the requested pages, and not on the postcopy
+ * preempt channel.  Sources that don't know about the postcopy preempt
+ * capability do not understand the message, so fall back to a plain
+ * request without it.
+ */
+int migrate_send_rp_message_prefetch_pages(MigrationIncomingState *mis,
+                                           RAMBlock *rb, ram_addr_t start)
+{
+    return migrate_send_rp_message_pages(mis, rb, start,
+                                         migrate_postcopy_preempt());
+}
+
 int migrate_send_rp_req_pages(MigrationIncomingState *mis,
                               RAMBlock *rb, ram_addr_t start, uint64_t haddr)
 {
@@ -444,6 +487,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -668,13 +713,46 @@ void migration_fd_process_incoming(QEMUFile *f, Error **errp)
     migration_incoming_process();
 }
 
+/*
+ * With postcopy preempt, a connection after the first one is either the
+ * preempt channel, which starts with POSTCOPY_PREEMPT_MAGIC, or the main
+ * channel of a postcopy recovery.  Tell them apart by the magic rather than
+ * by the order they arrive in, and close anything else: for example a
+ * preempt channel that the source gave up on after postcopy paused.
+ */
+static void postcopy_preempt_process_incoming(MigrationIncomingState *mis,
+                                              QEMUFile *f)
+{
+    uint8_t *buf;
+
+    /* The source writes to both channels as soon as they are connected */
+    if (qemu_peek_buffer(f, &buf, 4, 0) == 4) {
+        if (ldl_be_p(buf) == POSTCOPY_PREEMPT_MAGIC) {
+            qemu_file_skip(f, 4);
+            if (postcopy_preempt_new_channel(mis, f)) {
+                return;
+            }
+        } else if (postcopy_try_recover(f)) {
+            return;
+        }
+    }
+
+    trace_migration_incoming_drop_channel(MigrationStatus_str(mis->state));
+    qemu_fclose(f);
+}
+
 void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     Error *local_err = NULL;
     bool start_migration;
 
-    if (!mis->from_src_file) {
+    if (migrate_postcopy_preempt() &&
+        (mis->from_src_file ||
+         mis->state == MIGRATION_STATUS_POSTCOPY_PAUSED)) {
+        postcopy_preempt_process_incoming(mis, qemu_fopen_channel_input(ioc));
+        start_migration = false;
+    } else if (!mis->from_src_file) {
         /* The first connection (multifd may have multiple) */
         QEMUFile *f = qemu_fopen_channel_input(ioc);
 
@@ -690,9 +768,10 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
 
         /*
          * Common migration only needs one channel, so we can start
-         * right now.  Multifd needs more than one channel, we wait.
+         * right now.  Multifd needs more than one channel, we wait;
+         * except with mapped-ram, where the threads share the file.
          */
-        start_migration = !migrate_use_multifd();
+        start_migration = !migrate_use_multifd() || migrate_mapped_ram();
     } else {
         /* Multiple connections */
         assert(migrate_use_multifd());
@@ -720,6 +799,9 @@ bool migration_has_all_channels(void)
     bool all_channels;
 
     all_channels = multifd_recv_all_channels_created();
+    if (migrate_postcopy_preempt()) {
+        all_channels = all_channels && mis->postcopy_qemufile_dst != NULL;
+    }
 
     return all_channels && mis->from_src_file != NULL;
 }
@@ -888,6 +970,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->announce_rounds = s->parameters.announce_rounds;
     params->has_announce_step = true;
     params->announce_step = s->parameters.announce_step;
+    params->has_vcpu_dirty_limit = true;
+    params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
 
     if (s->parameters.has_block_bitmap_mapping) {
         params->has_block_bitmap_mapping = true;
@@ -994,6 +1080,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->page_size = qemu_target_page_size();
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
     info->ram->pages_per_second = s->pages_per_second;
+    info->ram->postcopy_preempt_pages = ram_counters.postcopy_preempt_pages;
 
     if (migrate_use_xbzrle()) {
         info->has_xbzrle_cache = true;
@@ -1005,6 +1092,14 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->encoding_rate = xbzrle_counters.encoding_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+    } else if (migrate_use_multifd() &&
+               migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE) {
+        XBZRLECacheStats stats;
+
+        if (multifd_xbzrle_get_stats(&stats)) {
+            info->has_xbzrle_cache = true;
+            info->xbzrle_cache = g_memdup(&stats, sizeof(stats));
+        }
     }
 
     if (migrate_use_compression()) {
@@ -1165,6 +1260,84 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preempt requires postcopy-ram");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Postcopy preempt is not compatible with multifd");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp, "Postcopy preempt is not compatible with "
+                       "compress");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Mapped RAM is not compatible with postcopy");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE]) {
+            error_setg(errp, "Mapped RAM is not compatible with xbzrle");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp, "Mapped RAM is not compatible with compress");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Mapped RAM is not compatible with COLO");
+            return false;
+        }
+
+        if (cap_list[MIGRATION_CAPABILITY_X_IGNORE_SHARED]) {
+            error_setg(errp, "Mapped RAM is not compatible with "
+                       "ignore-shared");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd zero page detection requires multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        migrate_get_current()->parameters.multifd_compression ==
+        MULTIFD_COMPRESSION_XBZRLE) {
+        /*
+         * Zero pages would never reach the xbzrle cache, leaving stale
+         * data there to compute the next delta against.
+         */
+        error_setg(errp, "Multifd zero page detection is not compatible "
+                   "with xbzrle multifd compression");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "Dirty limit is not compatible with "
+                       "auto-converge");
+            return false;
+        }
+
+        if (!kvm_dirty_ring_enabled()) {
+            error_setg(errp, "Dirty limit requires the KVM dirty ring");
+            error_append_hint(errp, "Use -accel kvm,dirty-ring-size=N.\n");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -1312,6 +1485,15 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE &&
+        migrate_get_current()->enabled_capabilities[
+            MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE]) {
+        error_setg(errp, "Multifd xbzrle compression is not compatible "
+                   "with multifd-zero-page");
+        return false;
+    }
+
     if (params->has_multifd_zlib_level &&
         (params->multifd_zlib_level > 9)) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zlib_level",
@@ -1381,6 +1563,22 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_vcpu_dirty_limit &&
+        params->vcpu_dirty_limit < 1) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "vcpu_dirty_limit",
+                   "is invalid, it must be at least 1 MB/s");
+        return false;
+    }
+
+    if (params->has_postcopy_prefetch_pages &&
+        params->postcopy_prefetch_pages > MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_pages",
+                   "is invalid, it must be in the range of 0 to 64");
+        return false;
+    }
+
     return true;
 }
 
@@ -1480,6 +1678,14 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
         dest->has_block_bitmap_mapping = true;
         dest->block_bitmap_mapping = params->block_bitmap_mapping;
     }
+
+    if (params->has_vcpu_dirty_limit) {
+        dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1602,6 +1808,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
             QAPI_CLONE(BitmapMigrationNodeAliasList,
                        params->block_bitmap_mapping);
     }
+
+    if (params->has_vcpu_dirty_limit) {
+        s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages =
+            params->postcopy_prefetch_pages;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -1715,7 +1930,7 @@ static void migrate_fd_cleanup(MigrationState *s)
     qemu_savevm_state_cleanup();
 
     if (s->to_dst_file) {
-        QEMUFile *tmp;
+        QEMUFile *tmp, *preempt;
 
         trace_migrate_fd_cleanup();
         qemu_mutex_unlock_iothread();
@@ -1729,12 +1944,17 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_mutex_lock(&s->qemu_file_lock);
         tmp = s->to_dst_file;
         s->to_dst_file = NULL;
+        preempt = s->postcopy_qemufile_src;
+        s->postcopy_qemufile_src = NULL;
         qemu_mutex_unlock(&s->qemu_file_lock);
         /*
          * Close the file handle without the lock to make sure the
          * critical section won't block for long.
          */
         qemu_fclose(tmp);
+        if (preempt) {
+            qemu_fclose(preempt);
+        }
     }
 
     assert(!migration_is_active(s));
@@ -1819,6 +2039,13 @@ static void migrate_fd_cancel(MigrationState *s)
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
     }
+    if (s->state == MIGRATION_STATUS_CANCELLING) {
+        WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+            if (s->postcopy_qemufile_src) {
+                qemu_file_shutdown(s->postcopy_qemufile_src);
+            }
+        }
+    }
     if (s->state == MIGRATION_STATUS_CANCELLING && s->block_inactive) {
         Error *local_err = NULL;
 
@@ -2037,6 +2264,9 @@ void qmp_migrate_pause(Error **errp)
         /* Source side, during postcopy */
         qemu_mutex_lock(&ms->qemu_file_lock);
         ret = qemu_file_shutdown(ms->to_dst_file);
+        if (ms->postcopy_qemufile_src) {
+            qemu_file_shutdown(ms->postcopy_qemufile_src);
+        }
         qemu_mutex_unlock(&ms->qemu_file_lock);
         if (ret) {
             error_setg(errp, "Failed to pause source migration");
@@ -2155,6 +2385,14 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
     MigrationState *s = migrate_get_current();
     const char *p = NULL;
 
+    if (migrate_postcopy_preempt() && !(has_resume && resume) &&
+        !strstart(uri, "tcp:", NULL) &&
+        !strstart(uri, "unix:", NULL) &&
+        !strstart(uri, "vsock:", NULL)) {
+        error_setg(errp, "Postcopy preempt requires a socket migration URI");
+        return;
+    }
+
     if (!migrate_prepare(s, has_blk && blk, has_inc && inc,
                          has_resume && resume, errp)) {
         /* Error detected, put into errp */
@@ -2173,6 +2411,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -2268,6 +2508,33 @@ bool migrate_postcopy_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+int migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -2390,6 +2657,24 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2511,6 +2796,9 @@ static struct rp_cmd_args {
     [MIG_RP_MSG_REQ_PAGES_ID]   = { .len = -1, .name = "REQ_PAGES_ID" },
     [MIG_RP_MSG_RECV_BITMAP]    = { .len = -1, .name = "RECV_BITMAP" },
     [MIG_RP_MSG_RESUME_ACK]     = { .len =  4, .name = "RESUME_ACK" },
+    [MIG_RP_MSG_PREFETCH_PAGES] = { .len = 12, .name = "PREFETCH_PAGES" },
+    [MIG_RP_MSG_PREFETCH_PAGES_ID] = { .len = -1,
+                                       .name = "PREFETCH_PAGES_ID" },
     [MIG_RP_MSG_MAX]            = { .len = -1, .name = "MAX" },
 };
 
@@ -2520,11 +2808,12 @@ static struct rp_cmd_args {
  * and we don't need to send pages that have already been sent.
  */
 static void migrate_handle_rp_req_pages(MigrationState *ms, const char* rbname,
-                                       ram_addr_t start, size_t len)
+                                       ram_addr_t start, size_t len,
+                                       bool prefetch)
 {
     long our_host_ps = qemu_real_host_page_size;
 
-    trace_migrate_handle_rp_req_pages(rbname, start, len);
+    trace_migrate_handle_rp_req_pages(rbname, start, len, prefetch);
 
     /*
      * Since we currently insist on matching page sizes, just sanity check
@@ -2538,7 +2827,7 @@ static void migrate_handle_rp_req_pages(MigrationState *ms, const char* rbname,
         return;
     }
 
-    if (ram_save_queue_pages(rbname, start, len)) {
+    if (ram_save_queue_pages(rbname, start, len, prefetch)) {
         mark_source_rp_bad(ms);
     }
 }
@@ -2669,12 +2958,16 @@ retry:
             break;
 
         case MIG_RP_MSG_REQ_PAGES:
+        case MIG_RP_MSG_PREFETCH_PAGES:
             start = ldq_be_p(buf);
             len = ldl_be_p(buf + 8);
-            migrate_handle_rp_req_pages(ms, NULL, start, len);
+            migrate_handle_rp_req_pages(ms, NULL, start, len,
+                                        header_type ==
+                                        MIG_RP_MSG_PREFETCH_PAGES);
             break;
 
         case MIG_RP_MSG_REQ_PAGES_ID:
+        case MIG_RP_MSG_PREFETCH_PAGES_ID:
             expected_len = 12 + 1; /* header + termination */
 
             if (header_len >= expected_len) {
@@ -2691,7 +2984,9 @@ retry:
                 mark_source_rp_bad(ms);
                 goto out;
             }
-            migrate_handle_rp_req_pages(ms, (char *)&buf[13], start, len);
+            migrate_handle_rp_req_pages(ms, (char *)&buf[13], start, len,
+                                        header_type ==
+                                        MIG_RP_MSG_PREFETCH_PAGES_ID);
             break;
 
         case MIG_RP_MSG_RECV_BITMAP:
@@ -3185,17 +3480,27 @@ static MigThrError postcopy_pause(MigrationState *s)
     assert(s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE);
 
     while (true) {
-        QEMUFile *file;
+        QEMUFile *file, *preempt;
 
         /* Current channel is possibly broken. Release it. */
         assert(s->to_dst_file);
         qemu_mutex_lock(&s->qemu_file_lock);
         file = s->to_dst_file;
         s->to_dst_file = NULL;
+        /*
+         * The preempt channel is not re-established on recovery, requested
+         * pages go over the main channel from now on.
+         */
+        preempt = s->postcopy_qemufile_src;
+        s->postcopy_qemufile_src = NULL;
         qemu_mutex_unlock(&s->qemu_file_lock);
 
         qemu_file_shutdown(file);
         qemu_fclose(file);
+        if (preempt) {
+            qemu_file_shutdown(preempt);
+            qemu_fclose(preempt);
+        }
 
         migrate_set_state(&s->state, s->state,
                           MIGRATION_STATUS_POSTCOPY_PAUSED);
@@ -3413,6 +3718,8 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    /* Likewise for the per-vCPU throttling of dirty-limit */
+    dirty_limit_stop();
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
@@ -3603,6 +3910,34 @@ static void *migration_thread(void *opaque)
     return NULL;
 }
 
+/*
+ * Mapped RAM writes pages at fixed offsets of the migration file, which
+ * must therefore allow random access.
+ */
+static bool migrate_mapped_ram_check(MigrationState *s, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(s->to_dst_file);
+
+    if (!migrate_mapped_ram()) {
+        return true;
+    }
+
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "Mapped RAM requires a migration file that "
+                   "supports random access");
+        return false;
+    }
+
+    if (migrate_use_multifd() &&
+        migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        error_setg(errp, "Mapped RAM is not compatible with multifd "
+                   "compression");
+        return false;
+    }
+
+    return true;
+}
+
 void migrate_fd_connect(MigrationState *s, Error *error_in)
 {
     Error *local_err = NULL;
@@ -3659,7 +3994,15 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         return;
     }
 
-    if (multifd_save_setup(&local_err) != 0) {
+    if (!migrate_mapped_ram_check(s, &local_err) ||
+        multifd_save_setup(&local_err) != 0) {
+        error_report_err(local_err);
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        migrate_fd_cleanup(s);
+        return;
+    }
+    if (postcopy_preempt_setup(s, &local_err)) {
         error_report_err(local_err);
         migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
                           MIGRATION_STATUS_FAILED);
@@ -3769,6 +4112,12 @@ static Property migration_properties[] = {
     DEFINE_PROP_SIZE("announce-step", MigrationState,
                       parameters.announce_step,
                       DEFAULT_MIGRATE_ANNOUNCE_STEP),
+    DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
+                      parameters.vcpu_dirty_limit,
+                      DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
+    DEFINE_PROP_UINT8("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages,
+                      DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -3783,6 +4132,12 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+                        MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-postcopy-preempt",
+                        MIGRATION_CAPABILITY_POSTCOPY_PREEMPT),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -3850,6 +4205,8 @@ static void migration_instance_init(Object *obj)
     params->has_announce_max = true;
     params->has_announce_rounds = true;
     params->has_announce_step = true;
+    params->has_vcpu_dirty_limit = true;
+    params->has_postcopy_prefetch_pages = true;
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
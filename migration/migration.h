@@ -44,6 +44,17 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/*
+ * Channels that RAM pages travel on during postcopy.  Pages that the
+ * destination faulted on use the postcopy preempt channel when it is
+ * available, everything else uses the main migration stream.
+ */
+enum {
+    RAM_CHANNEL_PRECOPY = 0,
+    RAM_CHANNEL_POSTCOPY = 1,
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -76,7 +87,8 @@ struct MigrationIncomingState {
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
     /* RAMBlock of last request sent to source */
     RAMBlock *last_rb;
-    void     *postcopy_tmp_page;
+    /* Temporary pages used to assemble host pages, one per channel */
+    void     *postcopy_tmp_pages[RAM_CHANNEL_MAX];
     void     *postcopy_tmp_zero_page;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
@@ -121,6 +133,17 @@ struct MigrationIncomingState {
      * contains valid information.
      */
     QemuMutex page_request_mutex;
+
+    /* Last RAMBlock received on each channel, for RAM_SAVE_FLAG_CONTINUE */
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
+    /* Postcopy preempt channel, carrying the pages that were faulted on */
+    QEMUFile *postcopy_qemufile_dst;
+    /* Posted when postcopy_qemufile_dst is set up, or on cleanup */
+    QemuSemaphore postcopy_qemufile_dst_done;
+    bool have_preempt_thread;
+    QemuThread preempt_thread;
+    /* Set to make the preempt thread exit without reporting an error */
+    bool preempt_thread_quit;
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -150,9 +173,14 @@ struct MigrationState {
     QEMUBH *cleanup_bh;
     QEMUFile *to_dst_file;
     /*
-     * Protects to_dst_file pointer.  We need to make sure we won't
-     * yield or hang during the critical section, since this lock will
-     * be used in OOB command handler.
+     * Postcopy preempt channel.  It is only written by the migration
+     * thread, which sends the pages requested by the destination on it.
+     */
+    QEMUFile *postcopy_qemufile_src;
+    /*
+     * Protects to_dst_file and postcopy_qemufile_src pointers.  We need
+     * to make sure we won't yield or hang during the critical section,
+     * since this lock will be used in OOB command handler.
      */
     QemuMutex qemu_file_lock;
 
@@ -310,6 +338,9 @@ bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
+bool migrate_postcopy_preempt(void);
+bool migrate_mapped_ram(void);
+int migrate_postcopy_prefetch_pages(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
@@ -317,6 +348,8 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_multifd_zero_page(void);
+bool migrate_dirty_limit(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
@@ -351,6 +384,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
                                       RAMBlock *rb, ram_addr_t start);
+int migrate_send_rp_message_prefetch_pages(MigrationIncomingState *mis,
+                                           RAMBlock *rb, ram_addr_t start);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -0,0 +1,539 @@
+/*
+ * Multifd XBZRLE compression implementation
+ *
+ * Copyright (c) 2020 Red Hat Inc
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "exec/target_page.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Each page in a packet is sent as one byte with its encoding, followed by
+ * the page contents for XBZRLE_PAGE_RAW, or a be16 length followed by the
+ * XBZRLE delta against the previously sent page for XBZRLE_PAGE_DELTA.
+ * Nothing follows XBZRLE_PAGE_SAME.
+ */
+#define XBZRLE_PAGE_RAW   0
+#define XBZRLE_PAGE_DELTA 1
+#define XBZRLE_PAGE_SAME  2
+
+/* Maximum encoded size of one page */
+#define XBZRLE_PAGE_MAX_SIZE(page_size) ((page_size) + 3)
+
+/*
+ * The cache of sent pages is shared by all the channels, as any page can
+ * be sent by any channel.  To keep the channels from serializing on one
+ * lock, it is split in stripes that each have their own lock, and
+ * consecutive pages go to different stripes.
+ */
+#define MULTIFD_XBZRLE_STRIPES 64
+
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} MultiFDXbzrleStripe;
+
+typedef struct {
+    MultiFDXbzrleStripe *stripes;
+    int nr_stripes;
+    /* number of send channels using the cache */
+    int users;
+} MultiFDXbzrleState;
+
+static MultiFDXbzrleState *multifd_xbzrle_state;
+
+/* Statistics, protected by multifd_xbzrle_stats_lock */
+static XBZRLECacheStats multifd_xbzrle_stats;
+static QemuMutex multifd_xbzrle_stats_lock;
+
+struct xbzrle_data {
+    /* copy of the page being encoded */
+    uint8_t *current_buf;
+    /* encoded packet */
+    uint8_t *zbuff;
+    /* size of encoded packet buffer */
+    uint32_t zbuff_len;
+};
+
+static void multifd_xbzrle_cache_fini(void);
+
+static int multifd_xbzrle_cache_init(Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    int64_t cache_pages = migrate_xbzrle_cache_size() / page_size;
+    int i;
+
+    if (multifd_xbzrle_state) {
+        multifd_xbzrle_state->users++;
+        return 0;
+    }
+
+    multifd_xbzrle_state = g_new0(MultiFDXbzrleState, 1);
+    multifd_xbzrle_state->nr_stripes = MIN(MULTIFD_XBZRLE_STRIPES,
+                                           cache_pages);
+    multifd_xbzrle_state->stripes = g_new0(MultiFDXbzrleStripe,
+                                           multifd_xbzrle_state->nr_stripes);
+    multifd_xbzrle_state->users = 1;
+
+    for (i = 0; i < multifd_xbzrle_state->nr_stripes; i++) {
+        qemu_mutex_init(&multifd_xbzrle_state->stripes[i].lock);
+    }
+    for (i = 0; i < multifd_xbzrle_state->nr_stripes; i++) {
+        MultiFDXbzrleStripe *stripe = &multifd_xbzrle_state->stripes[i];
+
+        stripe->cache = cache_init(migrate_xbzrle_cache_size() /
+                                   multifd_xbzrle_state->nr_stripes,
+                                   page_size, errp);
+        if (!stripe->cache) {
+            multifd_xbzrle_cache_fini();
+            return -1;
+        }
+    }
+
+    qemu_mutex_lock(&multifd_xbzrle_stats_lock);
+    memset(&multifd_xbzrle_stats, 0, sizeof(multifd_xbzrle_stats));
+    multifd_xbzrle_stats.cache_size = migrate_xbzrle_cache_size();
+    qemu_mutex_unlock(&multifd_xbzrle_stats_lock);
+
+    return 0;
+}
+
+static void multifd_xbzrle_cache_fini(void)
+{
+    int i;
+
+    if (!multifd_xbzrle_state || --multifd_xbzrle_state->users) {
+        return;
+    }
+
+    for (i = 0; i < multifd_xbzrle_state->nr_stripes; i++) {
+        MultiFDXbzrleStripe *stripe = &multifd_xbzrle_state->stripes[i];
+
+        if (stripe->cache) {
+            cache_fini(stripe->cache);
+        }
+        qemu_mutex_destroy(&stripe->lock);
+    }
+    g_free(multifd_xbzrle_state->stripes);
+    g_free(multifd_xbzrle_state);
+    multifd_xbzrle_state = NULL;
+}
+
+/*
+ * Find the stripe that caches @addr, and the address to use as key in the
+ * cache of that stripe.  Keys are made dense so that the whole cache of
+ * each stripe is used.
+ */
+static MultiFDXbzrleStripe *multifd_xbzrle_stripe(ram_addr_t addr,
+                                                  uint64_t *key)
+{
+    size_t page_size = qemu_target_page_size();
+    uint64_t page = addr / page_size;
+    int nr_stripes = multifd_xbzrle_state->nr_stripes;
+
+    *key = (page / nr_stripes) * page_size;
+    return &multifd_xbzrle_state->stripes[page % nr_stripes];
+}
+
+/**
+ * multifd_xbzrle_cache_zero_page: update the cache for a zero page
+ *
+ * Pages that are found to be zero are sent on the main migration
+ * stream; make sure that the next delta for such a page is computed
+ * against a zero page and not against stale data.
+ *
+ * @addr: ram address of the page
+ */
+void multifd_xbzrle_cache_zero_page(ram_addr_t addr)
+{
+    MultiFDXbzrleStripe *stripe;
+    uint64_t key;
+    uint8_t *data;
+
+    if (!multifd_xbzrle_state) {
+        return;
+    }
+
+    stripe = multifd_xbzrle_stripe(addr, &key);
+    qemu_mutex_lock(&stripe->lock);
+    if (cache_is_cached(stripe->cache, key, ram_counters.dirty_sync_count)) {
+        data = get_cached_data(stripe->cache, key);
+        memset(data, 0, qemu_target_page_size());
+    }
+    qemu_mutex_unlock(&stripe->lock);
+}
+
+/**
+ * multifd_xbzrle_get_stats: get the statistics of the last migration
+ *
+ * Returns false if multifd XBZRLE compression hasn't been used
+ *
+ * @stats: where to store the statistics
+ */
+bool multifd_xbzrle_get_stats(XBZRLECacheStats *stats)
+{
+    uint64_t encoded_size;
+
+    qemu_mutex_lock(&multifd_xbzrle_stats_lock);
+    *stats = multifd_xbzrle_stats;
+    qemu_mutex_unlock(&multifd_xbzrle_stats_lock);
+
+    if (!stats->cache_size) {
+        return false;
+    }
+
+    if (stats->pages) {
+        stats->cache_miss_rate = (double)stats->cache_miss /
+                                 (stats->pages + stats->cache_miss);
+    }
+    encoded_size = stats->bytes;
+    if (encoded_size) {
+        stats->encoding_rate = (double)stats->pages * qemu_target_page_size()
+                               / encoded_size;
+    }
+
+    return true;
+}
+
+/* Multifd XBZRLE compression */
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Setup each channel with XBZRLE compression.  The first channel also
+ * creates the cache that all channels share.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    size_t page_size = qemu_target_page_size();
+    struct xbzrle_data *z;
+
+    /* migrate_caps_check() rejects multifd-zero-page with xbzrle */
+    assert(!migrate_multifd_zero_page());
+
+    if (multifd_xbzrle_cache_init(errp) < 0) {
+        error_prepend(errp, "multifd %d: ", p->id);
+        return -1;
+    }
+
+    z = g_new0(struct xbzrle_data, 1);
+    p->data = z;
+    z->current_buf = g_malloc(page_size);
+    z->zbuff_len = page_count * XBZRLE_PAGE_MAX_SIZE(page_size);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Return memory.  The last channel also frees the shared cache.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    if (!z) {
+        return;
+    }
+
+    multifd_xbzrle_cache_fini();
+    g_free(z->current_buf);
+    z->current_buf = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode each page against the copy that was sent last time, when there
+ * is one in the cache, and update the cache with the new contents.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint64_t age = ram_counters.dirty_sync_count;
+    uint64_t pages = 0, cache_miss = 0, overflow = 0, bytes = 0;
+    uint32_t out_size = 0;
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        ram_addr_t addr = p->pages->block->offset + p->pages->offset[i];
+        uint8_t *out = z->zbuff + out_size;
+        MultiFDXbzrleStripe *stripe;
+        uint8_t *cached;
+        uint64_t key;
+        bool hit = false;
+        int encoded_len = -1;
+
+        /* The guest may change the page while we look at it */
+        memcpy(z->current_buf, p->pages->iov[i].iov_base, page_size);
+
+        stripe = multifd_xbzrle_stripe(addr, &key);
+        qemu_mutex_lock(&stripe->lock);
+        if (cache_is_cached(stripe->cache, key, age)) {
+            cached = get_cached_data(stripe->cache, key);
+            encoded_len = xbzrle_encode_buffer(cached, z->current_buf,
+                                               page_size, out + 3,
+                                               page_size);
+            if (encoded_len != 0) {
+                memcpy(cached, z->current_buf, page_size);
+            }
+            hit = true;
+        } else {
+            /* We don't care if the page didn't make it into the cache */
+            cache_insert(stripe->cache, key, z->current_buf, age);
+            cache_miss++;
+        }
+        qemu_mutex_unlock(&stripe->lock);
+
+        /* Account like save_xbzrle_page() does */
+        if (hit) {
+            pages++;
+            if (encoded_len == -1) {
+                overflow++;
+                bytes += page_size;
+            }
+        }
+
+        if (encoded_len == 0) {
+            out[0] = XBZRLE_PAGE_SAME;
+            out_size += 1;
+        } else if (encoded_len > 0) {
+            out[0] = XBZRLE_PAGE_DELTA;
+            stw_be_p(out + 1, encoded_len);
+            out_size += 3 + encoded_len;
+            bytes += 3 + encoded_len;
+        } else {
+            out[0] = XBZRLE_PAGE_RAW;
+            memcpy(out + 1, z->current_buf, page_size);
+            out_size += 1 + page_size;
+        }
+    }
+
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    qemu_mutex_lock(&multifd_xbzrle_stats_lock);
+    multifd_xbzrle_stats.pages += pages;
+    multifd_xbzrle_stats.cache_miss += cache_miss;
+    multifd_xbzrle_stats.overflow += overflow;
+    multifd_xbzrle_stats.bytes += bytes;
+    qemu_mutex_unlock(&multifd_xbzrle_stats_lock);
+
+    return 0;
+}
+
+/**
+ * xbzrle_send_write: do the actual write of the data
+ *
+ * Do the actual write of the encoded buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Create the buffer for the encoded packet.  The receive side doesn't
+ * need a cache, deltas are applied to the pages in guest memory.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    struct xbzrle_data *z = g_new0(struct xbzrle_data, 1);
+
+    p->data = z;
+    z->zbuff_len = page_count *
+                   XBZRLE_PAGE_MAX_SIZE(qemu_target_page_size());
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * Return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *z = p->data;
+
+    if (!z) {
+        return;
+    }
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the encoded buffer, and apply each page to guest memory.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    size_t page_size = qemu_target_page_size();
+    struct xbzrle_data *z = p->data;
+    uint32_t pos = 0;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %d maximum %d",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t len;
+
+        if (pos >= in_size) {
+            goto truncated;
+        }
+
+        switch (z->zbuff[pos++]) {
+        case XBZRLE_PAGE_SAME:
+            break;
+        case XBZRLE_PAGE_RAW:
+            if (in_size - pos < page_size) {
+                goto truncated;
+            }
+            memcpy(iov->iov_base, z->zbuff + pos, page_size);
+            pos += page_size;
+            break;
+        case XBZRLE_PAGE_DELTA:
+            if (in_size - pos < 2) {
+                goto truncated;
+            }
+            len = lduw_be_p(z->zbuff + pos);
+            pos += 2;
+            if (in_size - pos < len) {
+                goto truncated;
+            }
+            if (xbzrle_decode_buffer(z->zbuff + pos, len, iov->iov_base,
+                                     page_size) == -1) {
+                error_setg(errp, "multifd %d: failed to decode XBZRLE page "
+                           "at %p", p->id, iov->iov_base);
+                return -1;
+            }
+            pos += len;
+            break;
+        default:
+            error_setg(errp, "multifd %d: unknown page encoding %d",
+                       p->id, z->zbuff[pos - 1]);
+            return -1;
+        }
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %d: packet size received %d size used %d",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %d: truncated packet of size %d", p->id,
+               in_size);
+    return -1;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .send_write = xbzrle_send_write,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
+
+static void multifd_xbzrle_register(void)
+{
+    qemu_mutex_init(&multifd_xbzrle_stats_lock);
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -12,6 +12,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -259,9 +261,116 @@ static void multifd_pages_clear(MultiFDPages_t *pages)
     g_free(pages);
 }
 
+/*
+ * Size of the zero page bitmap that follows the page offsets in a packet
+ * with @pages_alloc pages, or 0 if the channels don't detect zero pages.
+ */
+static uint32_t multifd_zero_bitmap_size(uint32_t pages_alloc)
+{
+    if (!migrate_multifd_zero_page()) {
+        return 0;
+    }
+    return DIV_ROUND_UP(pages_alloc, 64) * sizeof(uint64_t);
+}
+
+static uint8_t *multifd_packet_zero_bitmap(MultiFDPacket_t *packet,
+                                           uint32_t pages_alloc)
+{
+    return (uint8_t *)packet + sizeof(MultiFDPacket_t)
+           + sizeof(uint64_t) * pages_alloc;
+}
+
+/**
+ * multifd_send_zero_page_detect: find the zero pages of a packet
+ *
+ * Zero pages are marked in p->zero_bitmap and removed from p->pages->iov,
+ * so that the compression methods only see the pages whose contents
+ * have to be sent.
+ *
+ * Returns the number of pages whose contents have to be sent
+ *
+ * @p: Params for the channel that we are using
+ */
+static uint32_t multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    uint32_t normal = 0;
+    uint32_t i;
+
+    bitmap_zero(p->zero_bitmap, pages->allocated);
+    for (i = 0; i < pages->used; i++) {
+        struct iovec *iov = &pages->iov[i];
+
+        if (buffer_is_zero(iov->iov_base, iov->iov_len)) {
+            set_bit(i, p->zero_bitmap);
+        } else {
+            pages->iov[normal++] = *iov;
+        }
+    }
+
+    return normal;
+}
+
+/**
+ * multifd_recv_zero_page_process: clear the zero pages of a packet
+ *
+ * Zero pages are cleared in guest memory and removed from p->pages->iov,
+ * so that the de-compression methods only see the pages whose contents
+ * are in the stream.
+ *
+ * Returns the number of pages whose contents have to be read
+ *
+ * @p: Params for the channel that we are using
+ */
+static uint32_t multifd_recv_zero_page_process(MultiFDRecvParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    uint32_t normal = 0;
+    uint32_t i;
+
+    for (i = 0; i < pages->used; i++) {
+        struct iovec *iov = &pages->iov[i];
+
+        if (test_bit(i, p->zero_bitmap)) {
+            /* Don't dirty pages that are already zero */
+            if (!buffer_is_zero(iov->iov_base, iov->iov_len)) {
+                memset(iov->iov_base, 0, iov->iov_len);
+            }
+        } else {
+            pages->iov[normal++] = *iov;
+        }
+    }
+
+    return normal;
+}
+
+/*
+ * Pages are accounted as normal pages when they are queued, before the
+ * channel had a chance to find out that they are zero.  Move the zero
+ * pages found since the last call to the duplicate counter and account
+ * the bytes the channel actually wrote, so that rate limiting and the
+ * bandwidth estimate do not see the zero pages that were dropped.
+ *
+ * Must be called with p->mutex held.
+ */
+static void multifd_account_sent(MultiFDSendParams *p, QEMUFile *f)
+{
+    uint64_t zero_pages = p->zero_pages_pending;
+    uint64_t bytes = p->bytes_pending;
+
+    p->zero_pages_pending = 0;
+    p->bytes_pending = 0;
+    ram_counters.normal -= zero_pages;
+    ram_counters.duplicate += zero_pages;
+    qemu_file_update_transfer(f, bytes);
+    ram_counters.multifd_bytes += bytes;
+    ram_counters.transferred += bytes;
+}
+
 static void multifd_send_fill_packet(MultiFDSendParams *p)
 {
     MultiFDPacket_t *packet = p->packet;
+    uint32_t bitmap_size = multifd_zero_bitmap_size(p->pages->allocated);
     int i;
 
     packet->flags = cpu_to_be32(p->flags);
@@ -280,12 +389,27 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    if (bitmap_size) {
+        uint8_t *bitmap = multifd_packet_zero_bitmap(packet,
+                                                     p->pages->allocated);
+
+        memset(bitmap, 0, bitmap_size);
+        for (i = 0; i < p->pages->used; i++) {
+            if (test_bit(i, p->zero_bitmap)) {
+                uint8_t *word = bitmap + (i / 64) * sizeof(uint64_t);
+
+                stq_be_p(word, ldq_be_p(word) | (1ULL << (i % 64)));
+            }
+        }
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
 {
     MultiFDPacket_t *packet = p->packet;
     uint32_t pages_max = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint32_t bitmap_size;
     RAMBlock *block;
     int i;
 
@@ -318,6 +442,16 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                    packet->pages_alloc, pages_max * 100) ;
         return -1;
     }
+    /* The zero page bitmap has to fit in the packet we have read */
+    bitmap_size = multifd_zero_bitmap_size(packet->pages_alloc);
+    if (bitmap_size &&
+        sizeof(MultiFDPacket_t) + sizeof(uint64_t) * packet->pages_alloc
+        + bitmap_size > p->packet_len) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d pages and expected a maximum of %d pages",
+                   packet->pages_alloc, pages_max);
+        return -1;
+    }
     /*
      * We received a packet that is bigger than expected but inside
      * reasonable limits (see previous comment).  Just reallocate.
@@ -325,6 +459,8 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     if (packet->pages_alloc > p->pages->allocated) {
         multifd_pages_clear(p->pages);
         p->pages = multifd_pages_init(packet->pages_alloc);
+        g_free(p->zero_bitmap);
+        p->zero_bitmap = bitmap_new(packet->pages_alloc);
     }
 
     p->pages->used = be32_to_cpu(packet->pages_used);
@@ -364,6 +500,20 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
 
+    if (bitmap_size) {
+        uint8_t *bitmap = multifd_packet_zero_bitmap(packet,
+                                                     packet->pages_alloc);
+
+        bitmap_zero(p->zero_bitmap, p->pages->allocated);
+        for (i = 0; i < p->pages->used; i++) {
+            uint64_t word = ldq_be_p(bitmap + (i / 64) * sizeof(uint64_t));
+
+            if (word & (1ULL << (i % 64))) {
+                set_bit(i, p->zero_bitmap);
+            }
+        }
+    }
+
     return 0;
 }
 
@@ -409,7 +559,6 @@ static int multifd_send_pages(QEMUFile *f)
     static int next_channel;
     MultiFDSendParams *p = NULL; /* make happy gcc */
     MultiFDPages_t *pages = multifd_send_state->pages;
-    uint64_t transferred;
 
     if (qatomic_read(&multifd_send_state->exiting)) {
         return -1;
@@ -441,14 +590,11 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->used);
     assert(!p->pages->block);
 
+    multifd_account_sent(p, f);
+
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->used) * qemu_target_page_size()
-                + p->packet_len;
-    qemu_file_update_transfer(f, transferred);
-    ram_counters.multifd_bytes += transferred;
-    ram_counters.transferred += transferred;
     qemu_mutex_unlock(&p->mutex);
     qemu_sem_post(&p->sem);
 
@@ -527,7 +673,7 @@ void multifd_save_cleanup(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_send_state) {
         return;
     }
     multifd_send_terminate_threads(NULL);
@@ -542,7 +688,11 @@ void multifd_save_cleanup(void)
         MultiFDSendParams *p = &multifd_send_state->params[i];
         Error *local_err = NULL;
 
-        socket_send_channel_destroy(p->c);
+        if (migrate_mapped_ram()) {
+            object_unref(OBJECT(p->c));
+        } else {
+            socket_send_channel_destroy(p->c);
+        }
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
@@ -553,6 +703,8 @@ void multifd_save_cleanup(void)
         p->tls_hostname = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero_bitmap);
+        p->zero_bitmap = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -600,9 +752,6 @@ void multifd_send_sync_main(QEMUFile *f)
         p->packet_num = multifd_send_state->packet_num++;
         p->flags |= MULTIFD_FLAG_SYNC;
         p->pending_job++;
-        qemu_file_update_transfer(f, p->packet_len);
-        ram_counters.multifd_bytes += p->packet_len;
-        ram_counters.transferred += p->packet_len;
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_post(&p->sem);
     }
@@ -611,10 +760,63 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        WITH_QEMU_LOCK_GUARD(&p->mutex) {
+            multifd_account_sent(p, f);
+        }
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/**
+ * multifd_send_mapped_ram: write the pages of a packet to the file
+ *
+ * With mapped-ram there are no packets: the pages are written at their
+ * place in the migration file, and the zero pages are dropped from the
+ * file bitmap of the RAMBlock.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @block: the RAMBlock of the pages
+ * @used: number of pages in the packet
+ * @normal: number of pages that are not zero, at the start of p->pages->iov
+ * @errp: pointer to an error
+ */
+static int multifd_send_mapped_ram(MultiFDSendParams *p, RAMBlock *block,
+                                   uint32_t used, uint32_t normal,
+                                   Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    uint32_t i, start;
+
+    if (normal < used) {
+        for (i = 0; i < used; i++) {
+            if (test_bit(i, p->zero_bitmap)) {
+                bitmap_test_and_clear_atomic(block->file_bmap,
+                                             pages->offset[i] / page_size, 1);
+            }
+        }
+    }
+
+    /* Pages that are contiguous in memory are contiguous in the file too */
+    for (start = 0; start < normal; start = i) {
+        uint8_t *base = pages->iov[start].iov_base;
+
+        for (i = start + 1; i < normal; i++) {
+            if (pages->iov[i].iov_base != base + (i - start) * page_size) {
+                break;
+            }
+        }
+        if (mapped_ram_write_pages(p->c, block, base - block->host,
+                                   (i - start) * page_size, errp)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -625,12 +827,15 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    /* With mapped-ram the channel is the migration file itself */
+    if (!migrate_mapped_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -642,38 +847,70 @@ static void *multifd_send_thread(void *opaque)
 
         if (p->pending_job) {
             uint32_t used = p->pages->used;
+            uint32_t normal = used;
             uint64_t packet_num = p->packet_num;
+            RAMBlock *block = p->pages->block;
             flags = p->flags;
 
-            if (used) {
-                ret = multifd_send_state->ops->send_prepare(p, used,
-                                                            &local_err);
+            /* Zero pages are not written to the file with mapped-ram */
+            if (used && (migrate_multifd_zero_page() || migrate_mapped_ram())) {
+                normal = multifd_send_zero_page_detect(p);
+                p->num_zero_pages += used - normal;
+                p->zero_pages_pending += used - normal;
+            }
+            if (migrate_mapped_ram()) {
+                p->flags = 0;
+                p->num_pages += used;
+                p->bytes_pending += (uint64_t)normal * qemu_target_page_size();
+                p->pages->used = 0;
+                p->pages->block = NULL;
+                qemu_mutex_unlock(&p->mutex);
+
+                trace_multifd_send(p->id, packet_num, used, used - normal,
+                                   flags, 0);
+
+                if (used) {
+                    ret = multifd_send_mapped_ram(p, block, used, normal,
+                                                  &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
+                }
+            } else {
+                if (normal) {
+                    ret = multifd_send_state->ops->send_prepare(p, normal,
+                                                                &local_err);
+                    if (ret != 0) {
+                        qemu_mutex_unlock(&p->mutex);
+                        break;
+                    }
+                } else {
+                    p->next_packet_size = 0;
+                }
+                multifd_send_fill_packet(p);
+                p->flags = 0;
+                p->num_packets++;
+                p->num_pages += used;
+                p->bytes_pending += p->packet_len + p->next_packet_size;
+                p->pages->used = 0;
+                p->pages->block = NULL;
+                qemu_mutex_unlock(&p->mutex);
+
+                trace_multifd_send(p->id, packet_num, used, used - normal,
+                                   flags, p->next_packet_size);
+
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
                 if (ret != 0) {
-                    qemu_mutex_unlock(&p->mutex);
                     break;
                 }
-            }
-            multifd_send_fill_packet(p);
-            p->flags = 0;
-            p->num_packets++;
-            p->num_pages += used;
-            p->pages->used = 0;
-            p->pages->block = NULL;
-            qemu_mutex_unlock(&p->mutex);
-
-            trace_multifd_send(p->id, packet_num, used, flags,
-                               p->next_packet_size);
 
-            ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                        p->packet_len, &local_err);
-            if (ret != 0) {
-                break;
-            }
-
-            if (used) {
-                ret = multifd_send_state->ops->send_write(p, used, &local_err);
-                if (ret != 0) {
-                    break;
+                if (normal) {
+                    ret = multifd_send_state->ops->send_write(p, normal,
+                                                              &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
                 }
             }
 
@@ -715,7 +952,8 @@ out:
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages,
+                                  p->num_zero_pages);
 
     return NULL;
 }
@@ -880,14 +1118,25 @@ int multifd_save_setup(Error **errp)
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
+        p->zero_bitmap = bitmap_new(page_count);
         p->packet_len = sizeof(MultiFDPacket_t)
-                      + sizeof(uint64_t) * page_count;
+                      + sizeof(uint64_t) * page_count
+                      + multifd_zero_bitmap_size(page_count);
         p->packet = g_malloc0(p->packet_len);
         p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
         p->tls_hostname = g_strdup(s->hostname);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (migrate_mapped_ram()) {
+            /* Every channel writes at its own offsets of the same file */
+            p->c = QIO_CHANNEL(object_ref(
+                       OBJECT(qemu_file_get_ioc(s->to_dst_file))));
+            p->running = true;
+            qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                               QEMU_THREAD_JOINABLE);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -916,6 +1165,15 @@ struct {
     MultiFDMethods *ops;
 } *multifd_recv_state;
 
+/*
+ * With mapped-ram the pages are read from the migration file directly,
+ * so the receive side has no channels to set up.
+ */
+static bool multifd_use_recv_channels(void)
+{
+    return migrate_use_multifd() && !migrate_mapped_ram();
+}
+
 static void multifd_recv_terminate_threads(Error *err)
 {
     int i;
@@ -954,7 +1212,7 @@ int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_recv_channels()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -982,6 +1240,8 @@ int multifd_load_cleanup(Error **errp)
         p->name = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero_bitmap);
+        p->zero_bitmap = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -1000,7 +1260,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_recv_channels()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1034,6 +1294,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t normal;
         uint32_t flags;
 
         if (p->quit) {
@@ -1066,8 +1327,14 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        if (used) {
-            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+        normal = used;
+        if (used && migrate_multifd_zero_page()) {
+            normal = multifd_recv_zero_page_process(p);
+            p->num_zero_pages += used - normal;
+        }
+
+        if (normal) {
+            ret = multifd_recv_state->ops->recv_pages(p, normal, &local_err);
             if (ret != 0) {
                 break;
             }
@@ -1088,7 +1355,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages,
+                                  p->num_zero_pages);
 
     return NULL;
 }
@@ -1099,7 +1367,7 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_recv_channels()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1117,8 +1385,10 @@ int multifd_load_setup(Error **errp)
         p->quit = false;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
+        p->zero_bitmap = bitmap_new(page_count);
         p->packet_len = sizeof(MultiFDPacket_t)
-                      + sizeof(uint64_t) * page_count;
+                      + sizeof(uint64_t) * page_count
+                      + multifd_zero_bitmap_size(page_count);
         p->packet = g_malloc0(p->packet_len);
         p->name = g_strdup_printf("multifdrecv_%d", i);
     }
@@ -1141,7 +1411,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_use_recv_channels()) {
         return true;
     }
 
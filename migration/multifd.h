@@ -22,6 +22,8 @@ bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 void multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+void multifd_xbzrle_cache_zero_page(ram_addr_t addr);
+bool multifd_xbzrle_get_stats(XBZRLECacheStats *stats);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -32,6 +34,7 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -48,6 +51,11 @@ typedef struct {
     uint64_t packet_num;
     uint64_t unused[4];    /* Reserved for future use */
     char ramblock[256];
+    /*
+     * offset[pages_alloc], followed by a bitmap of pages_alloc bits (as
+     * big endian 64 bit words) of pages that are zero when the
+     * multifd-zero-page capability is enabled.
+     */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
@@ -104,6 +112,14 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages detected by this channel */
+    uint64_t num_zero_pages;
+    /* zero pages not yet accounted in ram_counters */
+    uint64_t zero_pages_pending;
+    /* bytes written but not yet accounted in ram_counters */
+    uint64_t bytes_pending;
+    /* bitmap of the zero pages in the current packet */
+    unsigned long *zero_bitmap;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -143,6 +159,10 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages received through this channel */
+    uint64_t num_zero_pages;
+    /* bitmap of the zero pages in the current packet */
+    unsigned long *zero_bitmap;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
@@ -20,7 +20,9 @@
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
+#include "qemu-file-channel.h"
 #include "savevm.h"
+#include "socket.h"
 #include "postcopy-ram.h"
 #include "ram.h"
 #include "qapi/error.h"
@@ -104,6 +106,10 @@ typedef struct PostcopyBlocktimeContext {
     /* number of vCPU are suspended */
     int smp_cpus_down;
     uint64_t start_time;
+    /* number of vCPU page faults that waited for the source */
+    uint64_t page_faults;
+    /* number of pages requested ahead of page faults */
+    uint64_t prefetch_pages;
 
     /*
      * Handler for exit event, necessary for
@@ -178,6 +184,10 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     info->postcopy_blocktime = bc->total_blocktime;
     info->has_postcopy_vcpu_blocktime = true;
     info->postcopy_vcpu_blocktime = get_vcpu_blocktime_list(bc);
+    info->has_postcopy_page_faults = true;
+    info->postcopy_page_faults = bc->page_faults;
+    info->has_postcopy_prefetch_pages = true;
+    info->postcopy_prefetch_pages = bc->prefetch_pages;
 }
 
 static uint32_t get_postcopy_total_blocktime(void)
@@ -524,8 +534,17 @@ int postcopy_ram_incoming_init(MigrationIncomingState *mis)
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
+    int channel;
+
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    /*
+     * Unless postcopy failed, the source terminates the preempt channel
+     * after the last page it sent there; wait for them to be placed.
+     */
+    postcopy_preempt_thread_stop(mis, mis->state !=
+                                      MIGRATION_STATUS_POSTCOPY_ACTIVE);
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -560,9 +579,11 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         }
     }
 
-    if (mis->postcopy_tmp_page) {
-        munmap(mis->postcopy_tmp_page, mis->largest_page_size);
-        mis->postcopy_tmp_page = NULL;
+    for (channel = 0; channel < RAM_CHANNEL_MAX; channel++) {
+        if (mis->postcopy_tmp_pages[channel]) {
+            munmap(mis->postcopy_tmp_pages[channel], mis->largest_page_size);
+            mis->postcopy_tmp_pages[channel] = NULL;
+        }
     }
     if (mis->postcopy_tmp_zero_page) {
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
@@ -752,6 +773,8 @@ static void mark_postcopy_blocktime_begin(uintptr_t addr, uint32_t ptid,
         qatomic_xchg(&dc->vcpu_addr[cpu], 0);
         qatomic_xchg(&dc->page_fault_vcpu_time[cpu], 0);
         qatomic_dec(&dc->smp_cpus_down);
+    } else {
+        dc->page_faults++;
     }
     trace_mark_postcopy_blocktime_begin(addr, dc, dc->page_fault_vcpu_time[cpu],
                                         cpu, already_received);
@@ -821,14 +844,18 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
             qatomic_fetch_add(&dc->smp_cpus_down, 0) == smp_cpus) {
             vcpu_total_blocktime = true;
         }
-        /* continue cycle, due to one page could affect several vCPUs */
-        dc->vcpu_blocktime[i] += vcpu_blocktime;
+        /*
+         * continue cycle, due to one page could affect several vCPUs.
+         * Pages are placed both by the listen thread and by the postcopy
+         * preempt thread, so the sums are updated atomically.
+         */
+        qatomic_add(&dc->vcpu_blocktime[i], vcpu_blocktime);
     }
 
     qatomic_sub(&dc->smp_cpus_down, affected_cpu);
     if (vcpu_total_blocktime) {
-        dc->total_blocktime += low_time_offset - qatomic_fetch_add(
-                &dc->last_begin, 0);
+        qatomic_add(&dc->total_blocktime, low_time_offset - qatomic_fetch_add(
+                &dc->last_begin, 0));
     }
     trace_mark_postcopy_blocktime_end(addr, dc, dc->total_blocktime,
                                       affected_cpu);
@@ -845,12 +872,90 @@ static bool postcopy_pause_fault_thread(MigrationIncomingState *mis)
     return true;
 }
 
+/*
+ * Pages requested ahead of the page faults, to save the guest some of the
+ * round trips to the source.  When the last faults in a RAMBlock were the
+ * same distance apart, the next pages along that stride are requested;
+ * otherwise the pages right after the faulting one are, since guest
+ * accesses tend to be local.  Only used by the fault thread.
+ */
+typedef struct PostcopyPrefetchState {
+    RAMBlock *rb;
+    /* Offset of the last fault in @rb */
+    ram_addr_t last_offset;
+    /* Distance between the last two faults in @rb */
+    int64_t last_stride;
+    /* Stride used by the last prefetch, and the last page it requested */
+    int64_t prefetch_stride;
+    ram_addr_t prefetch_offset;
+} PostcopyPrefetchState;
+
+static void postcopy_prefetch_pages(MigrationIncomingState *mis,
+                                    PostcopyPrefetchState *ps,
+                                    RAMBlock *rb, ram_addr_t rb_offset)
+{
+    PostcopyBlocktimeContext *dc = mis->blocktime_ctx;
+    int npages = migrate_postcopy_prefetch_pages();
+    int64_t stride = qemu_ram_pagesize(rb);
+    int64_t ahead;
+    int i, first = 1;
+
+    if (rb == ps->rb) {
+        int64_t delta = (int64_t)rb_offset - (int64_t)ps->last_offset;
+
+        if (delta && delta == ps->last_stride) {
+            stride = delta;
+        }
+        ps->last_stride = delta;
+    } else {
+        ps->rb = rb;
+        ps->last_stride = 0;
+        ps->prefetch_stride = 0;
+    }
+    ps->last_offset = rb_offset;
+
+    if (!npages) {
+        return;
+    }
+
+    /* Skip what the previous faults already asked for along this stride */
+    ahead = (int64_t)ps->prefetch_offset - (int64_t)rb_offset;
+    if (stride == ps->prefetch_stride && ahead % stride == 0 &&
+        ahead / stride > 0 && ahead / stride <= npages) {
+        first = ahead / stride + 1;
+    }
+
+    for (i = first; i <= npages; i++) {
+        int64_t offset = (int64_t)rb_offset + i * stride;
+
+        if (offset < 0 || offset >= qemu_ram_get_used_length(rb)) {
+            break;
+        }
+        ps->prefetch_stride = stride;
+        ps->prefetch_offset = offset;
+
+        if (ramblock_recv_bitmap_test_byte_offset(rb, offset)) {
+            continue;
+        }
+
+        trace_postcopy_prefetch_page(qemu_ram_get_idstr(rb), offset, stride);
+        if (migrate_send_rp_message_prefetch_pages(mis, rb, offset)) {
+            /* The next fault will notice the broken return path */
+            break;
+        }
+        if (dc) {
+            dc->prefetch_pages++;
+        }
+    }
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    PostcopyPrefetchState prefetch = { 0 };
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -992,6 +1097,8 @@ retry:
                     break;
                 }
             }
+
+            postcopy_prefetch_pages(mis, &prefetch, rb, rb_offset);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1056,8 +1163,47 @@ retry:
     return NULL;
 }
 
+/*
+ * Load the pages that the source sends on the postcopy preempt channel,
+ * until it terminates the channel with RAM_SAVE_FLAG_EOS.
+ */
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    int ret = 0;
+
+    trace_postcopy_preempt_thread_entry();
+    rcu_register_thread();
+
+    /* The source connects the channel asynchronously */
+    qemu_sem_wait(&mis->postcopy_qemufile_dst_done);
+
+    if (!qatomic_read(&mis->preempt_thread_quit) &&
+        mis->postcopy_qemufile_dst) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
+                                    RAM_CHANNEL_POSTCOPY);
+        }
+    }
+
+    if (ret && !qatomic_read(&mis->preempt_thread_quit)) {
+        /*
+         * Don't leave the faulting vCPUs waiting: handle it like a failure
+         * of the main channel, which pauses postcopy if it can.
+         */
+        error_report("%s: failed to load pages: %d", __func__, ret);
+        qemu_file_shutdown(mis->from_src_file);
+    }
+
+    rcu_unregister_thread();
+    trace_postcopy_preempt_thread_exit(ret);
+    return NULL;
+}
+
 int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 {
+    int channel, nchannels;
+
     /* Open the fd for the kernel to give us userfaults */
     mis->userfault_fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
     if (mis->userfault_fd == -1) {
@@ -1096,14 +1242,18 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
         return -1;
     }
 
-    mis->postcopy_tmp_page = mmap(NULL, mis->largest_page_size,
-                                  PROT_READ | PROT_WRITE, MAP_PRIVATE |
-                                  MAP_ANONYMOUS, -1, 0);
-    if (mis->postcopy_tmp_page == MAP_FAILED) {
-        mis->postcopy_tmp_page = NULL;
-        error_report("%s: Failed to map postcopy_tmp_page %s",
-                     __func__, strerror(errno));
-        return -1;
+    /* The preempt channel needs its own page to assemble host pages */
+    nchannels = migrate_postcopy_preempt() ? RAM_CHANNEL_MAX : 1;
+    for (channel = 0; channel < nchannels; channel++) {
+        void *tmp_page = mmap(NULL, mis->largest_page_size,
+                              PROT_READ | PROT_WRITE, MAP_PRIVATE |
+                              MAP_ANONYMOUS, -1, 0);
+        if (tmp_page == MAP_FAILED) {
+            error_report("%s: Failed to map postcopy_tmp_page %s",
+                         __func__, strerror(errno));
+            return -1;
+        }
+        mis->postcopy_tmp_pages[channel] = tmp_page;
     }
 
     /*
@@ -1122,6 +1272,18 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
     }
     memset(mis->postcopy_tmp_zero_page, '\0', mis->largest_page_size);
 
+    if (migrate_postcopy_preempt()) {
+        /*
+         * Created after the temporary pages because it may use them right
+         * away; it waits for the channel itself if it is not there yet.
+         */
+        qatomic_set(&mis->preempt_thread_quit, false);
+        qemu_thread_create(&mis->preempt_thread, "postcopy/preempt",
+                           postcopy_preempt_thread, mis,
+                           QEMU_THREAD_JOINABLE);
+        mis->have_preempt_thread = true;
+    }
+
     trace_postcopy_ram_enable_notify();
 
     return 0;
@@ -1437,3 +1599,112 @@ void postcopy_unregister_shared_ufd(struct PostCopyFD *pcfd)
         }
     }
 }
+
+/*
+ * The preempt channel may only be installed while the migration it was
+ * created for is still running.  Once postcopy has paused, the channel
+ * belongs to a connection that is gone, and recovery sets up a new one.
+ */
+static bool postcopy_preempt_channel_wanted(MigrationState *s)
+{
+    switch (s->state) {
+    case MIGRATION_STATUS_SETUP:
+    case MIGRATION_STATUS_ACTIVE:
+    case MIGRATION_STATUS_POSTCOPY_ACTIVE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void postcopy_preempt_send_channel_new(QIOTask *task, gpointer opaque)
+{
+    MigrationState *s = opaque;
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        /* Not fatal: requested pages keep going over the main channel */
+        warn_report_err(local_err);
+        warn_report("Postcopy preempt channel unavailable, "
+                    "requested pages will use the main channel");
+    } else if (!postcopy_preempt_channel_wanted(s)) {
+        /*
+         * Without the magic, the destination closes the connection
+         * instead of taking it for one of its channels.
+         */
+        trace_postcopy_preempt_drop_channel(MigrationStatus_str(s->state));
+    } else {
+        QEMUFile *file;
+
+        qio_channel_set_name(ioc, "migration-postcopy-preempt");
+        file = qemu_fopen_channel_output(ioc);
+        qemu_file_set_blocking(file, true);
+        qemu_put_be32(file, POSTCOPY_PREEMPT_MAGIC);
+        qemu_fflush(file);
+        if (qemu_file_get_error(file)) {
+            warn_report("Postcopy preempt channel unavailable, "
+                        "requested pages will use the main channel");
+            qemu_fclose(file);
+        } else {
+            WITH_QEMU_LOCK_GUARD(&s->qemu_file_lock) {
+                qatomic_set(&s->postcopy_qemufile_src, file);
+            }
+            trace_postcopy_preempt_new_channel();
+        }
+    }
+    object_unref(OBJECT(ioc));
+}
+
+int postcopy_preempt_setup(MigrationState *s, Error **errp)
+{
+    if (!migrate_postcopy_preempt()) {
+        return 0;
+    }
+
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_setg(errp, "Postcopy preempt does not support TLS");
+        return -1;
+    }
+
+    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    return 0;
+}
+
+bool postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
+{
+    /*
+     * Only one preempt channel is used per migration.  Once postcopy has
+     * paused, a late one belongs to the connection that broke.
+     */
+    if (mis->postcopy_qemufile_dst ||
+        (mis->state != MIGRATION_STATUS_ACTIVE &&
+         mis->state != MIGRATION_STATUS_POSTCOPY_ACTIVE)) {
+        trace_postcopy_preempt_drop_channel(MigrationStatus_str(mis->state));
+        return false;
+    }
+
+    qemu_file_set_blocking(file, true);
+    qatomic_set(&mis->postcopy_qemufile_dst, file);
+    trace_postcopy_preempt_new_channel();
+    qemu_sem_post(&mis->postcopy_qemufile_dst_done);
+    return true;
+}
+
+void postcopy_preempt_thread_stop(MigrationIncomingState *mis, bool shutdown)
+{
+    if (!mis->have_preempt_thread) {
+        return;
+    }
+
+    if (shutdown) {
+        qatomic_set(&mis->preempt_thread_quit, true);
+        if (mis->postcopy_qemufile_dst) {
+            qemu_file_shutdown(mis->postcopy_qemufile_dst);
+        }
+    }
+    /* Wake the thread in case the source never connected the channel */
+    qemu_sem_post(&mis->postcopy_qemufile_dst_done);
+    qemu_thread_join(&mis->preempt_thread);
+    mis->have_preempt_thread = false;
+}
@@ -179,4 +179,29 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/*
+ * Postcopy preempt channel: pages faulted on by the destination are sent
+ * on a separate connection so that they are not delayed by the background
+ * transfer on the main one.
+ */
+/*
+ * The source sends this first on the preempt channel, so that the
+ * destination can tell it from the main channel.
+ */
+#define POSTCOPY_PREEMPT_MAGIC 0x51455050U /* "QEPP" */
+/* Source: start connecting the preempt channel */
+int postcopy_preempt_setup(MigrationState *s, Error **errp);
+/*
+ * Destination: a connection starting with POSTCOPY_PREEMPT_MAGIC has been
+ * accepted, and the magic read.  Returns false if the channel is not
+ * wanted, in which case the caller closes @file.
+ */
+bool postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file);
+/*
+ * Destination: wait for the preempt thread to finish.  With @shutdown the
+ * channel is shut down first, otherwise the thread reads until the source
+ * terminates the channel.
+ */
+void postcopy_preempt_thread_stop(MigrationIncomingState *mis, bool shutdown);
+
 #endif
@@ -89,6 +89,18 @@ QEMUFile *qemu_file_get_return_path(QEMUFile *f)
     return f->ops->get_return_path(f->opaque);
 }
 
+/*
+ * Return the channel the file reads from or writes to, or NULL if it
+ * is not backed by a QIOChannel.  No reference is taken.
+ */
+QIOChannel *qemu_file_get_ioc(QEMUFile *f)
+{
+    if (!f->ops->get_ioc) {
+        return NULL;
+    }
+    return f->ops->get_ioc(f->opaque);
+}
+
 bool qemu_file_mode_is_not_valid(const char *mode)
 {
     if (mode == NULL ||
@@ -657,6 +669,67 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Return the position in the underlying channel of the next byte to be
+ * read or written, or a negative errno if the channel is not seekable.
+ * Unlike qemu_ftell() this is an offset in the channel, not the amount
+ * of data transferred.
+ */
+int64_t qemu_get_offset(QEMUFile *f)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    Error *local_err = NULL;
+    off_t pos;
+
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        return -ESPIPE;
+    }
+
+    qemu_fflush(f);
+    if (f->last_error) {
+        return f->last_error;
+    }
+
+    pos = qio_channel_io_seek(ioc, 0, SEEK_CUR, &local_err);
+    if (pos < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+        return -EIO;
+    }
+
+    /* Data that was read ahead into the buffer is not consumed yet */
+    return pos - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Move the position in the underlying channel to @offset, so that the
+ * stream continues from there.  Buffered output is flushed first and
+ * buffered input is dropped.
+ *
+ * Returns 0 on success, or a negative errno
+ */
+int qemu_set_offset(QEMUFile *f, int64_t offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    Error *local_err = NULL;
+
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        return -ESPIPE;
+    }
+
+    qemu_fflush(f);
+    if (f->last_error) {
+        return f->last_error;
+    }
+
+    if (qio_channel_io_seek(ioc, offset, SEEK_SET, &local_err) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+        return -EIO;
+    }
+    f->buf_index = 0;
+    f->buf_size = 0;
+    return 0;
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->shutdown) {
@@ -56,6 +56,7 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "dirtyrate.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -76,6 +77,16 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * With mapped-ram, the setup section carries a header for each RAMBlock
+ * (version, target page size, offset of the bitmap and offset of the
+ * pages in the migration file).  The pages of a RAMBlock start on an
+ * aligned offset, so that the file can be read with O_DIRECT or mapped.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_HDR_SIZE (4 + 3 * 8)
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
@@ -302,6 +313,8 @@ struct RAMState {
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
     RAMBlock *last_sent_block;
+    /* Last block sent on the postcopy preempt channel */
+    RAMBlock *last_sent_block_preempt;
     /* Last dirty target page we have sent */
     ram_addr_t last_page;
     /* last ram version we have seen */
@@ -347,6 +360,12 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /*
+     * Pages the destination asked for ahead of its faults.  They are sent
+     * after src_page_requests, and never on the postcopy preempt channel,
+     * so that they do not delay the pages a vCPU is blocked on.
+     */
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_prefetches;
 };
 typedef struct RAMState RAMState;
 
@@ -951,7 +970,8 @@ static void migration_trigger_throttle(RAMState *rs)
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
-    if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+    if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+        !blk_mig_bulk_active()) {
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -960,10 +980,17 @@ static void migration_trigger_throttle(RAMState *rs)
 
         if ((bytes_dirty_period > bytes_dirty_threshold) &&
             (++rs->dirty_rate_high_cnt >= 2)) {
-            trace_migration_throttle();
             rs->dirty_rate_high_cnt = 0;
-            mig_throttle_guest_down(bytes_dirty_period,
-                                    bytes_dirty_threshold);
+            if (migrate_dirty_limit()) {
+                /* Only throttle the vCPUs that dirty memory too fast */
+                trace_migration_dirty_limit_guest(
+                    s->parameters.vcpu_dirty_limit);
+                dirty_limit_start(s->parameters.vcpu_dirty_limit);
+            } else {
+                trace_migration_throttle();
+                mig_throttle_guest_down(bytes_dirty_period,
+                                        bytes_dirty_threshold);
+            }
         }
     }
 }
@@ -1155,6 +1182,83 @@ static int save_normal_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
     return 1;
 }
 
+static int mapped_ram_pwrite_all(QIOChannel *ioc, const char *buf, size_t len,
+                                 off_t pos, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pwrite(ioc, buf, len, pos, errp);
+
+        if (ret < 0) {
+            return -1;
+        }
+        buf += ret;
+        pos += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/**
+ * mapped_ram_write_pages: write pages at their place in the migration file
+ *
+ * The pages are also marked as present in the file bitmap of @block.
+ * Called by the migration thread and by the multifd channels, which all
+ * write to the same file.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @ioc: channel of the migration file
+ * @block: block that contains the pages
+ * @offset: offset inside the block of the first page
+ * @len: length of the pages, a multiple of the target page size
+ * @errp: pointer to an error
+ */
+int mapped_ram_write_pages(QIOChannel *ioc, RAMBlock *block,
+                           ram_addr_t offset, size_t len, Error **errp)
+{
+    if (mapped_ram_pwrite_all(ioc, (char *)block->host + offset, len,
+                              block->pages_offset + offset, errp)) {
+        return -1;
+    }
+    bitmap_set_atomic(block->file_bmap, offset >> TARGET_PAGE_BITS,
+                      len >> TARGET_PAGE_BITS);
+    return 0;
+}
+
+/*
+ * Write a page at its place in the migration file.  Zero pages are not
+ * written, only dropped from the file bitmap in case an earlier version
+ * of the page was.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int save_mapped_ram_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    Error *local_err = NULL;
+
+    if (is_zero_range(block->host + offset, TARGET_PAGE_SIZE)) {
+        clear_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    if (mapped_ram_write_pages(ioc, block, offset, TARGET_PAGE_SIZE,
+                               &local_err)) {
+        qemu_file_set_error_obj(rs->f, -EIO, local_err);
+        return -1;
+    }
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 /**
  * ram_save_page: send the given page to the stream
  *
@@ -1404,19 +1508,25 @@ static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
  *
  * @rs: current RAM state
  * @offset: used to return the offset within the RAMBlock
+ * @prefetch: set to whether the page was only prefetched by the destination
  */
-static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
+static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset,
+                              bool *prefetch)
 {
+    struct RAMSrcPageRequest *entry;
     RAMBlock *block = NULL;
 
-    if (QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests)) {
+    if (QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_requests) &&
+        QSIMPLEQ_EMPTY_ATOMIC(&rs->src_page_prefetches)) {
         return NULL;
     }
 
     QEMU_LOCK_GUARD(&rs->src_page_req_mutex);
-    if (!QSIMPLEQ_EMPTY(&rs->src_page_requests)) {
-        struct RAMSrcPageRequest *entry =
-                                QSIMPLEQ_FIRST(&rs->src_page_requests);
+    /* The pages that vCPUs are blocked on go first */
+    *prefetch = QSIMPLEQ_EMPTY(&rs->src_page_requests);
+    entry = *prefetch ? QSIMPLEQ_FIRST(&rs->src_page_prefetches) :
+                        QSIMPLEQ_FIRST(&rs->src_page_requests);
+    if (entry) {
         block = entry->rb;
         *offset = entry->offset;
 
@@ -1425,9 +1535,13 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
             entry->offset += TARGET_PAGE_SIZE;
         } else {
             memory_region_unref(block->mr);
-            QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+            if (*prefetch) {
+                QSIMPLEQ_REMOVE_HEAD(&rs->src_page_prefetches, next_req);
+            } else {
+                QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+                migration_consume_urgent_request();
+            }
             g_free(entry);
-            migration_consume_urgent_request();
         }
     }
 
@@ -1443,15 +1557,17 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
  *
  * @rs: current RAM state
  * @pss: data about the state of the current dirty page scan
+ * @prefetch: set to whether the page was only prefetched by the destination
  */
-static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
+static bool get_queued_page(RAMState *rs, PageSearchStatus *pss,
+                            bool *prefetch)
 {
     RAMBlock  *block;
     ram_addr_t offset;
     bool dirty;
 
     do {
-        block = unqueue_page(rs, &offset);
+        block = unqueue_page(rs, &offset, prefetch);
         /*
          * We're sending this page, and since it's postcopy nothing else
          * will dirty it, and we must make sure it doesn't get sent again
@@ -1520,6 +1636,12 @@ static void migration_page_queue_free(RAMState *rs)
         QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
         g_free(mspr);
     }
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_page_prefetches, next_req,
+                          next_mspr) {
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_page_prefetches, next_req);
+        g_free(mspr);
+    }
 }
 
 /**
@@ -1533,8 +1655,10 @@ static void migration_page_queue_free(RAMState *rs)
  *          same that last one.
  * @start: starting address from the start of the RAMBlock
  * @len: length (in bytes) to send
+ * @prefetch: the destination has not faulted on the pages yet
  */
-int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
+int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
+                         bool prefetch)
 {
     RAMBlock *ramblock;
     RAMState *rs = ram_state;
@@ -1564,7 +1688,7 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
         }
         rs->last_req_rb = ramblock;
     }
-    trace_ram_save_queue_pages(ramblock->idstr, start, len);
+    trace_ram_save_queue_pages(ramblock->idstr, start, len, prefetch);
     if (start + len > ramblock->used_length) {
         error_report("%s request overrun start=" RAM_ADDR_FMT " len="
                      RAM_ADDR_FMT " blocklen=" RAM_ADDR_FMT,
@@ -1580,8 +1704,13 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
 
     memory_region_ref(ramblock->mr);
     qemu_mutex_lock(&rs->src_page_req_mutex);
-    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
-    migration_make_urgent_request();
+    if (prefetch) {
+        /* No need to wake up the migration thread for these */
+        QSIMPLEQ_INSERT_TAIL(&rs->src_page_prefetches, new_entry, next_req);
+    } else {
+        QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
+        migration_make_urgent_request();
+    }
     qemu_mutex_unlock(&rs->src_page_req_mutex);
 
     return 0;
@@ -1653,16 +1782,39 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
 
+    /* With mapped-ram, pages have their own place in the file */
+    if (migrate_mapped_ram()) {
+        if (migrate_use_multifd()) {
+            return ram_save_multifd_page(rs, block, offset);
+        }
+        return save_mapped_ram_page(rs, block, offset);
+    }
+
     if (save_compress_page(rs, block, offset)) {
         return 1;
     }
 
+    /*
+     * Do not use multifd for:
+     * 1. Compression as the first page in the new block should be posted out
+     *    before sending the compressed page
+     * 2. In postcopy as one whole host page should be placed
+     */
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd()
+                  && !migration_in_postcopy();
+
+    /* The multifd channels look for zero pages themselves if asked to */
+    if (use_multifd && migrate_multifd_zero_page()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -1673,18 +1825,15 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
             xbzrle_cache_zero_page(rs, block->offset + offset);
             XBZRLE_cache_unlock();
         }
+        if (use_multifd &&
+            migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE) {
+            multifd_xbzrle_cache_zero_page(block->offset + offset);
+        }
         ram_release_pages(block->idstr, offset, res);
         return res;
     }
 
-    /*
-     * Do not use multifd for:
-     * 1. Compression as the first page in the new block should be posted out
-     *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
-     */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -1746,6 +1895,66 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     return pages;
 }
 
+/**
+ * postcopy_preempt_active: whether requested pages use the preempt channel
+ *
+ * The channel is connected asynchronously, and dropped when postcopy is
+ * paused; the main channel is used whenever it is missing.
+ */
+static bool postcopy_preempt_active(void)
+{
+    return migrate_postcopy_preempt() && migration_in_postcopy() &&
+           qatomic_read(&migrate_get_current()->postcopy_qemufile_src);
+}
+
+/**
+ * ram_save_host_page_urgent: save a requested host page on the preempt channel
+ *
+ * The destination is blocked on this page, so send it on its own channel
+ * instead of queueing it behind the background data already buffered on
+ * the main channel, and push it out right away.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ * @last_stage: if we are at the completion stage
+ */
+static int ram_save_host_page_urgent(RAMState *rs, PageSearchStatus *pss,
+                                     bool last_stage)
+{
+    QEMUFile *f = rs->f;
+    QEMUFile *preempt = migrate_get_current()->postcopy_qemufile_src;
+    RAMBlock *last_sent_block = rs->last_sent_block;
+    int pages, ret;
+
+    trace_ram_save_host_page_urgent(pss->block->idstr, pss->page);
+
+    /* The RAM_SAVE_FLAG_CONTINUE tracking is per channel */
+    rs->f = preempt;
+    rs->last_sent_block = rs->last_sent_block_preempt;
+    pages = ram_save_host_page(rs, pss, last_stage);
+    rs->last_sent_block_preempt = rs->last_sent_block;
+    rs->last_sent_block = last_sent_block;
+    rs->f = f;
+
+    qemu_fflush(preempt);
+    ret = qemu_file_get_error(preempt);
+    if (ret) {
+        /*
+         * Report it on the main channel, so that the migration thread
+         * pauses postcopy like for any other network failure.
+         */
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+
+    if (pages > 0) {
+        ram_counters.postcopy_preempt_pages += pages;
+    }
+    return pages;
+}
+
 /**
  * ram_find_and_save_block: finds a dirty page and sends it to f
  *
@@ -1765,7 +1974,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 {
     PageSearchStatus pss;
     int pages = 0;
-    bool again, found;
+    bool again, found, prefetch = false;
 
     /* No dirty page as there is zero RAM */
     if (!ram_bytes_total()) {
@@ -1782,7 +1991,12 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 
     do {
         again = true;
-        found = get_queued_page(rs, &pss);
+        found = get_queued_page(rs, &pss, &prefetch);
+
+        if (found && !prefetch && postcopy_preempt_active()) {
+            pages = ram_save_host_page_urgent(rs, &pss, last_stage);
+            continue;
+        }
 
         if (!found) {
             /* priority queue empty, so just search for something dirty */
@@ -1890,6 +2104,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -1901,6 +2117,7 @@ static void ram_state_reset(RAMState *rs)
 {
     rs->last_seen_block = NULL;
     rs->last_sent_block = NULL;
+    rs->last_sent_block_preempt = NULL;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->ram_bulk_stage = true;
@@ -2284,6 +2501,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->src_page_prefetches);
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -2387,6 +2605,7 @@ static void ram_state_resume_prepare(RAMState *rs, QEMUFile *out)
 
     rs->last_seen_block = NULL;
     rs->last_sent_block = NULL;
+    rs->last_sent_block_preempt = NULL;
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     /*
@@ -2448,6 +2667,73 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
+/**
+ * mapped_ram_setup_ramblock: lay out a RAMBlock in the migration file
+ *
+ * Write the header locating the bitmap and the pages of @block, and move
+ * the stream past the space they take in the file.
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @f: QEMUFile where to send the data
+ * @block: the RAMBlock to lay out
+ */
+static int mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    int64_t header_offset = qemu_get_offset(f);
+
+    if (header_offset < 0) {
+        return header_offset;
+    }
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = header_offset + MAPPED_RAM_HDR_SIZE;
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+    trace_ram_mapped_ram_setup(block->idstr, block->bitmap_offset,
+                               block->pages_offset);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    return qemu_set_offset(f, block->pages_offset + block->used_length);
+}
+
+/*
+ * Write the final file bitmaps once all the pages are in the file.
+ *
+ * Returns zero to indicate success and negative for error
+ */
+static int mapped_ram_write_bitmaps(QEMUFile *f)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+        unsigned long *le_bitmap = bitmap_new(num_pages);
+        Error *local_err = NULL;
+        int ret;
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        ret = mapped_ram_pwrite_all(ioc, (char *)le_bitmap, size,
+                                    block->bitmap_offset, &local_err);
+        g_free(le_bitmap);
+        if (ret) {
+            qemu_file_set_error_obj(f, -EIO, local_err);
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
 /*
  * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
  * long-running RCU critical section.  When rcu-reclaims in the code
@@ -2467,6 +2753,7 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
     RAMBlock *block;
+    int ret;
 
     if (compress_threads_save_setup()) {
         return -1;
@@ -2495,6 +2782,14 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                ret = mapped_ram_setup_ramblock(f, block);
+                if (ret < 0) {
+                    error_report("Failed to lay out RAM block %s in the "
+                                 "migration file", block->idstr);
+                    return ret;
+                }
+            }
         }
     }
 
@@ -2661,10 +2956,22 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     if (ret >= 0) {
         multifd_send_sync_main(rs->f);
+        if (migrate_mapped_ram()) {
+            /* Every page is in the file now, the bitmaps are final */
+            ret = mapped_ram_write_bitmaps(f);
+        }
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
     }
 
+    if (ret >= 0 && postcopy_preempt_active()) {
+        QEMUFile *preempt = migrate_get_current()->postcopy_qemufile_src;
+
+        /* Let the destination preempt thread know that we are done */
+        qemu_put_be64(preempt, RAM_SAVE_FLAG_EOS);
+        qemu_fflush(preempt);
+    }
+
     return ret;
 }
 
@@ -2738,12 +3045,16 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * Returns a pointer from within the RCU-protected ram_list.
  *
+ * @mis: the migration incoming state pointer
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel we're using
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(MigrationIncomingState *mis,
+                                              QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block;
+    RAMBlock *block = mis->last_recv_block[channel];
     char id[256];
     uint8_t len;
 
@@ -2770,6 +3081,8 @@ static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
         return NULL;
     }
 
+    mis->last_recv_block[channel] = block;
+
     return block;
 }
 
@@ -3174,19 +3487,21 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and by the postcopy preempt
+ * thread for the pages that arrive on the preempt channel.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: the channel to use for loading
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = mis->postcopy_tmp_page;
+    void *postcopy_host_page = mis->postcopy_tmp_pages[channel];
     void *this_host = NULL;
     bool all_zero = true;
     int target_pages = 0;
@@ -3217,7 +3532,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(mis, f, flags, channel);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -3404,6 +3719,190 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+static int mapped_ram_pread_all(QIOChannel *ioc, char *buf, size_t len,
+                                off_t pos, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pread(ioc, buf, len, pos, errp);
+
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of the migration file");
+            return -1;
+        }
+        buf += ret;
+        pos += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+typedef struct MappedRamLoadJob {
+    QemuThread thread;
+    QIOChannel *ioc;
+    RAMBlock *block;
+    /* pages of @block that are in the file */
+    unsigned long *bitmap;
+    off_t pages_offset;
+    /* range of pages loaded by this job */
+    unsigned long start;
+    unsigned long end;
+    Error *err;
+} MappedRamLoadJob;
+
+/*
+ * Load a range of pages of a RAMBlock, reading each run of pages that are
+ * in the file at once straight into guest memory.  The pages that are not
+ * in the file were zero on the source.
+ */
+static int mapped_ram_load_range(MappedRamLoadJob *job)
+{
+    RAMBlock *block = job->block;
+    unsigned long run_start, run_end = job->start;
+
+    while (run_end < job->end) {
+        unsigned long page;
+        ram_addr_t offset;
+
+        run_start = find_next_bit(job->bitmap, job->end, run_end);
+        for (page = run_end; page < run_start; page++) {
+            ram_handle_compressed(block->host +
+                                  ((ram_addr_t)page << TARGET_PAGE_BITS),
+                                  0, TARGET_PAGE_SIZE);
+        }
+        if (run_start >= job->end) {
+            break;
+        }
+
+        run_end = find_next_zero_bit(job->bitmap, job->end, run_start);
+        offset = (ram_addr_t)run_start << TARGET_PAGE_BITS;
+        if (mapped_ram_pread_all(job->ioc, (char *)block->host + offset,
+                                 (ram_addr_t)(run_end - run_start) <<
+                                 TARGET_PAGE_BITS,
+                                 job->pages_offset + offset, &job->err)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *mapped_ram_load_thread(void *opaque)
+{
+    mapped_ram_load_range(opaque);
+    return NULL;
+}
+
+/**
+ * mapped_ram_load_ramblock: load a RAMBlock from its place in the file
+ *
+ * Read the header that follows the RAMBlock in the setup section, load
+ * the pages and move the stream past the space they take in the file.
+ * With multifd, the RAMBlock is split between as many threads as there
+ * are multifd channels.
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @f: QEMUFile where to read the data from
+ * @block: the RAMBlock to load
+ * @length: length of the RAMBlock on the source
+ */
+static int mapped_ram_load_ramblock(QEMUFile *f, RAMBlock *block,
+                                    ram_addr_t length)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    int nthreads = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    unsigned long pages_per_thread = DIV_ROUND_UP(num_pages, nthreads);
+    MappedRamLoadJob *jobs;
+    unsigned long *le_bitmap, *bitmap;
+    uint64_t bitmap_offset, pages_offset, page_size;
+    uint32_t version;
+    Error *local_err = NULL;
+    int i, ret;
+
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_report("Mapped RAM requires a migration file that supports "
+                     "random access");
+        return -EINVAL;
+    }
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    bitmap_offset = qemu_get_be64(f);
+    pages_offset = qemu_get_be64(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram version %" PRIu32
+                     " for RAM block %s", version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size for RAM block %s "
+                     "(local) %d != %" PRIu64, block->idstr,
+                     TARGET_PAGE_SIZE, page_size);
+        return -EINVAL;
+    }
+
+    trace_ram_mapped_ram_load(block->idstr, bitmap_offset, pages_offset,
+                              nthreads);
+
+    le_bitmap = bitmap_new(num_pages);
+    if (mapped_ram_pread_all(ioc, (char *)le_bitmap, bitmap_size,
+                             bitmap_offset, &local_err)) {
+        error_report_err(local_err);
+        g_free(le_bitmap);
+        return -EIO;
+    }
+    bitmap = bitmap_new(num_pages);
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+    g_free(le_bitmap);
+
+    jobs = g_new0(MappedRamLoadJob, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        MappedRamLoadJob *job = &jobs[i];
+
+        job->ioc = ioc;
+        job->block = block;
+        job->bitmap = bitmap;
+        job->pages_offset = pages_offset;
+        job->start = MIN(i * pages_per_thread, num_pages);
+        job->end = MIN(job->start + pages_per_thread, num_pages);
+        if (i) {
+            qemu_thread_create(&job->thread, "mapped-ram-load",
+                               mapped_ram_load_thread, job,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    /* This thread takes the first range */
+    mapped_ram_load_range(&jobs[0]);
+
+    for (i = 0; i < nthreads; i++) {
+        MappedRamLoadJob *job = &jobs[i];
+
+        if (i) {
+            qemu_thread_join(&job->thread);
+        }
+        if (job->err) {
+            error_report_err(job->err);
+            ret = -EIO;
+        }
+    }
+    g_free(jobs);
+    g_free(bitmap);
+
+    if (ret) {
+        return ret;
+    }
+    return qemu_set_offset(f, pages_offset + length);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3416,6 +3915,7 @@ void colo_flush_ram_cache(void)
  */
 static int ram_load_precopy(QEMUFile *f)
 {
+    MigrationIncomingState *mis = migration_incoming_get_current();
     int flags = 0, ret = 0, invalid_flags = 0, len = 0, i = 0;
     /* ADVISE is earlier, it shows the source has the postcopy capability on */
     bool postcopy_advised = postcopy_is_advised();
@@ -3454,7 +3954,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            RAMBlock *block = ram_block_from_stream(mis, f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -3543,6 +4044,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = mapped_ram_load_ramblock(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3631,7 +4135,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
      */
     WITH_RCU_READ_LOCK_GUARD() {
         if (postcopy_running) {
-            ret = ram_load_postcopy(f);
+            ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
         } else {
             ret = ram_load_precopy(f);
         }
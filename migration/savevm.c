@@ -271,6 +271,7 @@ static bool should_validate_capability(int capability)
     /* Validate only new capabilities to keep compatibility. */
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
+    case MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE:
         return true;
     default:
         return false;
@@ -1507,6 +1508,21 @@ void qemu_savevm_state_cleanup(void)
     }
 }
 
+/*
+ * Internal snapshots write the VM state area of a block device through a
+ * single QEMUFile.  Nothing multiplexes the multifd channels into it yet,
+ * and mapped-ram needs a channel that supports pwritev.
+ */
+static bool snapshot_check_multifd(Error **errp)
+{
+    if (migrate_use_multifd() || migrate_mapped_ram()) {
+        error_setg(errp, "Snapshots cannot use the multifd or mapped-ram "
+                   "capabilities, migrate to a file: URI instead");
+        return false;
+    }
+    return true;
+}
+
 static int qemu_savevm_state(QEMUFile *f, Error **errp)
 {
     int ret;
@@ -2527,6 +2543,9 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
     /* Clear the triggered bit to allow one recovery */
     mis->postcopy_recover_triggered = false;
 
+    /* Requested pages come over the main channel after recovery */
+    postcopy_preempt_thread_stop(mis, true);
+
     assert(mis->from_src_file);
     qemu_file_shutdown(mis->from_src_file);
     qemu_fclose(mis->from_src_file);
@@ -2741,6 +2760,11 @@ int save_snapshot(const char *name, Error **errp)
         return ret;
     }
 
+    /* Check before deleting an old snapshot of the same name */
+    if (!snapshot_check_multifd(errp)) {
+        return ret;
+    }
+
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow making snapshot "
                    "right now. Try once more later.");
@@ -2948,6 +2972,10 @@ int load_snapshot(const char *name, Error **errp)
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
+    if (!snapshot_check_multifd(errp)) {
+        return -EINVAL;
+    }
+
     if (!bdrv_all_can_snapshot(&bs)) {
         error_setg(errp,
                    "Device '%s' is writable but does not support snapshots",
@@ -12,8 +12,79 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
+/*
+ * The encoder looks for the end of runs of unchanged bytes (zrun) and of
+ * runs of changed bytes (nzrun).  These two searches are where it spends
+ * its time, so they come in several flavours and the fastest one that the
+ * host supports is picked at startup.
+ *
+ * xbzrle_find_diff_*() return the index of the first byte at or after @i
+ * that differs between @old_buf and @new_buf, or @slen if there is none.
+ * xbzrle_find_same_*() return the index of the first byte at or after @i
+ * that is the same in both buffers, or @slen if there is none.
+ */
+static inline int xbzrle_find_diff_int(const uint8_t *old_buf,
+                                       const uint8_t *new_buf,
+                                       int i, int slen)
+{
+    /* not aligned to sizeof(long) */
+    long res = (slen - i) % sizeof(long);
+    while (res && old_buf[i] == new_buf[i]) {
+        i++;
+        res--;
+    }
+
+    /* word at a time for speed */
+    if (!res) {
+        while (i < slen &&
+               (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
+            i += sizeof(long);
+        }
+
+        /* go over the rest */
+        while (i < slen && old_buf[i] == new_buf[i]) {
+            i++;
+        }
+    }
+    return i;
+}
+
+static inline int xbzrle_find_same_int(const uint8_t *old_buf,
+                                       const uint8_t *new_buf,
+                                       int i, int slen)
+{
+    /* not aligned to sizeof(long) */
+    long res = (slen - i) % sizeof(long);
+    while (res && old_buf[i] != new_buf[i]) {
+        i++;
+        res--;
+    }
+
+    /* word at a time for speed, use of 32-bit long okay */
+    if (!res) {
+        /* truncation to 32-bit long okay */
+        unsigned long mask = (unsigned long)0x0101010101010101ULL;
+        while (i < slen) {
+            unsigned long xor;
+            xor = *(unsigned long *)(old_buf + i)
+                ^ *(unsigned long *)(new_buf + i);
+            if ((xor - mask) & ~xor & (mask << 7)) {
+                /* found the end of an nzrun within the current long */
+                while (old_buf[i] != new_buf[i]) {
+                    i++;
+                }
+                break;
+            } else {
+                i += sizeof(long);
+            }
+        }
+    }
+    return i;
+}
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -24,13 +95,14 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static inline int QEMU_ALWAYS_INLINE
+xbzrle_encode(uint8_t *old_buf, uint8_t *new_buf, int slen,
+              uint8_t *dst, int dlen,
+              int (*find_diff)(const uint8_t *, const uint8_t *, int, int),
+              int (*find_same)(const uint8_t *, const uint8_t *, int, int))
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, j;
 
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
@@ -41,28 +113,9 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
             return -1;
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
+        j = find_diff(old_buf, new_buf, i, slen);
+        zrun_len = j - i;
+        i = j;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -76,56 +129,299 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
-
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        j = find_same(old_buf, new_buf, i, slen);
+        nzrun_len = j - i;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
         if (d + nzrun_len > dlen) {
             return -1;
         }
-        memcpy(dst + d, nzrun_start, nzrun_len);
+        memcpy(dst + d, new_buf + i, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
+        i = j;
     }
 
     return d;
 }
 
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode(old_buf, new_buf, slen, dst, dlen,
+                         xbzrle_find_diff_int, xbzrle_find_same_int);
+}
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static inline int xbzrle_find_diff_avx2(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    /* 32 bytes at a time, one mask bit per equal byte */
+    while (i + 32 <= slen) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (eq != UINT32_MAX) {
+            return i + ctz32(~eq);
+        }
+        i += 32;
+    }
+    return xbzrle_find_diff_int(old_buf, new_buf, i, slen);
+}
+
+static inline int xbzrle_find_same_avx2(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    while (i + 32 <= slen) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+        i += 32;
+    }
+    return xbzrle_find_same_int(old_buf, new_buf, i, slen);
+}
+
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode(old_buf, new_buf, slen, dst, dlen,
+                         xbzrle_find_diff_avx2, xbzrle_find_same_avx2);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512F_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#include <immintrin.h>
+
+/*
+ * AVX512F has no byte compares, so compare 32-bit lanes and look for the
+ * exact byte within the first lane that doesn't match.
+ */
+static inline int xbzrle_find_diff_avx512(const uint8_t *old_buf,
+                                          const uint8_t *new_buf,
+                                          int i, int slen)
+{
+    while (i + 64 <= slen) {
+        __m512i a = _mm512_loadu_si512(old_buf + i);
+        __m512i b = _mm512_loadu_si512(new_buf + i);
+        uint16_t eq = _mm512_cmpeq_epi32_mask(a, b);
+
+        if (eq != UINT16_MAX) {
+            i += ctz32(~eq & UINT16_MAX) * 4;
+            while (old_buf[i] == new_buf[i]) {
+                i++;
+            }
+            return i;
+        }
+        i += 64;
+    }
+    return xbzrle_find_diff_int(old_buf, new_buf, i, slen);
+}
+
+static inline int xbzrle_find_same_avx512(const uint8_t *old_buf,
+                                          const uint8_t *new_buf,
+                                          int i, int slen)
+{
+    const __m512i ones = _mm512_set1_epi8(0x01);
+    const __m512i highs = _mm512_set1_epi8(0x80);
+
+    while (i + 64 <= slen) {
+        __m512i a = _mm512_loadu_si512(old_buf + i);
+        __m512i b = _mm512_loadu_si512(new_buf + i);
+        __m512i x = _mm512_xor_si512(a, b);
+        /* Same trick as the scalar version to find lanes with a zero byte */
+        __m512i z = _mm512_and_si512(_mm512_andnot_si512(x,
+                                         _mm512_sub_epi32(x, ones)), highs);
+        uint16_t has_same = _mm512_test_epi32_mask(z, z);
+
+        if (has_same) {
+            i += ctz32(has_same) * 4;
+            while (old_buf[i] != new_buf[i]) {
+                i++;
+            }
+            return i;
+        }
+        i += 64;
+    }
+    return xbzrle_find_same_int(old_buf, new_buf, i, slen);
+}
+
+static int xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf,
+                                       int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode(old_buf, new_buf, slen, dst, dlen,
+                         xbzrle_find_diff_avx512, xbzrle_find_same_avx512);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512F_OPT */
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+/*
+ * Narrow a 16 byte comparison result to 4 bits per byte, so that the
+ * index of the first set byte can be found with ctz64().
+ */
+static inline uint64_t xbzrle_neon_mask(uint8x16_t eq)
+{
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+
+static inline int xbzrle_find_diff_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    while (i + 16 <= slen) {
+        uint64_t eq = xbzrle_neon_mask(vceqq_u8(vld1q_u8(old_buf + i),
+                                                vld1q_u8(new_buf + i)));
+
+        if (eq != UINT64_MAX) {
+            return i + ctz64(~eq) / 4;
+        }
+        i += 16;
+    }
+    return xbzrle_find_diff_int(old_buf, new_buf, i, slen);
+}
+
+static inline int xbzrle_find_same_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    while (i + 16 <= slen) {
+        uint64_t eq = xbzrle_neon_mask(vceqq_u8(vld1q_u8(old_buf + i),
+                                                vld1q_u8(new_buf + i)));
+
+        if (eq) {
+            return i + ctz64(eq) / 4;
+        }
+        i += 16;
+    }
+    return xbzrle_find_same_int(old_buf, new_buf, i, slen);
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode(old_buf, new_buf, slen, dst, dlen,
+                         xbzrle_find_diff_neon, xbzrle_find_same_neon);
+}
+#endif /* __aarch64__ */
+
+/* Note that the most preferred ISA must have the least significant bit. */
+#define CACHE_AVX512F 1
+#define CACHE_AVX2    2
+#define CACHE_NEON    4
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+/* Advanced SIMD is mandatory on AArch64, no need to check at runtime */
+# define INIT_CACHE CACHE_NEON
+# define INIT_ACCEL xbzrle_encode_buffer_neon
+#else
+# define INIT_CACHE 0
+# define INIT_ACCEL xbzrle_encode_buffer_int
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static unsigned accel_cache = INIT_CACHE;
+static int (*encode_accel)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+    INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+        xbzrle_encode_buffer_int;
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    if (cache & CACHE_NEON) {
+        fn = xbzrle_encode_buffer_neon;
+    }
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512F_OPT
+    if (cache & CACHE_AVX512F) {
+        fn = xbzrle_encode_buffer_avx512;
+    }
+#endif
+    accel_cache = cache;
+    encode_accel = fn;
+}
+
+#if defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* See util/bufferiszero.c for the meaning of 0xe6 */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512F)) {
+                cache |= CACHE_AVX512F;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX512F_OPT || CONFIG_AVX2_OPT */
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /*
+     * If no bits set, we just tested xbzrle_encode_buffer_int; go back
+     * to the best accelerator for the next user.
+     */
+    if (accel_cache == 0) {
+        init_accel(cpuid_cache);
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    init_accel(accel_cache & (accel_cache - 1));
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -283,6 +283,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "postcopy request count: %" PRIu64 "\n",
                            info->ram->postcopy_requests);
         }
+        if (info->ram->postcopy_preempt_pages) {
+            monitor_printf(mon, "postcopy preempt pages: %" PRIu64 "\n",
+                           info->ram->postcopy_preempt_pages);
+        }
     }
 
     if (info->has_disk) {
@@ -345,6 +349,14 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+    if (info->has_postcopy_page_faults) {
+        monitor_printf(mon, "postcopy page faults: %" PRIu64 "\n",
+                       info->postcopy_page_faults);
+    }
+    if (info->has_postcopy_prefetch_pages) {
+        monitor_printf(mon, "postcopy prefetch pages: %" PRIu64 "\n",
+                       info->postcopy_prefetch_pages);
+    }
     if (info->has_socket_address) {
         SocketAddressList *addr;
 
@@ -477,6 +489,14 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_AUTHZ),
             params->tls_authz);
+        assert(params->has_vcpu_dirty_limit);
+        monitor_printf(mon, "%s: %" PRIu64 " MB/s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT),
+            params->vcpu_dirty_limit);
+        assert(params->has_postcopy_prefetch_pages);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
 
         if (params->has_block_bitmap_mapping) {
             const BitmapMigrationNodeAliasList *bmnal;
@@ -1422,6 +1442,14 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         error_setg(&err, "The block-bitmap-mapping parameter can only be set "
                    "through QMP");
         break;
+    case MIGRATION_PARAMETER_VCPU_DIRTY_LIMIT:
+        p->has_vcpu_dirty_limit = true;
+        visit_type_uint64(v, param, &p->vcpu_dirty_limit, &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_int(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
     default:
         assert(0);
     }
@@ -1928,6 +1956,26 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-percentile=%" PRId64 "\n",
+                       value->poll_percentile);
+        if (value->has_poll_time_ns) {
+            monitor_printf(mon, "  poll-time-ns=%" PRIu64 "\n",
+                           value->poll_time_ns);
+        }
+        if (value->has_poll_histogram) {
+            uint64List *bucket;
+
+            monitor_printf(mon, "  poll-histogram=");
+            for (bucket = value->poll_histogram; bucket;
+                 bucket = bucket->next) {
+                monitor_printf(mon, "%" PRIu64 "%s", bucket->value,
+                               bucket->next ? "," : "\n");
+            }
+        }
+        if (value->has_io_uring_sqpoll_wakeups) {
+            monitor_printf(mon, "  io-uring-sqpoll-wakeups=%" PRIu64 "\n",
+                           value->io_uring_sqpoll_wakeups);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
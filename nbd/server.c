@@ -25,6 +25,11 @@
 #include "trace.h"
 #include "nbd-internal.h"
 #include "qemu/units.h"
+#include "block/thread-pool.h"
+
+#ifdef CONFIG_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -99,6 +104,9 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* Read data may be sent straight from the host file with sendfile() */
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -1531,7 +1539,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     int64_t size;
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
-    bool shared = !exp_args->writable;
+    bool multi_conn = arg->has_multi_conn ? arg->multi_conn : readonly;
     strList *bitmaps;
     size_t i;
     int ret;
@@ -1582,11 +1590,14 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     exp->description = g_strdup(arg->description);
     exp->nbdflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
+    if (multi_conn) {
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
+#ifdef CONFIG_SENDFILE
+        exp->zero_copy = true;
+#endif
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
@@ -1748,6 +1759,155 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+#ifdef CONFIG_SENDFILE
+typedef struct NBDSendfileData {
+    int out_fd;
+    int in_fd;
+    off_t offset;
+    size_t count;
+} NBDSendfileData;
+
+static int nbd_sendfile_worker(void *opaque)
+{
+    NBDSendfileData *d = opaque;
+    ssize_t ret;
+
+    do {
+        ret = sendfile(d->out_fd, d->in_fd, &d->offset, d->count);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : ret;
+}
+#endif
+
+/*
+ * Check whether the data in [offset, offset + size) can be sent with
+ * nbd_co_send_iov_zero_copy().  This is only the case for read-only exports
+ * whose data is stored unchanged in a host file, and only without TLS because
+ * the data must go to the socket as is.
+ */
+static bool nbd_can_zero_copy(NBDClient *client, uint64_t offset, size_t size)
+{
+    NBDExport *exp = client->exp;
+    int64_t host_offset;
+
+    if (!exp->zero_copy || client->ioc != QIO_CHANNEL(client->sioc)) {
+        return false;
+    }
+    return blk_get_host_fd(exp->common.blk, offset, size, &host_offset) >= 0;
+}
+
+/*
+ * Send the export data in [offset, offset + size) directly from the host file
+ * with sendfile().  If the host file becomes unavailable midway, e.g. because
+ * the export is drained, the rest is read into @data and sent from there.
+ * Must be called with send_lock held, after nbd_can_zero_copy() succeeded for
+ * the whole range.
+ */
+static int coroutine_fn nbd_co_sendfile(NBDClient *client, uint64_t offset,
+                                        uint8_t *data, size_t size,
+                                        Error **errp)
+{
+    BlockBackend *blk = client->exp->common.blk;
+    size_t progress = 0;
+    int ret;
+
+#ifdef CONFIG_SENDFILE
+    ThreadPool *pool = aio_get_thread_pool(client->exp->common.ctx);
+
+    while (progress < size) {
+        NBDSendfileData d;
+        int64_t host_offset;
+        int fd;
+
+        blk_inc_in_flight(blk);
+        fd = blk_get_host_fd(blk, offset + progress, size - progress,
+                             &host_offset);
+        if (fd < 0) {
+            blk_dec_in_flight(blk);
+            break;
+        }
+
+        d = (NBDSendfileData) {
+            .out_fd = client->sioc->fd,
+            .in_fd  = fd,
+            .offset = host_offset,
+            .count  = size - progress,
+        };
+        ret = thread_pool_submit_co(pool, nbd_sendfile_worker, &d);
+        blk_dec_in_flight(blk);
+
+        if (ret == -EAGAIN) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        } else if (ret < 0) {
+            error_setg_errno(errp, -ret, "sendfile failed");
+            return -EIO;
+        } else if (ret == 0) {
+            /* Truncated since nbd_can_zero_copy(), read the rest as zeroes */
+            break;
+        }
+        trace_nbd_co_sendfile(offset + progress, ret);
+        progress += ret;
+    }
+#endif
+
+    if (progress == size) {
+        return 0;
+    }
+
+    trace_nbd_co_sendfile_fallback(offset + progress, size - progress);
+    ret = blk_pread(blk, offset + progress, data + progress, size - progress);
+    if (ret < 0) {
+        /* The reply header is already out, so the error cannot be reported */
+        error_setg_errno(errp, -ret, "reading from file failed");
+        return -EIO;
+    }
+    return qio_channel_write_all(client->ioc, (char *)data + progress,
+                                 size - progress, errp) < 0 ? -EIO : 0;
+}
+
+/*
+ * Send the reply header in @iov followed by the export data in
+ * [offset, offset + size), which is sent without copying it through a buffer
+ * if possible.  @data must be large enough to hold the data in case the
+ * buffered path has to be taken.
+ *
+ * Return -ENOTSUP without sending anything if the range cannot be sent from
+ * the host file at the time the header would go out, e.g. because another
+ * reply was sent in the meantime and the export is now drained.  The caller
+ * must then read the data itself, so that read errors can still be reported
+ * to the client.  Errors reading the data after the header was sent are
+ * returned as -EIO so that the client is disconnected.
+ */
+static int coroutine_fn nbd_co_send_iov_zero_copy(NBDClient *client,
+                                                  struct iovec *iov,
+                                                  unsigned niov,
+                                                  uint64_t offset,
+                                                  uint8_t *data,
+                                                  size_t size,
+                                                  Error **errp)
+{
+    int ret;
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* Waiting for send_lock may have taken a while, check again */
+    if (!nbd_can_zero_copy(client, offset, size)) {
+        ret = -ENOTSUP;
+    } else if (qio_channel_writev_all(client->ioc, iov, niov, errp) < 0) {
+        ret = -EIO;
+    } else {
+        ret = nbd_co_sendfile(client, offset, data, size, errp);
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1899,15 +2059,36 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
         } else {
-            ret = blk_pread(exp->common.blk, offset + progress,
-                            data + progress, pnum);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            ret = -ENOTSUP;
+            if (nbd_can_zero_copy(client, offset + progress, pnum)) {
+                NBDStructuredReadData chunk;
+                struct iovec iov[] = {
+                    {.iov_base = &chunk, .iov_len = sizeof(chunk)},
+                };
+
+                trace_nbd_co_send_structured_read_zero_copy(handle,
+                                                            offset + progress,
+                                                            pnum);
+                set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                             NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                             sizeof(chunk) - sizeof(chunk.h) + pnum);
+                stq_be_p(&chunk.offset, offset + progress);
+                ret = nbd_co_send_iov_zero_copy(client, iov, 1,
+                                                offset + progress,
+                                                data + progress, pnum, errp);
+            }
+            if (ret == -ENOTSUP) {
+                ret = blk_pread(exp->common.blk, offset + progress,
+                                data + progress, pnum);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
+                ret = nbd_co_send_structured_read(client, handle,
+                                                  offset + progress,
+                                                  data + progress, pnum,
+                                                  final, errp);
             }
-            ret = nbd_co_send_structured_read(client, handle, offset + progress,
-                                              data + progress, pnum, final,
-                                              errp);
         }
 
         if (ret < 0) {
@@ -2275,6 +2456,46 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
     }
 }
 
+/*
+ * Send a non-sparse reply to NBD_CMD_READ, with the data coming straight
+ * from the host file.  Return -ENOTSUP if nothing was sent because this is
+ * not possible, see nbd_co_send_iov_zero_copy().
+ */
+static coroutine_fn int nbd_co_send_read_zero_copy(NBDClient *client,
+                                                   NBDRequest *request,
+                                                   uint8_t *data, Error **errp)
+{
+    if (client->structured_reply) {
+        NBDStructuredReadData chunk;
+        struct iovec iov[] = {
+            {.iov_base = &chunk, .iov_len = sizeof(chunk)},
+        };
+
+        trace_nbd_co_send_structured_read_zero_copy(request->handle,
+                                                    request->from,
+                                                    request->len);
+        set_be_chunk(&chunk.h, NBD_REPLY_FLAG_DONE,
+                     NBD_REPLY_TYPE_OFFSET_DATA, request->handle,
+                     sizeof(chunk) - sizeof(chunk.h) + request->len);
+        stq_be_p(&chunk.offset, request->from);
+
+        return nbd_co_send_iov_zero_copy(client, iov, 1, request->from, data,
+                                         request->len, errp);
+    } else {
+        NBDSimpleReply reply;
+        struct iovec iov[] = {
+            {.iov_base = &reply, .iov_len = sizeof(reply)},
+        };
+
+        trace_nbd_co_send_simple_reply(request->handle, 0,
+                                       nbd_err_lookup(0), request->len);
+        set_be_simple_reply(&reply, 0, request->handle);
+
+        return nbd_co_send_iov_zero_copy(client, iov, 1, request->from, data,
+                                         request->len, errp);
+    }
+}
+
 /* Handle NBD_CMD_READ request.
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
@@ -2302,6 +2523,15 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    if (request->len &&
+        nbd_can_zero_copy(client, request->from, request->len))
+    {
+        ret = nbd_co_send_read_zero_copy(client, request, data, errp);
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+    }
+
     ret = blk_pread(exp->common.blk, request->from, data, request->len);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request->handle, ret,
@@ -48,6 +48,7 @@
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
@@ -83,6 +84,8 @@ enum {
     OPTION_MERGE = 274,
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
+    OPTION_RANDOM = 277,
+    OPTION_ZERO_DETECT_THREADS = 278,
 };
 
 typedef enum OutputFormat {
@@ -199,6 +202,9 @@ static void QEMU_NORETURN help(void)
            "  '--bitmaps' copies all top-level persistent bitmaps to destination\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
+           "  '--zero-detect-threads' specifies how many threads scan the copied data\n"
+           "       for zeroes (defaults to 1, which scans in the main thread). Reads and\n"
+           "       writes are still done in the main thread; it cannot exceed '-m'\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
@@ -1703,6 +1709,9 @@ typedef struct ImgConvertState {
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
+    long num_threads;
+    int running_threads;
+    CoQueue thread_queue;
     CoMutex lock;
     int ret;
 } ImgConvertState;
@@ -1974,6 +1983,46 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
     return 0;
 }
 
+typedef struct ConvertZeroData {
+    const uint8_t *buf;
+    size_t len;
+} ConvertZeroData;
+
+static int convert_buffer_is_zero_worker(void *opaque)
+{
+    ConvertZeroData *data = opaque;
+
+    return buffer_is_zero(data->buf, data->len);
+}
+
+/*
+ * Check in a worker thread whether @buf is all zeroes, so that scanning the
+ * buffers of several requests can use more than one host CPU.
+ */
+static bool coroutine_fn convert_co_buffer_is_zero(ImgConvertState *s,
+                                                   const uint8_t *buf,
+                                                   int nb_sectors)
+{
+    ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
+    ConvertZeroData data = {
+        .buf = buf,
+        .len = nb_sectors * BDRV_SECTOR_SIZE,
+    };
+    int ret;
+
+    while (s->running_threads >= s->num_threads) {
+        qemu_co_queue_wait(&s->thread_queue, NULL);
+    }
+    s->running_threads++;
+
+    ret = thread_pool_submit_co(pool, convert_buffer_is_zero_worker, &data);
+
+    s->running_threads--;
+    qemu_co_queue_next(&s->thread_queue);
+
+    return ret;
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -2040,6 +2089,22 @@ retry:
             memset(buf, 0x00, n * BDRV_SECTOR_SIZE);
         }
 
+        /*
+         * With several zero detection threads, look for zeroed buffers
+         * before waiting for our turn to write, otherwise in-order writes
+         * would serialize the scan as well.
+         * A zeroed buffer is treated like convert_co_write() would: whole
+         * for compressed targets, aligned for everything else.
+         */
+        if (s->num_threads > 1 && status == BLK_DATA && !copy_range &&
+            s->min_sparse && s->ret == -EINPROGRESS &&
+            (s->compressed ||
+             !((sector_num | (sector_num + n)) & (s->alignment - 1))) &&
+            convert_co_buffer_is_zero(s, buf, n))
+        {
+            status = BLK_ZERO;
+        }
+
         if (s->wr_in_order) {
             /* keep writes in order */
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
@@ -2131,6 +2196,7 @@ static int convert_do_copy(ImgConvertState *s)
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->thread_queue);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
@@ -2227,6 +2293,7 @@ static int img_convert(int argc, char **argv)
         .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
         .num_coroutines     = 8,
+        .num_threads        = 1,
     };
 
     for(;;) {
@@ -2239,6 +2306,8 @@ static int img_convert(int argc, char **argv)
             {"salvage", no_argument, 0, OPTION_SALVAGE},
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
+            {"zero-detect-threads", required_argument, 0,
+             OPTION_ZERO_DETECT_THREADS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:Cco:l:S:pt:T:qnm:WUr:",
@@ -2332,6 +2401,15 @@ static int img_convert(int argc, char **argv)
                 goto fail_getopt;
             }
             break;
+        case OPTION_ZERO_DETECT_THREADS:
+            if (qemu_strtol(optarg, NULL, 0, &s.num_threads) ||
+                s.num_threads < 1 || s.num_threads > MAX_COROUTINES) {
+                error_report("Invalid number of zero detection threads. Allowed"
+                             " number of threads is between 1 and %d",
+                             MAX_COROUTINES);
+                goto fail_getopt;
+            }
+            break;
         case 'W':
             s.wr_in_order = false;
             break;
@@ -2391,6 +2469,13 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    /* Each coroutine scans at most one buffer at a time */
+    if (s.num_threads > s.num_coroutines) {
+        error_report("Number of zero detection threads cannot exceed the "
+                     "number of coroutines (-m %ld)", s.num_coroutines);
+        goto fail_getopt;
+    }
+
     if (explict_min_sparse && s.copy_range) {
         error_report("Cannot enable copy offloading when -S is used");
         goto fail_getopt;
@@ -4319,12 +4404,31 @@ typedef struct BenchData {
     bool drain_on_flush;
     uint8_t *buf;
     QEMUIOVector *qiov;
+    GRand *rand;
+    uint64_t start_offset;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
 } BenchData;
 
+/*
+ * Pick a random request offset between the start offset and the end of the
+ * image, aligned to the step size.  The whole request must fit in the image,
+ * so the last possible offset is image_size - bufsize.
+ */
+static uint64_t bench_random_offset(BenchData *b)
+{
+    uint64_t nb_steps;
+    uint64_t r;
+
+    assert(b->start_offset + b->bufsize <= b->image_size);
+    nb_steps = (b->image_size - b->bufsize - b->start_offset) / b->step + 1;
+
+    r = ((uint64_t)g_rand_int(b->rand) << 32) | g_rand_int(b->rand);
+    return b->start_offset + (r % nb_steps) * b->step;
+}
+
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
     if (ret < 0) {
@@ -4384,8 +4488,12 @@ static void bench_cb(void *opaque, int ret)
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
+        if (b->rand) {
+            b->offset = bench_random_offset(b);
+        } else {
+            b->offset += b->step;
+            b->offset %= b->image_size;
+        }
         if (b->write) {
             acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
         } else {
@@ -4413,12 +4521,14 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    bool random = false;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double elapsed;
     int i;
     bool force_share = false;
     size_t buf_size;
@@ -4430,6 +4540,7 @@ static int img_bench(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
+            {"random", no_argument, 0, OPTION_RANDOM},
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
@@ -4561,6 +4672,9 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_RANDOM:
+            random = true;
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4595,6 +4709,12 @@ static int img_bench(int argc, char **argv)
         ret = image_size;
         goto out;
     }
+    if (random && offset + bufsize > image_size) {
+        error_report("Offset plus buffer size must not exceed the image size "
+                     "for random requests");
+        ret = -1;
+        goto out;
+    }
 
     data = (BenchData) {
         .blk            = blk,
@@ -4604,14 +4724,24 @@ static int img_bench(int argc, char **argv)
         .nrreq          = depth,
         .n              = count,
         .offset         = offset,
+        .start_offset   = offset,
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
+    if (random) {
+        /* Fixed seed, so that runs with different settings are comparable */
+        data.rand = g_rand_new_with_seed(0);
+        printf("Sending %d random %s requests, %d bytes each, %d in parallel "
+               "(offsets from %" PRId64 ", aligned to %d)\n",
+               data.n, data.write ? "write" : "read", data.bufsize,
+               data.nrreq, data.offset, data.step);
+    } else {
+        printf("Sending %d %s requests, %d bytes each, %d in parallel "
+               "(starting at offset %" PRId64 ", step size %d)\n",
+               data.n, data.write ? "write" : "read", data.bufsize,
+               data.nrreq, data.offset, data.step);
+    }
     if (flush_interval) {
         printf("Sending flush every %d requests\n", flush_interval);
     }
@@ -4637,11 +4767,18 @@ static int img_bench(int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    elapsed = (t2.tv_sec - t1.tv_sec)
+              + ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+    printf("Run completed in %3.3f seconds.\n", elapsed);
+    if (count > 0) {
+        printf("%.3f us per request, %.0f requests per second.\n",
+               elapsed * 1000000 / count, count / elapsed);
+    }
 
 out:
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
     if (data.buf) {
         blk_unregister_buf(blk, data.buf);
     }
@@ -1079,6 +1079,8 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .has_multi_conn       = true,
+            .multi_conn           = readonly || shared > 1,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
@@ -115,7 +115,10 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-jmp-cache-ways=n (TCG jump cache associativity)\n"
+    "                tier-up-threshold=n (enable tiered TCG translation)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -140,9 +143,38 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``dirty-ring-size=n``
+        When the KVM accelerator is used, enables dirty page tracking
+        through per-vCPU dirty rings of n entries instead of the dirty
+        bitmaps (default=0, disabled).  n must be a power of two, at
+        least 1024 and not above the maximum supported by the kernel;
+        4096 is a good starting point.  Dirty pages are harvested from
+        the rings periodically by a reaper thread, and a vCPU whose ring
+        fills up only harvests its own ring, without stopping the other
+        vCPUs.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-jmp-cache-ways=n``
+        Controls the associativity of the per-vCPU cache used to find the
+        translation block for a guest address, which can be 1 (the
+        default), 2, 4 or 8.  The total number of entries does not
+        change; a higher associativity reduces conflict misses for guests
+        with a large number of hot translation blocks, at a small cost
+        for each lookup.  Hit and miss counts are shown by ``info jit``.
+
+    ``tier-up-threshold=n``
+        Enables tiered translation when n is not zero (the default is 0,
+        disabled); otherwise n must be between 2 and 1000000.  Translation
+        blocks are first generated without the TCG optimizer and count
+        their executions; after n executions a block is translated again
+        with full optimization, plus the forwarding of stores to the CPU
+        state to later loads of the same field.  This reduces the time
+        spent translating code that only runs a few times, such as most
+        of the firmware and kernel boot code.  Tiered translation is not
+        used with ``-icount``.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -4098,6 +4130,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4117,6 +4151,10 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a file previously written by
+    migrating to ``file:filename``.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -5086,7 +5124,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,poll-percentile=percentile,io-uring-sqpoll=on|off,io-uring-sqpoll-cpu=cpu``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5122,6 +5160,16 @@ SRST
         the polling time when the algorithm detects it is spending too
         long polling without encountering events.
 
+        The ``poll-percentile`` parameter replaces ``poll-grow`` and
+        ``poll-shrink`` with an algorithm that keeps a histogram of the
+        time between events for each polled file descriptor, such as a
+        virtqueue. The polling time is chosen so that the given
+        percentile (1-100) of events on the busiest file descriptor
+        arrive while polling, as long as that fits in ``poll-max-ns``.
+        The histograms and the time spent polling are reported by
+        ``query-iothreads``. The default of 0 uses ``poll-grow`` and
+        ``poll-shrink``.
+
         The polling parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
@@ -5129,6 +5177,16 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+        The ``io-uring-sqpoll`` parameter makes block devices using
+        ``aio=io_uring`` in this IOThread submit requests through a
+        submission queue that a kernel thread polls
+        (``IORING_SETUP_SQPOLL``). Requests are then submitted without a
+        system call while the kernel thread is busy. The kernel thread
+        goes to sleep when it has been idle for a while; how often it had
+        to be woken up is reported by ``query-iothreads``. The
+        ``io-uring-sqpoll-cpu`` parameter binds the kernel thread to a
+        host CPU. Neither parameter can be changed at run-time.
 ERST
 
 
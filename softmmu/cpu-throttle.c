@@ -33,25 +33,38 @@
 /* vcpu throttling controls */
 static QEMUTimer *throttle_timer;
 static unsigned int throttle_percentage;
+/* Period of throttle_timer, set at each tick; protected by the BQL */
+static int64_t throttle_period_ns;
 
 #define CPU_THROTTLE_PCT_MIN 1
 #define CPU_THROTTLE_PCT_MAX 99
 #define CPU_THROTTLE_TIMESLICE_NS 10000000
 
+/* The throttle percentage of @cpu, taking all vcpus' throttling into account */
+static int cpu_throttle_effective_percentage(CPUState *cpu)
+{
+    return MAX(cpu_throttle_get_percentage(),
+               cpu_throttle_get_vcpu_percentage(cpu));
+}
+
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
     double pct;
-    double throttle_ratio;
     int64_t sleeptime_ns, endtime_ns;
 
-    if (!cpu_throttle_get_percentage()) {
+    if (!cpu_throttle_effective_percentage(cpu)) {
+        qatomic_set(&cpu->throttle_thread_scheduled, 0);
         return;
     }
 
-    pct = (double)cpu_throttle_get_percentage() / 100;
-    throttle_ratio = pct / (1 - pct);
+    /*
+     * The vcpu sleeps for its share of the timer period, and runs for the
+     * rest of it.  With a single percentage for all vcpus, this gives a
+     * CPU_THROTTLE_TIMESLICE_NS run time.
+     */
+    pct = (double)cpu_throttle_effective_percentage(cpu) / 100;
     /* Add 1ns to fix double's rounding error (like 0.9999999...) */
-    sleeptime_ns = (int64_t)(throttle_ratio * CPU_THROTTLE_TIMESLICE_NS + 1);
+    sleeptime_ns = (int64_t)(pct * throttle_period_ns + 1);
     endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
     while (sleeptime_ns > 0 && !cpu->stop) {
         if (sleeptime_ns > SCALE_MS) {
@@ -70,22 +83,31 @@ static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 static void cpu_throttle_timer_tick(void *opaque)
 {
     CPUState *cpu;
+    int max_pct = 0;
     double pct;
 
+    CPU_FOREACH(cpu) {
+        max_pct = MAX(max_pct, cpu_throttle_effective_percentage(cpu));
+    }
+
     /* Stop the timer if needed */
-    if (!cpu_throttle_get_percentage()) {
+    if (!max_pct) {
         return;
     }
+
+    pct = (double)max_pct / 100;
+    throttle_period_ns = CPU_THROTTLE_TIMESLICE_NS / (1 - pct);
+
     CPU_FOREACH(cpu) {
-        if (!qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
+        if (cpu_throttle_effective_percentage(cpu) &&
+            !qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
             async_run_on_cpu(cpu, cpu_throttle_thread,
                              RUN_ON_CPU_NULL);
         }
     }
 
-    pct = (double)cpu_throttle_get_percentage() / 100;
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
-                                   CPU_THROTTLE_TIMESLICE_NS / (1 - pct));
+                                   throttle_period_ns);
 }
 
 void cpu_throttle_set(int new_throttle_pct)
@@ -115,6 +137,27 @@ int cpu_throttle_get_percentage(void)
     return qatomic_read(&throttle_percentage);
 }
 
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct)
+{
+    /* Ensure throttle percentage is within valid range */
+    if (new_throttle_pct) {
+        new_throttle_pct = MIN(new_throttle_pct, CPU_THROTTLE_PCT_MAX);
+        new_throttle_pct = MAX(new_throttle_pct, CPU_THROTTLE_PCT_MIN);
+    }
+
+    qatomic_set(&cpu->throttle_percentage, new_throttle_pct);
+
+    if (new_throttle_pct && !timer_pending(throttle_timer)) {
+        timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                           CPU_THROTTLE_TIMESLICE_NS);
+    }
+}
+
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu)
+{
+    return qatomic_read(&cpu->throttle_percentage);
+}
+
 void cpu_throttle_init(void)
 {
     throttle_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
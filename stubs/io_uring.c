@@ -21,7 +21,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
     abort();
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp)
 {
     abort();
 }
@@ -30,3 +30,8 @@ void luring_cleanup(LuringState *s)
 {
     abort();
 }
+
+uint64_t luring_get_sqpoll_wakeups(LuringState *s)
+{
+    abort();
+}
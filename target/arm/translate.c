@@ -91,6 +91,10 @@ void arm_translate_init(void)
     cpu_NF = tcg_global_mem_new_i32(cpu_env, offsetof(CPUARMState, NF), "NF");
     cpu_VF = tcg_global_mem_new_i32(cpu_env, offsetof(CPUARMState, VF), "VF");
     cpu_ZF = tcg_global_mem_new_i32(cpu_env, offsetof(CPUARMState, ZF), "ZF");
+    tcg_global_mark_cc_i32(cpu_CF);
+    tcg_global_mark_cc_i32(cpu_NF);
+    tcg_global_mark_cc_i32(cpu_VF);
+    tcg_global_mark_cc_i32(cpu_ZF);
 
     cpu_exclusive_addr = tcg_global_mem_new_i64(cpu_env,
         offsetof(CPUARMState, exclusive_addr), "exclusive_addr");
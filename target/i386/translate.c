@@ -8425,6 +8425,10 @@ void tcg_x86_init(void)
                                     "cc_src");
     cpu_cc_src2 = tcg_global_mem_new(cpu_env, offsetof(CPUX86State, cc_src2),
                                      "cc_src2");
+    tcg_global_mark_cc_i32(cpu_cc_op);
+    tcg_global_mark_cc_tl(cpu_cc_dst);
+    tcg_global_mark_cc_tl(cpu_cc_src);
+    tcg_global_mark_cc_tl(cpu_cc_src2);
 
     for (i = 0; i < CPU_NB_REGS; ++i) {
         cpu_regs[i] = tcg_global_mem_new(cpu_env,
@@ -111,6 +111,28 @@ static void init_arg_info(struct tcg_temp_info *infos,
     init_ts_info(infos, temps_used, arg_temp(arg));
 }
 
+/*
+ * The fall-through path of a conditional branch has no other predecessor,
+ * and globals and local temps keep their value across the branch; only
+ * ordinary temps die.  Forget about those, but keep what we know about
+ * the others, so that constants and copies of guest registers propagate
+ * through the whole extended basic block.  Nothing is carried across the
+ * end of the TB, because a chained TB can be entered from any of its
+ * predecessors and from the main loop.
+ */
+static void reset_temps_cond_branch(TCGContext *s, TCGTempSet *temps_used)
+{
+    int i;
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (!ts->temp_local && test_bit(i, temps_used->l)) {
+            reset_ts(ts);
+        }
+    }
+}
+
 static TCGTemp *find_better_copy(TCGContext *s, TCGTemp *ts)
 {
     TCGTemp *i;
@@ -1348,7 +1370,7 @@ void tcg_optimize(TCGContext *s)
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                bitmap_zero(temps_used.l, nb_temps);
+                reset_temps_cond_branch(s, &temps_used);
                 op->opc = INDEX_op_brcond_i32;
                 op->args[0] = op->args[1];
                 op->args[1] = op->args[3];
@@ -1374,7 +1396,7 @@ void tcg_optimize(TCGContext *s)
                     goto do_default;
                 }
             do_brcond_low:
-                bitmap_zero(temps_used.l, nb_temps);
+                reset_temps_cond_branch(s, &temps_used);
                 op->opc = INDEX_op_brcond_i32;
                 op->args[1] = op->args[2];
                 op->args[2] = op->args[4];
@@ -1491,9 +1513,12 @@ void tcg_optimize(TCGContext *s)
             /* Default case: we know nothing about operation (or were unable
                to compute the operation result) so no propagation is done.
                We trash everything if the operation is the end of a basic
-               block, otherwise we only trash the output args.  "mask" is
+               block, except for what survives a conditional branch,
+               otherwise we only trash the output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                reset_temps_cond_branch(s, &temps_used);
+            } else if (def->flags & TCG_OPF_BB_END) {
                 bitmap_zero(temps_used.l, nb_temps);
             } else {
         do_reset_output:
@@ -1548,3 +1573,175 @@ void tcg_optimize(TCGContext *s)
         }
     }
 }
+
+/* Fields of the CPU state whose value is known to be in a temp.  */
+#define MAX_ENV_SLOTS 16
+
+typedef struct EnvSlot {
+    intptr_t ofs;
+    TCGType type;
+    TCGTemp *val;
+} EnvSlot;
+
+typedef struct EnvSlots {
+    int nb;
+    EnvSlot slot[MAX_ENV_SLOTS];
+} EnvSlots;
+
+static EnvSlot *env_slot_find(EnvSlots *e, intptr_t ofs, TCGType type)
+{
+    int i;
+
+    for (i = 0; i < e->nb; i++) {
+        if (e->slot[i].ofs == ofs && e->slot[i].type == type) {
+            return &e->slot[i];
+        }
+    }
+    return NULL;
+}
+
+static void env_slot_add(EnvSlots *e, intptr_t ofs, TCGType type,
+                         TCGTemp *val)
+{
+    /* When full, forget the oldest one.  */
+    if (e->nb == MAX_ENV_SLOTS) {
+        memmove(&e->slot[0], &e->slot[1], sizeof(EnvSlot) * --e->nb);
+    }
+    e->slot[e->nb++] = (EnvSlot) { .ofs = ofs, .type = type, .val = val };
+}
+
+/* Forget the fields overlapping a store of @size bytes at @ofs.  */
+static void env_slot_clobber(EnvSlots *e, intptr_t ofs, intptr_t size)
+{
+    int i = 0;
+
+    while (i < e->nb) {
+        EnvSlot *slot = &e->slot[i];
+        intptr_t slot_size = slot->type == TCG_TYPE_I32 ? 4 : 8;
+
+        if (slot->ofs < ofs + size && ofs < slot->ofs + slot_size) {
+            *slot = e->slot[--e->nb];
+        } else {
+            i++;
+        }
+    }
+}
+
+/* Forget the fields whose value was in @ts, which is being written.  */
+static void env_slot_kill(EnvSlots *e, TCGTemp *ts)
+{
+    int i = 0;
+
+    while (i < e->nb) {
+        if (e->slot[i].val == ts) {
+            e->slot[i] = e->slot[--e->nb];
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * Forward values stored to the CPU state to later loads of the same
+ * field, and replace loads of a field that is already in a temp with a
+ * move.  tcg_optimize() then propagates the value further.  Stores are
+ * all kept, so the CPU state is the same if an exception is raised, and
+ * the analysis does not cross basic blocks or helper calls, which may
+ * access the CPU state.  Stores through pointers other than env might
+ * point into it too, so they make us forget everything.
+ *
+ * This is only run on hot TBs when tiered translation is enabled.
+ */
+void tcg_optimize_env(TCGContext *s)
+{
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    EnvSlots e = { .nb = 0 };
+    TCGOp *op;
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        TCGType type = TCG_TYPE_I32;
+        intptr_t size = 0;
+        int i;
+
+        switch (opc) {
+        case INDEX_op_ld_i64:
+            type = TCG_TYPE_I64;
+            /* fall through */
+        case INDEX_op_ld_i32:
+            if (arg_temp(op->args[1]) == env) {
+                TCGTemp *ret = arg_temp(op->args[0]);
+                intptr_t ofs = op->args[2];
+                EnvSlot *slot = env_slot_find(&e, ofs, type);
+
+                if (slot) {
+                    op->opc = (type == TCG_TYPE_I32
+                               ? INDEX_op_mov_i32 : INDEX_op_mov_i64);
+                    op->args[1] = temp_arg(slot->val);
+                }
+                env_slot_kill(&e, ret);
+                if (!env_slot_find(&e, ofs, type)) {
+                    env_slot_add(&e, ofs, type, ret);
+                }
+                continue;
+            }
+            break;
+
+        case INDEX_op_st_i64:
+            type = TCG_TYPE_I64;
+            /* fall through */
+        case INDEX_op_st_i32:
+            if (arg_temp(op->args[1]) == env) {
+                intptr_t ofs = op->args[2];
+
+                env_slot_clobber(&e, ofs, type == TCG_TYPE_I32 ? 4 : 8);
+                env_slot_add(&e, ofs, type, arg_temp(op->args[0]));
+                continue;
+            }
+            size = -1;
+            break;
+
+        CASE_OP_32_64(st8):
+            size = 1;
+            break;
+        CASE_OP_32_64(st16):
+            size = 2;
+            break;
+        case INDEX_op_st32_i64:
+            size = 4;
+            break;
+        case INDEX_op_st_vec:
+            size = 8 << TCGOP_VECL(op);
+            break;
+
+        case INDEX_op_call:
+            e.nb = 0;
+            continue;
+
+        default:
+            break;
+        }
+
+        if (size) {
+            if (size > 0 && arg_temp(op->args[1]) == env) {
+                env_slot_clobber(&e, op->args[2], size);
+            } else {
+                e.nb = 0;
+            }
+        }
+        if (def->flags & TCG_OPF_BB_END) {
+            e.nb = 0;
+        }
+        for (i = 0; i < def->nb_oargs; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+
+            env_slot_kill(&e, ts);
+            /* Globals live in the CPU state too.  */
+            if (ts->temp_global && ts->mem_base == env) {
+                env_slot_clobber(&e, ts->mem_offset,
+                                 ts->type == TCG_TYPE_I32 ? 4 : 8);
+            }
+        }
+    }
+}
@@ -868,6 +868,20 @@ size_t tcg_tb_phys_invalidate_count(void)
     return total;
 }
 
+size_t tcg_cc_ops_eliminated(void)
+{
+    unsigned int n_ctxs = qatomic_read(&n_tcg_ctxs);
+    unsigned int i;
+    size_t total = 0;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        total += qatomic_read(&s->cc_ops_eliminated);
+    }
+    return total;
+}
+
 /* pool based memory allocation */
 void *tcg_malloc_internal(TCGContext *s, int size)
 {
@@ -1250,6 +1264,25 @@ TCGTemp *tcg_global_mem_new_internal(TCGType type, TCGv_ptr base,
     return ts;
 }
 
+/*
+ * Front ends call this for the globals that hold condition codes.  The
+ * liveness pass tracks them across the basic blocks of a TB instead of
+ * assuming that they are needed at every label and branch, so that flags
+ * overwritten before anything reads them are not computed at all.
+ */
+void tcg_global_mark_cc(TCGTemp *ts)
+{
+    TCGContext *s = tcg_ctx;
+    int n = ts->base_type != ts->type ? 2 : 1;
+    int i;
+
+    tcg_debug_assert(ts->temp_global && !ts->indirect_reg);
+    tcg_debug_assert(s->nb_cc_globals + n <= TCG_MAX_CC_GLOBALS);
+    for (i = 0; i < n; i++) {
+        s->cc_globals[s->nb_cc_globals++] = temp_idx(ts + i);
+    }
+}
+
 TCGTemp *tcg_temp_new_internal(TCGType type, bool temp_local)
 {
     TCGContext *s = tcg_ctx;
@@ -2333,6 +2366,8 @@ void tcg_op_remove(TCGContext *s, TCGOp *op)
 
 #ifdef CONFIG_PROFILER
     qatomic_set(&s->prof.del_op_count, s->prof.del_op_count + 1);
+    qatomic_set(&s->prof.table_del_op_count[op->opc],
+                s->prof.table_del_op_count[op->opc] + 1);
 #endif
 }
 
@@ -2575,6 +2610,64 @@ static void la_cross_call(TCGContext *s, int nt)
     }
 }
 
+/*
+ * liveness analysis: return the set of condition code globals, as
+ * indices into s->cc_globals, that the following code needs.
+ */
+static unsigned la_cc_live(TCGContext *s)
+{
+    unsigned live = 0;
+    int i;
+
+    for (i = 0; i < s->nb_cc_globals; i++) {
+        if (s->temps[s->cc_globals[i]].state != TS_DEAD) {
+            live |= 1u << i;
+        }
+    }
+    return live;
+}
+
+/*
+ * liveness analysis: end of basic block, after la_bb_end() or la_bb_sync().
+ * The condition code globals that are not in @live are overwritten before
+ * anything reads them on every path, so they need not be saved.  Mark them
+ * dead again and return them.
+ */
+static unsigned la_cc_kill(TCGContext *s, unsigned live)
+{
+    unsigned killed = 0;
+    int i;
+
+    for (i = 0; i < s->nb_cc_globals; i++) {
+        if (!(live & (1u << i))) {
+            TCGTemp *ts = &s->temps[s->cc_globals[i]];
+
+            ts->state = TS_DEAD;
+            la_reset_pref(ts);
+            killed |= 1u << i;
+        }
+    }
+    return killed;
+}
+
+/* liveness analysis: the condition code globals among some op args.  */
+static unsigned la_cc_args(TCGContext *s, TCGOp *op, int start, int n)
+{
+    unsigned found = 0;
+    int i, j;
+
+    for (i = start; i < start + n; i++) {
+        TCGTemp *ts = arg_temp(op->args[i]);
+
+        for (j = 0; ts && j < s->nb_cc_globals; j++) {
+            if (ts == &s->temps[s->cc_globals[j]]) {
+                found |= 1u << j;
+            }
+        }
+    }
+    return found;
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -2582,6 +2675,12 @@ static void liveness_pass_1(TCGContext *s)
 {
     int nb_globals = s->nb_globals;
     int nb_temps = s->nb_temps;
+    unsigned cc_all = (1u << s->nb_cc_globals) - 1;
+    /* Per label, the condition codes needed after it, or -1 if unknown.  */
+    int *cc_label_live = NULL;
+    /* Condition codes that are dead only thanks to cc_label_live.  */
+    unsigned cc_killed = 0;
+    size_t cc_removed = 0;
     TCGOp *op, *op_prev;
     TCGRegSet *prefs;
     int i;
@@ -2590,6 +2689,10 @@ static void liveness_pass_1(TCGContext *s)
     for (i = 0; i < nb_temps; ++i) {
         s->temps[i].state_ptr = prefs + i;
     }
+    if (s->nb_cc_globals) {
+        cc_label_live = tcg_malloc(sizeof(int) * s->nb_labels);
+        memset(cc_label_live, -1, sizeof(int) * s->nb_labels);
+    }
 
     /* ??? Should be redundant with the exit_tb that ends the TB.  */
     la_func_end(s, nb_globals, nb_temps);
@@ -2626,6 +2729,9 @@ static void liveness_pass_1(TCGContext *s)
             do_not_remove_call:
 
                 /* Output args are dead.  */
+                if (cc_killed) {
+                    cc_killed &= ~la_cc_args(s, op, 0, nb_oargs);
+                }
                 for (i = 0; i < nb_oargs; i++) {
                     ts = arg_temp(op->args[i]);
                     if (ts->state & TS_DEAD) {
@@ -2695,6 +2801,9 @@ static void liveness_pass_1(TCGContext *s)
             ts = arg_temp(op->args[0]);
             ts->state = TS_DEAD;
             la_reset_pref(ts);
+            if (cc_killed) {
+                cc_killed &= ~la_cc_args(s, op, 0, 1);
+            }
             break;
 
         case INDEX_op_add2_i32:
@@ -2794,10 +2903,22 @@ static void liveness_pass_1(TCGContext *s)
             goto do_not_remove;
 
         do_remove:
+            if (cc_killed) {
+                unsigned cc = la_cc_args(s, op, 0, nb_oargs);
+
+                /* Without cc_label_live the outputs would be synced.  */
+                if (cc & cc_killed) {
+                    cc_removed++;
+                }
+                cc_killed &= ~cc;
+            }
             tcg_op_remove(s, op);
             break;
 
         do_not_remove:
+            if (cc_killed) {
+                cc_killed &= ~la_cc_args(s, op, 0, nb_oargs);
+            }
             for (i = 0; i < nb_oargs; i++) {
                 ts = arg_temp(op->args[i]);
 
@@ -2818,10 +2939,32 @@ static void liveness_pass_1(TCGContext *s)
             /* If end of basic block, update.  */
             if (def->flags & TCG_OPF_BB_EXIT) {
                 la_func_end(s, nb_globals, nb_temps);
+                cc_killed = 0;
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Needed on the fall-through path or at the target.  */
+                unsigned cc_live = la_cc_live(s);
+
                 la_bb_sync(s, nb_globals, nb_temps);
+                if (cc_all) {
+                    TCGLabel *l = arg_label(op->args[def->nb_oargs +
+                                                     def->nb_iargs +
+                                                     def->nb_cargs - 1]);
+
+                    cc_live |= cc_label_live[l->id];
+                    cc_killed = la_cc_kill(s, cc_live);
+                }
             } else if (def->flags & TCG_OPF_BB_END) {
+                unsigned cc_live = cc_all;
+
+                if (cc_all && opc == INDEX_op_set_label) {
+                    cc_live = la_cc_live(s);
+                    cc_label_live[arg_label(op->args[0])->id] = cc_live;
+                } else if (cc_all && opc == INDEX_op_br) {
+                    /* A backward branch finds -1, i.e. everything.  */
+                    cc_live = cc_label_live[arg_label(op->args[0])->id];
+                }
                 la_bb_end(s, nb_globals, nb_temps);
+                cc_killed = la_cc_kill(s, cc_live);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                 la_global_sync(s, nb_globals);
                 if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -2886,6 +3029,10 @@ static void liveness_pass_1(TCGContext *s)
         }
         op->life = arg_life;
     }
+
+    if (cc_removed) {
+        qatomic_set(&s->cc_ops_eliminated, s->cc_ops_eliminated + cc_removed);
+    }
 }
 
 /* Liveness analysis: Convert indirect regs to direct temporaries.  */
@@ -4050,6 +4197,7 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
 
             for (i = 0; i < NB_OPS; i++) {
                 PROF_ADD(prof, orig, table_op_count[i]);
+                PROF_ADD(prof, orig, table_del_op_count[i]);
             }
         }
     }
@@ -4075,8 +4223,9 @@ void tcg_dump_op_count(void)
 
     tcg_profile_snapshot_table(&prof);
     for (i = 0; i < NB_OPS; i++) {
-        qemu_printf("%s %" PRId64 "\n", tcg_op_defs[i].name,
-                    prof.table_op_count[i]);
+        qemu_printf("%s %" PRId64 " (%" PRId64 " eliminated)\n",
+                    tcg_op_defs[i].name, prof.table_op_count[i],
+                    prof.table_del_op_count[i]);
     }
 }
 
@@ -4169,7 +4318,14 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
-    tcg_optimize(s);
+    /* Tier 0 TBs trade code quality for translation speed */
+    if (!(tb_cflags(tb) & CF_TIER0)) {
+        /* With tiered translation, the others are hot: spend more time */
+        if (tcg_tier_up_threshold) {
+            tcg_optimize_env(s);
+        }
+        tcg_optimize(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
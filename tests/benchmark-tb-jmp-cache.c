@@ -0,0 +1,182 @@
+/*
+ * TB jump cache associativity benchmark
+ *
+ * Replays a synthetic guest control flow trace against a model of the
+ * per-vCPU jump cache, backed by a QHT like tb_htable_lookup(), and
+ * reports the miss rate and the average lookup cost for each
+ * associativity.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/qht.h"
+#include "qemu/xxhash.h"
+#include "exec/tb-jmp-cache.h"
+
+/* Same geometry and hash as include/exec/tb-hash.h for 4k target pages */
+#define PAGE_BITS 12
+#define CACHE_BITS 12
+#define CACHE_SIZE (1 << CACHE_BITS)
+#define PAGE_HASH_BITS (CACHE_BITS / 2)
+#define ADDR_MASK ((1 << PAGE_HASH_BITS) - 1)
+#define PAGE_MASK (CACHE_SIZE - (1 << PAGE_HASH_BITS))
+
+#define TRACE_LEN (1 << 22)
+
+/* Stand-in for the real thing, only the guest PC matters here */
+struct TranslationBlock {
+    uint64_t pc;
+};
+typedef struct TranslationBlock TranslationBlock;
+
+typedef struct BenchOpts {
+    const char *name;
+    size_t nr_tbs;      /* distinct TBs in the working set */
+    size_t nr_funcs;    /* TBs are grouped in functions run as a whole */
+} BenchOpts;
+
+static struct qht htable;
+static TranslationBlock *tbs;
+static size_t *trace;
+
+static unsigned int hash_func(uint64_t pc)
+{
+    uint64_t tmp = pc ^ (pc >> (PAGE_BITS - PAGE_HASH_BITS));
+
+    return ((tmp >> (PAGE_BITS - PAGE_HASH_BITS)) & PAGE_MASK) |
+           (tmp & ADDR_MASK);
+}
+
+static bool tb_cmp(const void *ap, const void *bp)
+{
+    const TranslationBlock *a = ap;
+    const TranslationBlock *b = bp;
+
+    return a->pc == b->pc;
+}
+
+static bool tb_lookup_cmp(const void *p, const void *userp)
+{
+    const TranslationBlock *tb = p;
+
+    return tb->pc == *(const uint64_t *)userp;
+}
+
+/*
+ * Lay out TBs in a "kernel" and a "user" region, a few dozen bytes apart
+ * within functions, and build a trace that mostly runs a skewed selection
+ * of the functions, each from its first to its last TB.
+ */
+static void build_workload(const BenchOpts *opts)
+{
+    size_t tbs_per_func = opts->nr_tbs / opts->nr_funcs;
+    uint64_t pc;
+    size_t i, j, n;
+
+    tbs = g_new(TranslationBlock, opts->nr_tbs);
+    for (i = 0; i < opts->nr_funcs; i++) {
+        pc = (i & 1 ? 0xffffffff81000000ULL : 0x400000ULL) +
+             g_test_rand_int_range(0, 1 << 26);
+        for (j = 0; j < tbs_per_func; j++) {
+            tbs[i * tbs_per_func + j].pc = pc;
+            pc += g_test_rand_int_range(4, 64);
+        }
+    }
+
+    qht_init(&htable, tb_cmp, opts->nr_tbs, QHT_MODE_AUTO_RESIZE);
+    for (i = 0; i < opts->nr_funcs * tbs_per_func; i++) {
+        qht_insert(&htable, &tbs[i], qemu_xxhash2(tbs[i].pc), NULL);
+    }
+
+    trace = g_new(size_t, TRACE_LEN);
+    for (n = 0; n < TRACE_LEN; ) {
+        /* square the random number to favour the first functions */
+        double r = g_test_rand_double();
+        size_t func = (size_t)(r * r * opts->nr_funcs);
+
+        for (j = 0; j < tbs_per_func && n < TRACE_LEN; j++) {
+            trace[n++] = func * tbs_per_func + j;
+        }
+    }
+}
+
+static void free_workload(void)
+{
+    qht_destroy(&htable);
+    g_free(tbs);
+    g_free(trace);
+}
+
+static void run_trace(unsigned int ways)
+{
+    TranslationBlock **cache = g_new0(TranslationBlock *, CACHE_SIZE);
+    uint64_t misses = 0;
+    double elapsed;
+    size_t n;
+
+    g_test_timer_start();
+    for (n = 0; n < TRACE_LEN; n++) {
+        uint64_t pc = tbs[trace[n]].pc;
+        unsigned int set = hash_func(pc) & ~(ways - 1);
+        TranslationBlock *tb;
+        unsigned int way;
+
+        for (way = 0; way < ways; way++) {
+            tb = qatomic_read(&cache[set + way]);
+            if (tb && tb->pc == pc) {
+                if (way) {
+                    tb_jmp_cache_promote(&cache[set], way, tb);
+                }
+                break;
+            }
+        }
+        if (way == ways) {
+            misses++;
+            tb = qht_lookup_custom(&htable, &pc, qemu_xxhash2(pc),
+                                   tb_lookup_cmp);
+            g_assert(tb);
+            tb_jmp_cache_promote(&cache[set], ways - 1, tb);
+        }
+    }
+    elapsed = g_test_timer_elapsed();
+
+    g_test_message("%u-way: miss rate %.2f%%, %.1f ns per lookup", ways,
+                   misses * 100.0 / TRACE_LEN, elapsed * 1e9 / TRACE_LEN);
+    g_free(cache);
+}
+
+static void test_jmp_cache(const void *opaque)
+{
+    const BenchOpts *opts = opaque;
+    unsigned int ways;
+
+    build_workload(opts);
+    for (ways = 1; ways <= TB_JMP_CACHE_MAX_WAYS; ways *= 2) {
+        run_trace(ways);
+    }
+    free_workload();
+}
+
+static const BenchOpts bench_opts[] = {
+    { .name = "small", .nr_tbs = 1024, .nr_funcs = 64 },
+    { .name = "medium", .nr_tbs = 4096, .nr_funcs = 256 },
+    { .name = "large", .nr_tbs = 32768, .nr_funcs = 2048 },
+};
+
+int main(int argc, char **argv)
+{
+    char *name;
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(bench_opts); i++) {
+        name = g_strdup_printf("/tb-jmp-cache/benchmark/%s",
+                               bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_jmp_cache);
+        g_free(name);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,162 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE 4096
+#define NR_PAGES 256
+
+typedef enum {
+    XBZRLE_BENCH_SPARSE,    /* a few isolated words changed per page */
+    XBZRLE_BENCH_CLUSTERED, /* a few longer runs changed per page */
+    XBZRLE_BENCH_UNCHANGED, /* page written with the same content */
+    XBZRLE_BENCH_OVERFLOW,  /* every other byte changed, encoding fails */
+} XbzrleBenchPattern;
+
+typedef struct XbzrleBenchOpts {
+    const char *name;
+    XbzrleBenchPattern pattern;
+} XbzrleBenchOpts;
+
+static void dirty_page(uint8_t *page, XbzrleBenchPattern pattern)
+{
+    int i, j;
+
+    switch (pattern) {
+    case XBZRLE_BENCH_SPARSE:
+        for (i = 0; i < 8; i++) {
+            j = g_test_rand_int_range(0, PAGE_SIZE / 8) * 8;
+            *(uint64_t *)(page + j) += 1;
+        }
+        break;
+    case XBZRLE_BENCH_CLUSTERED:
+        for (i = 0; i < 4; i++) {
+            int start = g_test_rand_int_range(0, PAGE_SIZE - 256);
+            int len = g_test_rand_int_range(16, 256);
+
+            for (j = start; j < start + len; j++) {
+                page[j] ^= 0x5a;
+            }
+        }
+        break;
+    case XBZRLE_BENCH_UNCHANGED:
+        break;
+    case XBZRLE_BENCH_OVERFLOW:
+        for (j = 0; j < PAGE_SIZE; j += 2) {
+            page[j] ^= 0xff;
+        }
+        break;
+    }
+}
+
+static void test_xbzrle_speed(const void *opaque)
+{
+    const XbzrleBenchOpts *opts = opaque;
+    uint8_t *old_buf = g_malloc(NR_PAGES * PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(NR_PAGES * PAGE_SIZE);
+    uint8_t *encoded = g_malloc(NR_PAGES * PAGE_SIZE);
+    int *encoded_len = g_new(int, NR_PAGES);
+    const size_t total = 1 * GiB;
+    size_t done;
+    double encode_time, decode_time;
+    int i, decoded;
+
+    for (i = 0; i < NR_PAGES * PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, NR_PAGES * PAGE_SIZE);
+    for (i = 0; i < NR_PAGES; i++) {
+        dirty_page(new_buf + i * PAGE_SIZE, opts->pattern);
+    }
+
+    do {
+        g_test_timer_start();
+        for (done = 0; done < total; done += NR_PAGES * PAGE_SIZE) {
+            for (i = 0; i < NR_PAGES; i++) {
+                encoded_len[i] = xbzrle_encode_buffer(old_buf + i * PAGE_SIZE,
+                                                      new_buf + i * PAGE_SIZE,
+                                                      PAGE_SIZE,
+                                                      encoded + i * PAGE_SIZE,
+                                                      PAGE_SIZE);
+            }
+        }
+        encode_time = g_test_timer_elapsed();
+
+        decoded = 0;
+        g_test_timer_start();
+        for (done = 0; done < total; done += NR_PAGES * PAGE_SIZE) {
+            for (i = 0; i < NR_PAGES; i++) {
+                if (encoded_len[i] > 0) {
+                    xbzrle_decode_buffer(encoded + i * PAGE_SIZE,
+                                         encoded_len[i],
+                                         old_buf + i * PAGE_SIZE, PAGE_SIZE);
+                    decoded++;
+                }
+            }
+        }
+        decode_time = g_test_timer_elapsed();
+
+        if (decoded) {
+            g_test_message("xbzrle(%s): encode %.2f GB/sec "
+                           "decode %.2f GB/sec (%d bytes per page)",
+                           opts->name, total / encode_time / GiB,
+                           (double)decoded * PAGE_SIZE / decode_time / GiB,
+                           encoded_len[0]);
+        } else if (encoded_len[0] < 0) {
+            /*
+             * Migration sends these pages as they are, so the receiver
+             * never decodes anything.
+             */
+            g_test_message("xbzrle(%s): encode %.2f GB/sec decode n/a "
+                           "(encoding overflowed, pages are sent raw)",
+                           opts->name, total / encode_time / GiB);
+        } else {
+            g_test_message("xbzrle(%s): encode %.2f GB/sec decode n/a "
+                           "(pages unchanged, nothing is sent)",
+                           opts->name, total / encode_time / GiB);
+        }
+
+        /* Decoding brought old_buf up to date, start over for next accel */
+        for (i = 0; i < NR_PAGES; i++) {
+            if (encoded_len[i] > 0) {
+                memcpy(new_buf + i * PAGE_SIZE, old_buf + i * PAGE_SIZE,
+                       PAGE_SIZE);
+                dirty_page(new_buf + i * PAGE_SIZE, opts->pattern);
+            }
+        }
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(encoded);
+    g_free(encoded_len);
+}
+
+static const XbzrleBenchOpts bench_opts[] = {
+    { .name = "sparse", .pattern = XBZRLE_BENCH_SPARSE },
+    { .name = "clustered", .pattern = XBZRLE_BENCH_CLUSTERED },
+    { .name = "unchanged", .pattern = XBZRLE_BENCH_UNCHANGED },
+    { .name = "overflow", .pattern = XBZRLE_BENCH_OVERFLOW },
+};
+
+int main(int argc, char **argv)
+{
+    char *name;
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(bench_opts); i++) {
+        name = g_strdup_printf("/xbzrle/benchmark/%s", bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_xbzrle_speed);
+        g_free(name);
+    }
+
+    return g_test_run();
+}
@@ -15,6 +15,7 @@
 #include "libqos/libqtest.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
@@ -42,6 +43,11 @@ static bool uffd_feature_thread_id;
 #include <sys/vfs.h>
 #endif
 
+#if defined(__linux__) && defined(HOST_X86_64)
+#include <sys/ioctl.h>
+#include <linux/kvm.h>
+#endif
+
 #if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
@@ -472,6 +478,10 @@ typedef struct {
     bool use_shmem;
     /* only launch the target process */
     bool only_target;
+    /* send requested pages over the postcopy preempt channel */
+    bool postcopy_preempt;
+    /* give the source a KVM dirty ring, see kvm_dirty_ring_supported() */
+    bool use_dirty_ring;
     char *opts_source;
     char *opts_target;
 } MigrateStart;
@@ -578,11 +588,13 @@ static int test_migrate_start(QTestState **from, QTestState **to,
         shmem_opts = g_strdup("");
     }
 
-    cmd_source = g_strdup_printf("-accel kvm -accel tcg%s%s "
+    cmd_source = g_strdup_printf("-accel kvm%s -accel tcg%s%s "
                                  "-name source,debug-threads=on "
                                  "-m %s "
                                  "-serial file:%s/src_serial "
                                  "%s %s %s %s",
+                                 args->use_dirty_ring ?
+                                 ",dirty-ring-size=4096" : "",
                                  machine_opts ? " -machine " : "",
                                  machine_opts ? machine_opts : "",
                                  memory_size, tmpfs,
@@ -711,6 +723,7 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
 {
     char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     QTestState *from, *to;
+    bool postcopy_preempt = args->postcopy_preempt;
 
     if (test_migrate_start(&from, &to, uri, args)) {
         return -1;
@@ -720,6 +733,12 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
     migrate_set_capability(to, "postcopy-ram", true);
     migrate_set_capability(to, "postcopy-blocktime", true);
 
+    if (postcopy_preempt) {
+        migrate_set_capability(from, "postcopy-preempt", true);
+        migrate_set_capability(to, "postcopy-preempt", true);
+        migrate_set_parameter_int(to, "postcopy-prefetch-pages", 4);
+    }
+
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
      * machine, so also set the downtime.
@@ -767,6 +786,39 @@ static void test_postcopy(void)
     migrate_postcopy_complete(from, to);
 }
 
+static void test_postcopy_preempt(void)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    args->postcopy_preempt = true;
+
+    if (migrate_postcopy_prepare(&from, &to, args)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    wait_for_migration_complete(from);
+
+    /*
+     * The pages that the destination faulted on went over the preempt
+     * channel, rather than falling back to the main one.
+     */
+    g_assert_cmpint(read_ram_property_int(from, "postcopy-preempt-pages"),
+                    >, 0);
+
+    if (uffd_feature_thread_id) {
+        QDict *rsp_return = migrate_query(to);
+
+        g_assert_cmpint(qdict_get_int(rsp_return, "postcopy-page-faults"),
+                        >, 0);
+        g_assert_cmpint(qdict_get_int(rsp_return, "postcopy-prefetch-pages"),
+                        >, 0);
+        qobject_unref(rsp_return);
+    }
+
+    migrate_postcopy_complete(from, to);
+}
+
 static void test_postcopy_recovery(void)
 {
     MigrateStart *args = migrate_start_new();
@@ -945,8 +997,8 @@ static void test_xbzrle(const char *uri)
 
     migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
 
-    migrate_set_capability(from, "xbzrle", "true");
-    migrate_set_capability(to, "xbzrle", "true");
+    migrate_set_capability(from, "xbzrle", true);
+    migrate_set_capability(to, "xbzrle", true);
     /* Wait for the first serial output from the source */
     wait_for_serial("src_serial");
 
@@ -1266,7 +1318,421 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static bool kvm_dirty_ring_supported(void)
+{
+#if defined(__linux__) && defined(HOST_X86_64)
+    int ret, kvm_fd = open("/dev/kvm", O_RDONLY);
+
+    if (kvm_fd < 0) {
+        return false;
+    }
+
+    ret = ioctl(kvm_fd, KVM_CHECK_EXTENSION, KVM_CAP_DIRTY_LOG_RING);
+    close(kvm_fd);
+
+    /* The source is started with 4096 entries per ring */
+    return ret >= 4096;
+#else
+    return false;
+#endif
+}
+
+static void migrate_check_set_capability_error(QTestState *who,
+                                               const char *capability,
+                                               const char *error)
+{
+    QDict *rsp;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-capabilities',"
+                    "'arguments': { "
+                    "'capabilities': [ { "
+                    "'capability': %s, 'state': true } ] } }",
+                    capability);
+    g_assert(qdict_haskey(rsp, "error"));
+    g_assert_cmpstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    ==, error);
+    qobject_unref(rsp);
+}
+
+/* Return the result of query-vcpu-dirty-limit; the caller unrefs it */
+static QList *query_vcpu_dirty_limit(QTestState *who)
+{
+    QDict *rsp;
+    QList *list;
+
+    rsp = wait_command(who, "{ 'execute': 'query-vcpu-dirty-limit' }");
+    list = qdict_get_qlist(rsp, "return");
+    qobject_ref(list);
+    qobject_unref(rsp);
+    return list;
+}
+
+/*
+ * The dirty-limit capability needs the KVM dirty ring, and cannot be
+ * combined with auto-converge, which throttles all vCPUs the same.
+ */
+static void test_dirty_limit_caps(void)
+{
+    QTestState *who;
+    QList *list;
+
+    who = qtest_init("-machine none -accel tcg");
+
+    migrate_check_set_capability_error(who, "dirty-limit",
+                                       "Dirty limit requires the KVM "
+                                       "dirty ring");
+
+    migrate_set_capability(who, "auto-converge", true);
+    migrate_check_set_capability_error(who, "dirty-limit",
+                                       "Dirty limit is not compatible with "
+                                       "auto-converge");
+
+    /* Nothing is throttled */
+    list = query_vcpu_dirty_limit(who);
+    g_assert(qlist_empty(list));
+    qobject_unref(list);
+
+    qtest_quit(who);
+}
+
+/*
+ * Migrate a guest that dirties memory faster than the bandwidth allows,
+ * and check that dirty-limit throttles its vCPU, and only while the
+ * migration runs.
+ */
+static void test_dirty_limit(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    const int64_t dirty_limit = 50; /* MB/s */
+    QListEntry *entry;
+    QList *list;
+    QDict *info;
+    int64_t pct = 0;
+
+    if (!kvm_dirty_ring_supported()) {
+        g_test_skip("KVM dirty ring not supported");
+        migrate_start_destroy(args);
+        g_free(uri);
+        return;
+    }
+
+    args->use_dirty_ring = true;
+    if (test_migrate_start(&from, &to, uri, args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "dirty-limit", true);
+    migrate_set_parameter_int(from, "vcpu-dirty-limit", dirty_limit);
+
+    /* Set the parameters so that the migration cannot converge */
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    migrate_set_parameter_int(from, "max-bandwidth", 100000000); /* ~100Mb/s */
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+
+    /* Wait for the vCPU to be throttled */
+    while (pct == 0) {
+        usleep(100 * 1000);
+        g_assert_false(got_stop);
+
+        list = query_vcpu_dirty_limit(from);
+        QLIST_FOREACH_ENTRY(list, entry) {
+            info = qobject_to(QDict, qlist_entry_obj(entry));
+            g_assert_cmpint(qdict_get_int(info, "limit-rate"), ==,
+                            dirty_limit);
+            pct = MAX(pct, qdict_get_int(info, "throttle-percentage"));
+        }
+        qobject_unref(list);
+    }
+
+    /* auto-converge would have throttled the whole guest instead */
+    g_assert_cmpint(read_migrate_property_int(from, "cpu-throttle-percentage"),
+                    ==, 0);
+
+    /* Now let it converge */
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000); /* ~1Gb/s */
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /*
+     * The throttling ends with the migration thread, right after the
+     * migration has completed
+     */
+    for (;;) {
+        bool empty;
+
+        list = query_vcpu_dirty_limit(from);
+        empty = qlist_empty(list);
+        qobject_unref(list);
+        if (empty) {
+            break;
+        }
+        usleep(1000);
+    }
+
+    g_free(uri);
+
+    test_migrate_end(from, to, true);
+}
+
+/*
+ * Save the stopped source to a regular file with mapped-ram and load the
+ * destination from it, the way a snapshot to disk is taken and restored.
+ * The file is either passed with fd: or opened by QEMU with file:.
+ */
+static void test_mapped_ram(bool multifd, bool file_uri)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    char *path = g_strdup_printf("%s/migfile", tmpfs);
+    char *uri = file_uri ? g_strdup_printf("file:%s", path)
+                         : g_strdup("fd:fd-mig");
+    QDict *rsp;
+    int fd;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        g_free(uri);
+        g_free(path);
+        return;
+    }
+
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    rsp = wait_command(from, "{ 'execute': 'stop' }");
+    qobject_unref(rsp);
+
+    /* Save the source to the file */
+    if (!file_uri) {
+        fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0660);
+        g_assert_cmpint(fd, >=, 0);
+        rsp = wait_command_fd(from, fd,
+                              "{ 'execute': 'getfd',"
+                              "  'arguments': { 'fdname': 'fd-mig' }}");
+        qobject_unref(rsp);
+        close(fd);
+    }
+
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    /* Load the destination from the file */
+    if (!file_uri) {
+        fd = open(path, O_RDONLY);
+        g_assert_cmpint(fd, >=, 0);
+        rsp = wait_command_fd(to, fd,
+                              "{ 'execute': 'getfd',"
+                              "  'arguments': { 'fdname': 'fd-mig' }}");
+        qobject_unref(rsp);
+        close(fd);
+    }
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    wait_for_migration_complete(to);
+
+    /* The source was stopped, so the destination does not start by itself */
+    rsp = wait_command(to, "{ 'execute': 'cont' }");
+    qobject_unref(rsp);
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+
+    unlink(path);
+    g_free(uri);
+    g_free(path);
+}
+
+/*
+ * Save a running source to a file with mapped-ram, over several passes,
+ * and restore it.  Pages dirtied again must overwrite their slot in the
+ * file rather than be appended, and the destination must see their last
+ * contents.  That includes a page that became zero, which must be dropped
+ * from the file bitmap.
+ */
+static void test_mapped_ram_live(bool multifd)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    char *path = g_strdup_printf("%s/migfile", tmpfs);
+    char *uri = g_strdup_printf("file:%s", path);
+    uint8_t page[TEST_MEM_PAGE_SIZE];
+    unsigned zero_address;
+    int64_t ram_total;
+    struct stat st;
+    QDict *rsp;
+    int i;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        g_free(uri);
+        g_free(path);
+        return;
+    }
+
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+    }
+
+    /* Set the parameters so that the migration cannot converge yet */
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    migrate_set_parameter_int(from, "max-bandwidth", 100000000); /* ~100Mb/s */
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    /* A page past the memory that the guest writes to */
+    zero_address = end_address + 4 * 1024 * 1024;
+    qtest_memset(from, zero_address, 0xaa, TEST_MEM_PAGE_SIZE);
+
+    migrate_qmp(from, uri, "{}");
+
+    /* The guest keeps dirtying its memory in the meantime */
+    wait_for_migration_pass(from);
+    qtest_memset(from, zero_address, 0, TEST_MEM_PAGE_SIZE);
+    wait_for_migration_pass(from);
+    g_assert_cmpint(get_migration_pass(from), >=, 3);
+    g_assert_false(got_stop);
+
+    migrate_set_parameter_int(from, "downtime-limit", CONVERGE_DOWNTIME);
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000); /* ~1Gb/s */
+    wait_for_migration_complete(from);
+
+    /*
+     * Every RAMBlock has one slot per page in the file, aligned to 1 MiB,
+     * and the device state is small.  Appending the pages sent again
+     * would add most of the guest memory for each pass.
+     */
+    ram_total = read_ram_property_int(from, "total");
+    g_assert_cmpint(stat(path, &st), ==, 0);
+    g_assert_cmpint(st.st_size, <=, ram_total + 16 * 1024 * 1024);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+
+    /* The source was running, so the destination starts by itself */
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_migration_complete(to);
+
+    qtest_memread(to, zero_address, page, sizeof(page));
+    for (i = 0; i < sizeof(page); i++) {
+        g_assert_cmpint(page[i], ==, 0);
+    }
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+
+    unlink(path);
+    g_free(uri);
+    g_free(path);
+}
+
+static void test_mapped_ram_none(void)
+{
+    test_mapped_ram(false, false);
+}
+
+static void test_mapped_ram_multifd(void)
+{
+    test_mapped_ram(true, false);
+}
+
+static void test_mapped_ram_multifd_file(void)
+{
+    test_mapped_ram(true, true);
+}
+
+static void test_mapped_ram_live_none(void)
+{
+    test_mapped_ram_live(false);
+}
+
+static void test_mapped_ram_live_multifd(void)
+{
+    test_mapped_ram_live(true);
+}
+
+static void check_snapshot_refused(QTestState *who)
+{
+    QDict *rsp;
+    char *out;
+
+    out = qtest_hmp(who, "savevm snap0");
+    g_assert(strstr(out, "Snapshots cannot use the multifd or mapped-ram"));
+    g_free(out);
+
+    /* savevm fails before it stops the VM */
+    rsp = wait_command(who, "{ 'execute': 'query-status' }");
+    g_assert(qdict_get_bool(rsp, "running"));
+    qobject_unref(rsp);
+
+    out = qtest_hmp(who, "loadvm snap0");
+    g_assert(strstr(out, "Snapshots cannot use the multifd or mapped-ram"));
+    g_free(out);
+
+    /* loadvm leaves the VM stopped on failure, but it can go on */
+    qtest_qmp_discard_response(who, "{ 'execute': 'cont' }");
+    rsp = wait_command(who, "{ 'execute': 'query-status' }");
+    g_assert(qdict_get_bool(rsp, "running"));
+    qobject_unref(rsp);
+}
+
+/*
+ * Internal snapshots cannot use the multifd threads, savevm and loadvm
+ * must fail up front when multifd or mapped-ram is enabled.
+ */
+static void test_snapshot_multifd(void)
+{
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_set_capability(from, "multifd", true);
+    check_snapshot_refused(from);
+    migrate_set_capability(from, "multifd", false);
+
+    migrate_set_capability(from, "mapped-ram", true);
+    check_snapshot_refused(from);
+
+    test_migrate_end(from, to, false);
+}
+
+static void test_multifd_tcp(const char *method, bool zero_page)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1293,8 +1759,13 @@ static void test_multifd_tcp(const char *method)
     migrate_set_parameter_str(from, "multifd-compression", method);
     migrate_set_parameter_str(to, "multifd-compression", method);
 
-    migrate_set_capability(from, "multifd", "true");
-    migrate_set_capability(to, "multifd", "true");
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    if (zero_page) {
+        migrate_set_capability(from, "multifd-zero-page", true);
+        migrate_set_capability(to, "multifd-zero-page", true);
+    }
 
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
@@ -1325,21 +1796,36 @@ static void test_multifd_tcp(const char *method)
 
 static void test_multifd_tcp_none(void)
 {
-    test_multifd_tcp("none");
+    test_multifd_tcp("none", false);
 }
 
 static void test_multifd_tcp_zlib(void)
 {
-    test_multifd_tcp("zlib");
+    test_multifd_tcp("zlib", false);
 }
 
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
-    test_multifd_tcp("zstd");
+    test_multifd_tcp("zstd", false);
 }
 #endif
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    test_multifd_tcp("xbzrle", false);
+}
+
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp("none", true);
+}
+
+static void test_multifd_tcp_zero_page_zlib(void)
+{
+    test_multifd_tcp("zlib", true);
+}
+
 /*
  * This test does:
  *  source               target
@@ -1377,8 +1863,8 @@ static void test_multifd_tcp_cancel(void)
     migrate_set_parameter_int(from, "multifd-channels", 16);
     migrate_set_parameter_int(to, "multifd-channels", 16);
 
-    migrate_set_capability(from, "multifd", "true");
-    migrate_set_capability(to, "multifd", "true");
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
 
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
@@ -1405,7 +1891,7 @@ static void test_multifd_tcp_cancel(void)
 
     migrate_set_parameter_int(to2, "multifd-channels", 16);
 
-    migrate_set_capability(to2, "multifd", "true");
+    migrate_set_capability(to2, "multifd", true);
 
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to2, "{ 'execute': 'migrate-incoming',"
@@ -1486,6 +1972,7 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/postcopy/unix", test_postcopy);
     qtest_add_func("/migration/postcopy/recovery", test_postcopy_recovery);
+    qtest_add_func("/migration/postcopy/preempt", test_postcopy_preempt);
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
@@ -1493,6 +1980,14 @@ int main(int argc, char **argv)
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
+    qtest_add_func("/migration/mapped-ram", test_mapped_ram_none);
+    qtest_add_func("/migration/mapped-ram/multifd", test_mapped_ram_multifd);
+    qtest_add_func("/migration/mapped-ram/multifd/file",
+                   test_mapped_ram_multifd_file);
+    qtest_add_func("/migration/mapped-ram/live", test_mapped_ram_live_none);
+    qtest_add_func("/migration/mapped-ram/multifd/live",
+                   test_mapped_ram_live_multifd);
+    qtest_add_func("/migration/snapshot/multifd", test_snapshot_multifd);
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
     qtest_add_func("/migration/validate_uuid_src_not_set",
@@ -1501,12 +1996,19 @@ int main(int argc, char **argv)
                    test_validate_uuid_dst_not_set);
 
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
+    qtest_add_func("/migration/dirty_limit/caps", test_dirty_limit_caps);
+    qtest_add_func("/migration/dirty_limit", test_dirty_limit);
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
+    qtest_add_func("/migration/multifd/tcp/xbzrle", test_multifd_tcp_xbzrle);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
+    qtest_add_func("/migration/multifd/tcp/zero-page/zlib",
+                   test_multifd_tcp_zero_page_zlib);
 
     ret = g_test_run();
 
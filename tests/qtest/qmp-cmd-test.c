@@ -15,6 +15,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-introspect.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qapi/qobject-input-visitor.h"
 
 const char common_args[] = "-nodefaults -machine none";
@@ -329,6 +330,68 @@ static void test_object_add_failure_modes(void)
     qtest_quit(qts);
 }
 
+/* Return the query-iothreads entry of IOThread @id, or NULL */
+static QDict *query_iothread(QTestState *qts, const char *id)
+{
+    QDict *resp = qtest_qmp(qts, "{'execute': 'query-iothreads'}");
+    QDict *info = NULL;
+    QListEntry *entry;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(resp, "return"), entry) {
+        QDict *iothread = qobject_to(QDict, qlist_entry_obj(entry));
+
+        if (!strcmp(qdict_get_str(iothread, "id"), id)) {
+            info = qobject_ref(iothread);
+        }
+    }
+    qobject_unref(resp);
+
+    return info;
+}
+
+static void test_iothread_poll_percentile(void)
+{
+    QTestState *qts;
+    QDict *resp, *info;
+
+    qts = qtest_init(common_args);
+
+    resp = qtest_qmp(qts, "{'execute': 'object-add', 'arguments':"
+                     " {'qom-type': 'iothread', 'id': 'iothread0',"
+                     " 'props': {'poll-max-ns': 32768,"
+                     " 'poll-percentile': 90 } } }");
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+
+    info = query_iothread(qts, "iothread0");
+    g_assert_nonnull(info);
+    g_assert_cmpint(qdict_get_int(info, "poll-percentile"), ==, 90);
+    g_assert(qdict_haskey(info, "poll-time-ns"));
+    g_assert_cmpint(qlist_size(qdict_get_qlist(info, "poll-histogram")),
+                    ==, 20);
+    qobject_unref(info);
+
+    /* Percentiles above 100 make no sense */
+    resp = qtest_qmp(qts, "{'execute': 'qom-set', 'arguments':"
+                     " {'path': '/objects/iothread0',"
+                     " 'property': 'poll-percentile', 'value': 101 } }");
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    /* 0 goes back to poll-grow and poll-shrink */
+    resp = qtest_qmp(qts, "{'execute': 'qom-set', 'arguments':"
+                     " {'path': '/objects/iothread0',"
+                     " 'property': 'poll-percentile', 'value': 0 } }");
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+
+    info = query_iothread(qts, "iothread0");
+    g_assert_nonnull(info);
+    g_assert_cmpint(qdict_get_int(info, "poll-percentile"), ==, 0);
+    qobject_unref(info);
+
+    qtest_quit(qts);
+}
+
 int main(int argc, char *argv[])
 {
     QmpSchema schema;
@@ -341,6 +404,8 @@ int main(int argc, char *argv[])
 
     qtest_add_func("qmp/object-add-failure-modes",
                    test_object_add_failure_modes);
+    qtest_add_func("qmp/iothread-poll-percentile",
+                   test_iothread_poll_percentile);
 
     ret = g_test_run();
 
@@ -0,0 +1,177 @@
+/*
+ * QTest testcase for the TCG optimizer
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Run a few guest instructions under TCG with -d op_opt and check the
+ * ops that the optimizer produced for them.
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+#include "qemu/bswap.h"
+
+/* The virt board loads raw kernel images here and jumps to them */
+#define KERNEL_ADDR 0x40010000
+#define KERNEL64_ADDR 0x40080000
+
+#define ARM_ARGS "-cpu cortex-a15 -accel tcg"
+
+/*
+ * The conditional add sits behind a brcond that skips it when r1 is
+ * zero.  r0 is known to be 5 on both paths, so the add must be folded
+ * to a constant store into r2.
+ */
+static const uint32_t kernel_cond_branch[] = {
+    0xe3a00005,     /* mov r0, #5 */
+    0xe3510000,     /* cmp r1, #0 */
+    0x12802001,     /* addne r2, r0, #1 */
+    0xeafffffe,     /* b . */
+};
+
+/*
+ * Boot @kernel on the virt board with the CPU and accelerator options
+ * in @args, wait until it reaches its final self-loop and return the
+ * ops the optimizer produced for it.  @aarch64 says whether the CPU
+ * starts in AArch64 state.  If @info_jit is not NULL, also return the
+ * output of "info jit" there.
+ */
+static char *run_kernel(const char *args, bool aarch64,
+                        const uint32_t *kernel, size_t size, char **info_jit)
+{
+    char codetmp[] = "/tmp/qtest-tcg-opt-cXXXXXX";
+    char logtmp[] = "/tmp/qtest-tcg-opt-lXXXXXX";
+    uint64_t addr = aarch64 ? KERNEL64_ADDR : KERNEL_ADDR;
+    uint64_t end = addr + size - sizeof(uint32_t);
+    g_autofree char *loop_pc = aarch64
+        ? g_strdup_printf("PC=%016" PRIx64, end)
+        : g_strdup_printf("R15=%08" PRIx64, end);
+    g_autofree uint32_t *code = g_malloc(size);
+    QTestState *qts;
+    char *log = NULL;
+    ssize_t wlen;
+    int code_fd, log_fd, i;
+
+    for (i = 0; i < size / sizeof(uint32_t); i++) {
+        code[i] = cpu_to_le32(kernel[i]);
+    }
+    code_fd = mkstemp(codetmp);
+    g_assert(code_fd != -1);
+    wlen = write(code_fd, code, size);
+    g_assert(wlen == size);
+    close(code_fd);
+    log_fd = mkstemp(logtmp);
+    g_assert(log_fd != -1);
+    close(log_fd);
+
+    qts = qtest_initf("-M virt %s -kernel %s "
+                      "-d op_opt -D %s -dfilter 0x%" PRIx64 "+0x%zx",
+                      args, codetmp, logtmp, addr, size);
+    unlink(codetmp);
+
+    for (i = 0; i < 100; i++) {
+        g_autofree char *regs = qtest_hmp(qts, "info registers");
+
+        if (strstr(regs, loop_pc)) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmpint(i, <, 100);
+
+    if (info_jit) {
+        *info_jit = qtest_hmp(qts, "info jit");
+    }
+
+    /* The log is complete once QEMU has exited */
+    qtest_quit(qts);
+    g_assert(g_file_get_contents(logtmp, &log, NULL, NULL));
+    unlink(logtmp);
+
+    return log;
+}
+
+/*
+ * The flags set by the first cmp are only needed for the brcond that
+ * skips the add, and only ZF at that; the second cmp overwrites all of
+ * them after the label.  The other flags must not be computed.
+ */
+static const uint32_t kernel_cc_liveness[] = {
+    0xe3510000,     /* cmp r1, #0 */
+    0x12822001,     /* addne r2, r2, #1 */
+    0xe3520003,     /* cmp r2, #3 */
+    0xeafffffe,     /* b . */
+};
+
+/*
+ * The loop moves x1 to x2 through d0, which lives in the CPU state and
+ * is accessed with explicit stores and loads.  It runs well past the
+ * tier-up threshold, so its TB is translated a second time at tier 1.
+ */
+static const uint32_t kernel_tier_up[] = {
+    0xd2a00600,     /* mov x0, #(3 << 20) */
+    0xd5181040,     /* msr cpacr_el1, x0 (enable FP) */
+    0xd5033fdf,     /* isb */
+    0x9e670020,     /* 1: fmov d0, x1 */
+    0x9e660002,     /* fmov x2, d0 */
+    0x91000421,     /* add x1, x1, #1 */
+    0xf10fa03f,     /* cmp x1, #1000 */
+    0x54ffff81,     /* b.ne 1b */
+    0x14000000,     /* b . */
+};
+
+static void test_cond_branch(void)
+{
+    g_autofree char *log = run_kernel(ARM_ARGS, false, kernel_cond_branch,
+                                      sizeof(kernel_cond_branch), NULL);
+
+    g_assert_nonnull(strstr(log, "brcond_i32"));
+    g_assert_nonnull(strstr(log, "movi_i32 r2,$0x6"));
+}
+
+static void test_cc_liveness(void)
+{
+    g_autofree char *info_jit = NULL;
+    g_autofree char *log = run_kernel(ARM_ARGS, false, kernel_cc_liveness,
+                                      sizeof(kernel_cc_liveness), &info_jit);
+    const char *line = strstr(info_jit, "CC ops eliminated");
+    unsigned long eliminated;
+
+    g_assert_nonnull(line);
+    g_assert_cmpint(sscanf(line, "CC ops eliminated %lu", &eliminated), ==, 1);
+    g_assert_cmpuint(eliminated, >, 0);
+
+    /*
+     * The carry of "cmp r1, #0" is the constant 1, which would be stored
+     * to CF if the flag were synced at the brcond.
+     */
+    g_assert_nonnull(strstr(log, "brcond_i32 ZF"));
+    g_assert_null(strstr(log, "movi_i32 CF,"));
+}
+
+static void test_tier_up(void)
+{
+    g_autofree char *log = run_kernel("-cpu cortex-a57 "
+                                      "-accel tcg,tier-up-threshold=10",
+                                      true, kernel_tier_up,
+                                      sizeof(kernel_tier_up), NULL);
+    const char *tier0 = strstr(log, "ld_i64 x2,env,");
+
+    /* Tier 0 loads d0 back from env, tier 1 forwards the stored value */
+    g_assert_nonnull(tier0);
+    g_assert_nonnull(strstr(tier0, "mov_i64 x2,x1"));
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("tcg-opt/cond-branch", test_cond_branch);
+    qtest_add_func("tcg-opt/cc-liveness", test_cc_liveness);
+    if (!strcmp(qtest_get_arch(), "aarch64")) {
+        qtest_add_func("tcg-opt/tier-up", test_tier_up);
+    }
+
+    return g_test_run();
+}
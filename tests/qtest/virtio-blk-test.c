@@ -766,6 +766,97 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+#define VQ_IOTHREAD_QUEUES 4
+
+/* Do a one-sector request on @vq and return its status */
+static uint8_t vq_iothread_request(QVirtioDevice *dev, QVirtQueue *vq,
+                                   QGuestAllocator *alloc, uint32_t type,
+                                   uint64_t sector, char *data)
+{
+    QTestState *qts = global_qtest;
+    QVirtioBlkReq req = {
+        .type = type,
+        .ioprio = 1,
+        .sector = sector,
+        .data = data,
+    };
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t status;
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, type == VIRTIO_BLK_T_IN, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    if (type == VIRTIO_BLK_T_IN) {
+        memread(req_addr + 16, data, 512);
+    }
+
+    guest_free(alloc, req_addr);
+    return status;
+}
+
+/*
+ * The virtqueues are spread over two IOThreads, while the BlockBackend
+ * stays in the first one.  Write a sector through each virtqueue and
+ * read it back through a virtqueue that belongs to the other IOThread.
+ */
+static void vq_iothread(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QVirtioDevice *dev = &blk->pci_vdev.vdev;
+    QVirtQueue *vq[VQ_IOTHREAD_QUEUES];
+    uint64_t features;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    g_assert(features & (1u << VIRTIO_BLK_F_MQ));
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                    (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                    (1u << VIRTIO_RING_F_EVENT_IDX) |
+                    (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    g_assert_cmpint(qvirtio_config_readw(dev,
+                        offsetof(struct virtio_blk_config, num_queues)),
+                    ==, VQ_IOTHREAD_QUEUES);
+
+    for (i = 0; i < VQ_IOTHREAD_QUEUES; i++) {
+        vq[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(dev);
+
+    for (i = 0; i < VQ_IOTHREAD_QUEUES; i++) {
+        g_autofree char *buf = g_malloc0(512);
+
+        sprintf(buf, "TEST%d", i);
+        g_assert_cmpint(vq_iothread_request(dev, vq[i], t_alloc,
+                                            VIRTIO_BLK_T_OUT, i, buf),
+                        ==, VIRTIO_BLK_S_OK);
+    }
+
+    for (i = 0; i < VQ_IOTHREAD_QUEUES; i++) {
+        g_autofree char *expected = g_strdup_printf("TEST%d", i);
+        g_autofree char *buf = g_malloc0(512);
+        QVirtQueue *other = vq[(i + 1) % VQ_IOTHREAD_QUEUES];
+
+        g_assert_cmpint(vq_iothread_request(dev, other, t_alloc,
+                                            VIRTIO_BLK_T_IN, i, buf),
+                        ==, VIRTIO_BLK_S_OK);
+        g_assert_cmpstr(buf, ==, expected);
+    }
+
+    for (i = 0; i < VQ_IOTHREAD_QUEUES; i++) {
+        qvirtqueue_cleanup(dev->bus, vq[i], t_alloc);
+    }
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -780,6 +871,13 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *vq_iothread_setup(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=iothread0"
+                              " -object iothread,id=iothread1 ");
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -797,6 +895,12 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.before = vq_iothread_setup;
+    opts.edge.extra_device_opts = "num-queues=4,len-vq-iothread=2,"
+                                  "vq-iothread[0]=iothread0,"
+                                  "vq-iothread[1]=iothread1";
+    qos_add_test("vq-iothread", "virtio-blk-pci", vq_iothread, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
@@ -877,6 +877,97 @@ static void test_queue_chaining(void)
     g_assert_cmpint(data_b.i, ==, data_b.max);
 }
 
+#ifndef _WIN32
+/*
+ * Histogram-based polling.  Each round of events on a polled handler
+ * starts with one event after a long pause, followed by a few in quick
+ * succession.  The fast events fit in the polling time, the slow ones do
+ * not.
+ */
+#define POLL_MAX_NS         SCALE_MS
+#define POLL_SLOW_GAP_US    (20 * 1000)
+#define POLL_ROUNDS         8
+#define POLL_EVENTS         5
+
+static bool poll_never_ready(void *opaque)
+{
+    return false;
+}
+
+static uint64_t poll_histogram_events(void)
+{
+    uint64_t histogram[AIO_POLL_HISTOGRAM_BUCKETS];
+    uint64_t events = 0;
+    int i;
+
+    aio_context_get_poll_stats(ctx, histogram);
+    for (i = 0; i < AIO_POLL_HISTOGRAM_BUCKETS; i++) {
+        events += histogram[i];
+    }
+    return events;
+}
+
+/*
+ * Run the event pattern with @percentile and return the polling time
+ * that it resulted in.  Check that the histogram counted the intervals
+ * between events only if @percentile is non-zero.
+ */
+static int64_t run_poll_percentile(int64_t percentile)
+{
+    EventNotifierTestData data = { .n = 0 };
+    uint64_t events = poll_histogram_events();
+    int64_t poll_ns;
+    int i, j;
+
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, false, event_ready_cb,
+                           poll_never_ready);
+    aio_context_set_poll_params(ctx, POLL_MAX_NS, 0, 0, percentile,
+                                &error_abort);
+
+    for (i = 0; i < POLL_ROUNDS; i++) {
+        g_usleep(POLL_SLOW_GAP_US);
+        for (j = 0; j < POLL_EVENTS; j++) {
+            event_notifier_set(&data.e);
+            g_assert(aio_poll(ctx, false));
+        }
+    }
+    g_assert_cmpint(data.n, ==, POLL_ROUNDS * POLL_EVENTS);
+    poll_ns = ctx->poll_ns;
+
+    /* The first event has no predecessor */
+    g_assert_cmpint(poll_histogram_events() - events, ==,
+                    percentile ? POLL_ROUNDS * POLL_EVENTS - 1 : 0);
+
+    aio_context_set_poll_params(ctx, 0, 0, 0, 0, &error_abort);
+    set_event_notifier(ctx, &data.e, NULL);
+    event_notifier_cleanup(&data.e);
+
+    return poll_ns;
+}
+
+static void test_poll_percentile(void)
+{
+    int64_t poll_ns;
+
+    /* Low percentiles are covered by the fast events */
+    poll_ns = run_poll_percentile(25);
+    g_assert_cmpint(poll_ns, >, 0);
+    g_assert_cmpint(poll_ns, <=, POLL_MAX_NS);
+
+    poll_ns = run_poll_percentile(50);
+    g_assert_cmpint(poll_ns, >, 0);
+    g_assert_cmpint(poll_ns, <=, POLL_MAX_NS);
+
+    /* High ones need the slow events, polling is not worth it */
+    g_assert_cmpint(run_poll_percentile(95), ==, 0);
+    g_assert_cmpint(run_poll_percentile(100), ==, 0);
+
+    /* Without a percentile, poll-grow and poll-shrink are used instead */
+    run_poll_percentile(0);
+}
+#endif
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -901,6 +992,9 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifndef _WIN32
+    g_test_add_func("/aio/poll/percentile",         test_poll_percentile);
+#endif
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
 
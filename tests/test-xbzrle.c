@@ -169,8 +169,62 @@ static void test_encode_decode(void)
 {
     int i;
 
-    for (i = 0; i < 10000; i++) {
-        encode_decode_range();
+    do {
+        for (i = 0; i < 10000; i++) {
+            encode_decode_range();
+        }
+    } while (test_xbzrle_encode_next_accel());
+}
+
+/*
+ * All the encoder implementations must produce exactly the same stream,
+ * including when the destination buffer is too small.
+ */
+static void encode_accel_range(void)
+{
+    uint8_t *old_buf = g_malloc(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE);
+    uint8_t *ref = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    int dlen = g_test_rand_int_range(1, PAGE_SIZE + 1);
+    int nr_writes = g_test_rand_int_range(0, 256);
+    int i, j, ref_len, rc;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int_range(0, 4);
+    }
+    memcpy(new_buf, old_buf, PAGE_SIZE);
+    for (i = 0; i < nr_writes; i++) {
+        int start = g_test_rand_int_range(0, PAGE_SIZE);
+        int len = g_test_rand_int_range(1, 65);
+
+        for (j = start; j < start + len && j < PAGE_SIZE; j++) {
+            new_buf[j] = g_test_rand_int_range(0, 4);
+        }
+    }
+
+    ref_len = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, ref, dlen);
+    while (test_xbzrle_encode_next_accel()) {
+        rc = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, compressed,
+                                  dlen);
+        g_assert_cmpint(rc, ==, ref_len);
+        if (rc > 0) {
+            g_assert(memcmp(ref, compressed, rc) == 0);
+        }
+    }
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(ref);
+    g_free(compressed);
+}
+
+static void test_encode_accel(void)
+{
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        encode_accel_range();
     }
 }
 
@@ -186,6 +240,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -20,12 +20,19 @@
 #include "qemu/rcu_queue.h"
 #include "qemu/sockets.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "trace.h"
 #include "aio-posix.h"
 
 /* Stop userspace polling on a handler if it isn't active for some time */
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
+/* Minimum number of samples before a handler's histogram is trusted */
+#define POLL_HISTOGRAM_MIN_EVENTS 16
+
+/* Halve a handler's histogram once it has this many samples */
+#define POLL_HISTOGRAM_DECAY_EVENTS 1024
+
 bool aio_poll_disabled(AioContext *ctx)
 {
     return qatomic_read(&ctx->poll_disable_cnt);
@@ -134,6 +141,11 @@ void aio_set_fd_handler(AioContext *ctx,
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
+            new_node->poll_last_event = node->poll_last_event;
+            new_node->poll_ns = node->poll_ns;
+            new_node->poll_histogram_total = node->poll_histogram_total;
+            memcpy(new_node->poll_histogram, node->poll_histogram,
+                   sizeof(node->poll_histogram));
         }
         g_source_add_poll(&ctx->source, &new_node->pfd);
 
@@ -298,6 +310,81 @@ static void aio_free_deleted_handlers(AioContext *ctx)
     qemu_lockcnt_inc_and_unlock(&ctx->list_lock);
 }
 
+/* Histogram bucket for an inter-arrival time, see AioContext.poll_histogram */
+static int poll_histogram_bucket(int64_t interval_ns)
+{
+    if (interval_ns < 1024) {
+        return 0;
+    }
+    return MIN(63 - clz64(interval_ns) - 9, AIO_POLL_HISTOGRAM_BUCKETS - 1);
+}
+
+/*
+ * Pick the shortest polling time that covers ctx->poll_percentile percent of
+ * the handler's events, or 0 if even ctx->poll_max_ns is not enough.
+ */
+static void poll_update_handler_ns(AioContext *ctx, AioHandler *node)
+{
+    uint64_t target;
+    uint64_t sum = 0;
+    int i;
+
+    node->poll_ns = 0;
+    if (node->poll_histogram_total < POLL_HISTOGRAM_MIN_EVENTS) {
+        return;
+    }
+
+    target = DIV_ROUND_UP((uint64_t)node->poll_histogram_total *
+                          ctx->poll_percentile, 100);
+
+    /* The last bucket is unbounded, polling never covers it */
+    for (i = 0; i < AIO_POLL_HISTOGRAM_BUCKETS - 1; i++) {
+        int64_t limit = 1024LL << i;
+
+        sum += node->poll_histogram[i];
+        if (sum >= target) {
+            if (limit / 2 < ctx->poll_max_ns) {
+                node->poll_ns = MIN(limit, ctx->poll_max_ns);
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Account an event on a handler in its inter-arrival time histogram.  Only
+ * used when ctx->poll_percentile selects histogram-based polling.
+ */
+static void poll_record_event(AioContext *ctx, AioHandler *node, int64_t now)
+{
+    int bucket;
+    int i;
+
+    if (!ctx->poll_max_ns || !ctx->poll_percentile ||
+        node->opaque == &ctx->notifier) {
+        return;
+    }
+
+    if (node->poll_last_event && now > node->poll_last_event) {
+        bucket = poll_histogram_bucket(now - node->poll_last_event);
+
+        /* Decay old samples so that the histogram follows the workload */
+        if (node->poll_histogram_total >= POLL_HISTOGRAM_DECAY_EVENTS) {
+            node->poll_histogram_total = 0;
+            for (i = 0; i < AIO_POLL_HISTOGRAM_BUCKETS; i++) {
+                node->poll_histogram[i] /= 2;
+                node->poll_histogram_total += node->poll_histogram[i];
+            }
+        }
+
+        node->poll_histogram[bucket]++;
+        node->poll_histogram_total++;
+        stat64_add(&ctx->poll_histogram[bucket], 1);
+        poll_update_handler_ns(ctx, node);
+    }
+    node->poll_last_event = now;
+}
+
 static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
 {
     bool progress = false;
@@ -332,6 +419,11 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
         if (node->opaque != &ctx->notifier) {
             progress = true;
         }
+
+        if (node->io_poll && ctx->poll_percentile) {
+            poll_record_event(ctx, node,
+                              qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+        }
     }
     if (!QLIST_IS_INSERTED(node, node_deleted) &&
         (revents & (G_IO_OUT | G_IO_ERR)) &&
@@ -375,11 +467,22 @@ static bool aio_dispatch_handlers(AioContext *ctx)
     return progress;
 }
 
+static bool run_poll_handlers_once(AioContext *ctx,
+                                   int64_t now,
+                                   int64_t *timeout);
+
 void aio_dispatch(AioContext *ctx)
 {
     qemu_lockcnt_inc(&ctx->list_lock);
     aio_bh_poll(ctx);
     aio_dispatch_handlers(ctx);
+    if (qatomic_read(&ctx->busy_poll_cnt)) {
+        int64_t timeout = 0;
+
+        RCU_READ_LOCK_GUARD();
+        run_poll_handlers_once(ctx, qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+                               &timeout);
+    }
     aio_free_deleted_handlers(ctx);
     qemu_lockcnt_dec(&ctx->list_lock);
 
@@ -399,6 +502,11 @@ static bool run_poll_handlers_once(AioContext *ctx,
             node->io_poll(node->opaque)) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
 
+            if (ctx->poll_percentile) {
+                poll_record_event(ctx, node,
+                                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+            }
+
             /*
              * Polling was successful, exit try_poll_mode immediately
              * to adjust the next polling time.
@@ -436,6 +544,11 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
         return false;
     }
 
+    /* Busy polling handlers may legitimately wait longer than the interval */
+    if (qatomic_read(&ctx->busy_poll_cnt)) {
+        return false;
+    }
+
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
         if (node->poll_idle_timeout == 0LL) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
@@ -496,6 +609,8 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    stat64_add(&ctx->poll_time_ns, elapsed_time);
+
     if (remove_idle_poll_handlers(ctx, start_time + elapsed_time)) {
         *timeout = 0;
         progress = true;
@@ -529,7 +644,12 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
         return false;
     }
 
-    max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    if (qatomic_read(&ctx->busy_poll_cnt)) {
+        /* Nothing but polling reports progress, poll until the next timer */
+        max_ns = *timeout == -1 ? INT64_MAX : *timeout;
+    } else {
+        max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    }
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         poll_set_started(ctx, true);
 
@@ -546,6 +666,26 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
     return false;
 }
 
+/*
+ * Poll for as long as the handler that wants the longest polling time, so
+ * that each handler's target percentile of events is caught while polling.
+ */
+static void poll_update_ns_from_histograms(AioContext *ctx)
+{
+    AioHandler *node;
+    int64_t old = ctx->poll_ns;
+    int64_t poll_ns = 0;
+
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        poll_ns = MAX(poll_ns, node->poll_ns);
+    }
+
+    ctx->poll_ns = MIN(poll_ns, ctx->poll_max_ns);
+    if (ctx->poll_ns != old) {
+        trace_poll_percentile(ctx, old, ctx->poll_ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -569,7 +709,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     qemu_lockcnt_inc(&ctx->list_lock);
 
-    if (ctx->poll_max_ns) {
+    if (ctx->poll_max_ns && !ctx->poll_percentile) {
         start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     }
 
@@ -616,7 +756,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
     aio_notify_accept(ctx);
 
     /* Adjust polling time */
-    if (ctx->poll_max_ns) {
+    if (ctx->poll_max_ns && ctx->poll_percentile) {
+        poll_update_ns_from_histograms(ctx);
+    } else if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
         if (block_ns <= ctx->poll_ns) {
@@ -704,7 +846,8 @@ void aio_context_use_g_source(AioContext *ctx)
 }
 
 void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
-                                 int64_t grow, int64_t shrink, Error **errp)
+                                 int64_t grow, int64_t shrink,
+                                 int64_t percentile, Error **errp)
 {
     /* No thread synchronization here, it doesn't matter if an incorrect value
      * is used once.
@@ -713,6 +856,7 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     ctx->poll_ns = 0;
     ctx->poll_grow = grow;
     ctx->poll_shrink = shrink;
+    ctx->poll_percentile = percentile;
 
     aio_notify(ctx);
 }
@@ -36,6 +36,12 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+
+    /* Inter-arrival time histogram, see poll_record_event() */
+    int64_t poll_last_event;   /* when the last event was handled */
+    int64_t poll_ns;           /* polling time wanted by this handler */
+    uint32_t poll_histogram_total;
+    uint32_t poll_histogram[AIO_POLL_HISTOGRAM_BUCKETS];
     bool is_external;
 };
 
@@ -261,7 +261,8 @@ aio_ctx_prepare(GSource *source, gint    *timeout)
     /* We assume there is no timeout already supplied */
     *timeout = qemu_timeout_ns_to_ms(aio_compute_timeout(ctx));
 
-    if (aio_prepare(ctx)) {
+    /* Busy polling happens in aio_dispatch() when there is no aio_poll() */
+    if (aio_prepare(ctx) || qatomic_read(&ctx->busy_poll_cnt)) {
         *timeout = 0;
     }
 
@@ -292,7 +293,8 @@ aio_ctx_check(GSource *source)
             }
         }
     }
-    return aio_pending(ctx) || (timerlistgroup_deadline_ns(&ctx->tlg) == 0);
+    return aio_pending(ctx) || qatomic_read(&ctx->busy_poll_cnt) ||
+           (timerlistgroup_deadline_ns(&ctx->tlg) == 0);
 }
 
 static gboolean
@@ -401,7 +403,8 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->linux_io_uring_sqpoll,
+                                      ctx->linux_io_uring_sqpoll_cpu, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -417,6 +420,56 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
 }
 #endif
 
+uint64_t aio_get_linux_io_uring_sqpoll_wakeups(AioContext *ctx)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        return luring_get_sqpoll_wakeups(ctx->linux_io_uring);
+    }
+#endif
+    return 0;
+}
+
+uint64_t aio_context_get_poll_stats(AioContext *ctx, uint64_t *histogram)
+{
+    int i;
+
+    for (i = 0; i < AIO_POLL_HISTOGRAM_BUCKETS; i++) {
+        histogram[i] = stat64_get(&ctx->poll_histogram[i]);
+    }
+    return stat64_get(&ctx->poll_time_ns);
+}
+
+void aio_context_begin_busy_poll(AioContext *ctx)
+{
+    qatomic_inc(&ctx->busy_poll_cnt);
+}
+
+void aio_context_end_busy_poll(AioContext *ctx)
+{
+    int old = qatomic_fetch_dec(&ctx->busy_poll_cnt);
+
+    assert(old > 0);
+}
+
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int sqpoll_cpu, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        error_setg(errp, "io_uring parameters cannot be changed after the "
+                   "ring was created");
+        return;
+    }
+    ctx->linux_io_uring_sqpoll = sqpoll;
+    ctx->linux_io_uring_sqpoll_cpu = sqpoll_cpu;
+#else
+    if (sqpoll) {
+        error_setg(errp, "io_uring is not supported in this build");
+    }
+#endif
+}
+
 void aio_notify(AioContext *ctx)
 {
     /*
@@ -526,6 +579,8 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_sqpoll = false;
+    ctx->linux_io_uring_sqpoll_cpu = -1;
 #endif
 
     ctx->thread_pool = NULL;